@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -6,12 +7,45 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <signal.h>
+#include "dhcp_options.h"
+#include "dhcp_log.h"
+#include "dhcp_raw.h"
 
 // Definiciones de tipos de mensajes DHCP y otros parámetros
 #define DHCP_DISCOVER 1       // Tipo de mensaje DHCP Discover
+#define DHCP_OFFER 2          // Tipo de mensaje DHCP Offer
 #define DHCP_REQUEST 3        // Tipo de mensaje DHCP Request
 #define DHCP_MAGIC_COOKIE 0x63825363  // Valor fijo para identificar mensajes DHCP
 #define LEASE_TIME 60         // Duración del lease en segundos (para la simulación)
+#define DHCP_ACK 5            // Tipo de mensaje DHCP ACK
+#define DHCP_NAK 6            // Tipo de mensaje DHCP NAK
+#define DHCP_RELEASE 7        // Tipo de mensaje DHCP Release
+#define DHCP_MIN_LEN 300      // Tamaño mínimo de un mensaje BOOTP (RFC 1542)
+#define DHCP_SERVER_PORT 67   // Puerto del servidor: destino de renovaciones y reenlaces
+#define LOAD_BATCH 64         // Datagramas por recvmmsg/sendmmsg en el generador
+#define LOAD_TIMEOUT_MS 1000  // Tiempo máximo de espera de una respuesta
+#define FLOOD_XID 0x80000000u // Marca en el xid de los DISCOVER de la inundación
+#define LAT_SUB_BITS 4        // Precisión del histograma: 16 sub-buckets por potencia de 2
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+#define AGENT_INDEX_BITS 20   // Bits bajos del xid del agente con el índice del lease
+#define AGENT_MAX_LEASES (1u << AGENT_INDEX_BITS)
+#define AGENT_RETRANSMIT_MS 4000      // Primer reenvío; se dobla hasta AGENT_RETRANSMIT_MAX_MS
+#define AGENT_RETRANSMIT_MAX_MS 64000
+#define AGENT_JITTER_MS 1000          // Aleatoriedad de ±1 s en cada reenvío
+#define AGENT_MIN_RETRANSMIT_MS 1000  // Reenvío mínimo al acercarse a T2 o al vencimiento
+#define AGENT_REQUEST_TRIES 4         // REQUEST sin ACK antes de volver a INIT
+#define AGENT_START_SPREAD_MS 1000    // Retardo aleatorio del primer DISCOVER de cada lease
+#define AGENT_T_FUZZ 0.05             // Variación aleatoria de T1 y T2 (±5%)
 
 // Estructura que representa un paquete DHCP
 struct dhcp_packet {
@@ -33,17 +67,11 @@ struct dhcp_packet {
     uint8_t options[312];  // Opciones DHCP
 };
 
-// Variable global para almacenar el xid del cliente (identificador de transacción)
-uint32_t global_xid = 0;
-
-// Función auxiliar para imprimir los bytes de una dirección IP
-void print_ip_bytes(uint32_t ip) {
-    unsigned char *bytes = (unsigned char *)&ip;
-    printf("IP address bytes: %d.%d.%d.%d\n", bytes[0], bytes[1], bytes[2], bytes[3]);
-}
+// Dirección MAC del cliente
+uint8_t client_mac[6] = {0x00, 0x0c, 0x29, 0x3e, 0x53, 0xf7};
 
 // Construye un paquete DHCP Discover para que el cliente busque un servidor DHCP
-void construct_dhcp_discover(struct dhcp_packet *packet, uint32_t xid) {
+void construct_dhcp_discover(struct dhcp_packet *packet, uint32_t xid, const uint8_t *mac) {
     memset(packet, 0, sizeof(struct dhcp_packet));  // Limpia el paquete
 
     packet->op = 1;  // Cliente -> Servidor (solicitud)
@@ -60,12 +88,7 @@ void construct_dhcp_discover(struct dhcp_packet *packet, uint32_t xid) {
     packet->giaddr = htonl(0);  // No hay relay
 
     // Dirección MAC del cliente
-    packet->chaddr[0] = 0x00;
-    packet->chaddr[1] = 0x0c;
-    packet->chaddr[2] = 0x29;
-    packet->chaddr[3] = 0x3e;
-    packet->chaddr[4] = 0x53;
-    packet->chaddr[5] = 0xf7;
+    memcpy(packet->chaddr, mac, 6);
 
     packet->magic_cookie = htonl(DHCP_MAGIC_COOKIE);  // Agrega la cookie mágica
 
@@ -77,7 +100,7 @@ void construct_dhcp_discover(struct dhcp_packet *packet, uint32_t xid) {
 }
 
 // Construye un paquete DHCP Request para solicitar una IP ofrecida
-void construct_dhcp_request(struct dhcp_packet *packet, uint32_t offered_ip, uint32_t xid) {
+void construct_dhcp_request(struct dhcp_packet *packet, uint32_t offered_ip, uint32_t xid, const uint8_t *mac) {
     memset(packet, 0, sizeof(struct dhcp_packet));  // Limpia el paquete
 
 
@@ -94,7 +117,7 @@ void construct_dhcp_request(struct dhcp_packet *packet, uint32_t offered_ip, uin
     packet->giaddr = 0;  // No hay relay
 
     // Dirección MAC del cliente
-    memcpy(packet->chaddr, (uint8_t[]){0x00, 0x0c, 0x29, 0x3e, 0x53, 0xf7}, 6);
+    memcpy(packet->chaddr, mac, 6);
 
     packet->magic_cookie = htonl(DHCP_MAGIC_COOKIE);  // Agrega la cookie mágica
 
@@ -108,149 +131,1094 @@ void construct_dhcp_request(struct dhcp_packet *packet, uint32_t offered_ip, uin
     packet->options[9] = 255;  // Fin de las opciones
 }
 
-// Función para renovar el lease de la IP solicitada
-void renew_lease(int sock, struct sockaddr_in *relay_addr, uint32_t offered_ip, uint32_t xid) {
-    struct dhcp_packet dhcp_request;
-    socklen_t relay_addr_len = sizeof(*relay_addr);
+// ---------------------------------------------------------------------------
+// Generador de carga: simula muchas MACs virtuales desde un solo proceso
+// dirigido por eventos (epoll + timerfd) y mide la latencia de cada fase.
+// ---------------------------------------------------------------------------
 
-    // Construir y enviar un paquete DHCP Request para renovar el lease
-    construct_dhcp_request(&dhcp_request, offered_ip, xid);
-    if (sendto(sock, &dhcp_request, sizeof(dhcp_request), 0, (struct sockaddr *)relay_addr, relay_addr_len) < 0) {
-        perror("Error al enviar DHCP Request para renovación");
-        close(sock);
-        exit(1);
+enum vclient_state {
+    VC_IDLE,         // Sin lease
+    VC_WAIT_OFFER,   // DISCOVER enviado
+    VC_WAIT_ACK,     // REQUEST tras el OFFER
+    VC_BOUND,        // Con lease
+    VC_WAIT_RENEW,   // REQUEST de renovación enviado
+};
+
+enum load_phase {
+    PHASE_DISCOVER,  // DISCOVER -> OFFER
+    PHASE_REQUEST,   // REQUEST -> ACK
+    PHASE_RENEW,     // REQUEST de renovación -> ACK
+    PHASE_COUNT,
+};
+
+const char *phase_names[PHASE_COUNT] = { "DISCOVER->OFFER", "REQUEST->ACK", "RENEW->ACK" };
+
+// Estado de cada cliente virtual; el xid de sus mensajes es su índice
+struct vclient {
+    uint8_t state;
+    uint8_t phase;
+    uint32_t ip;        // IP ofrecida o asignada (orden de red)
+    uint64_t sent_ns;   // Momento del último envío, 0 si no espera respuesta
+    int32_t prev, next; // Enlaces en la lista de espera de respuesta
+};
+
+// Histograma log-lineal al estilo HDR: error relativo < 1/16
+struct latency_hist {
+    uint64_t counts[LAT_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+struct load_config {
+    struct sockaddr_in target;
+    uint32_t clients;     // MACs virtuales
+    double rate;          // Transacciones iniciadas por segundo
+    double renew_mix;     // Fracción de transacciones que son renovaciones
+    double loss;          // Probabilidad de descartar un envío (pérdida simulada)
+    int duration;         // Segundos de prueba
+    double flood_rate;    // DISCOVER por segundo desde MACs falsas aleatorias (0 = sin inundación)
+    const char *interface;  // Enviar como clientes sin dirección: broadcast desde 0.0.0.0 por esta interfaz
+};
+
+// Datagrama del generador. En modo broadcast (-i) viaja con sus cabeceras
+// IPv4 y UDP por un socket de paquetes; si no, solo el mensaje DHCP.
+struct load_frame {
+    uint8_t headers[RAW_HEADERS_LEN];
+    struct dhcp_packet dhcp;
+};
+
+struct load_stats {
+    uint64_t sent[PHASE_COUNT];
+    uint64_t completed[PHASE_COUNT];
+    uint64_t timeouts[PHASE_COUNT];
+    uint64_t dropped;     // Envíos descartados por la pérdida simulada
+    uint64_t unexpected;  // Respuestas que no corresponden a una transacción abierta
+    uint64_t skipped;     // Llegadas sin MAC libre ni con lease
+    uint64_t flooded;     // DISCOVER de la inundación enviados
+    uint64_t flood_replies;  // ... que recibieron respuesta
+    struct latency_hist hist[PHASE_COUNT];
+};
+
+// Clientes esperando respuesta, ordenados por hora de envío. Como el timeout
+// es fijo, basta con mirar la cabeza para encontrar los vencidos.
+struct wait_list {
+    int32_t head, tail;
+    uint32_t count;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_bucket(uint64_t v) {
+    if (v < (1u << LAT_SUB_BITS)) {
+        return (int)v;
     }
-    printf("DHCP Request enviado para renovación del lease.\n");
+    int msb = 63 - __builtin_clzll(v);
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + (int)((v >> (msb - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1));
 }
 
-// Función para analizar las opciones del paquete DHCP recibido (máscara, gateway, DNS)
-void parse_dhcp_options(uint8_t *options, uint32_t *subnet_mask, uint32_t *gateway, uint32_t *dns_server) {
-    int i = 0;
-    // Recorre las opciones hasta encontrar el fin de opciones (255)
-    while (i < 312 && options[i] != 255) {
-        switch (options[i]) {
-            case 1:  // Máscara de red
-                memcpy(subnet_mask, &options[i + 2], 4);  // La máscara es de 4 bytes
-                break;
-            case 3:  // Puerta de enlace (gateway)
-                memcpy(gateway, &options[i + 2], 4);  // El gateway es de 4 bytes
-                break;
-            case 6:  // Servidor DNS
-                memcpy(dns_server, &options[i + 2], 4);  // El servidor DNS es de 4 bytes
-                break;
-            default:
-                break;
+static uint64_t hist_value(int bucket) {
+    if (bucket < (1 << LAT_SUB_BITS)) {
+        return bucket;
+    }
+    int msb = (bucket >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << LAT_SUB_BITS) - 1);
+    return ((1ull << LAT_SUB_BITS) + sub + 1) << (msb - LAT_SUB_BITS);
+}
+
+static void hist_record(struct latency_hist *hist, uint64_t ns) {
+    hist->counts[hist_bucket(ns)]++;
+    hist->total++;
+    if (ns > hist->max) {
+        hist->max = ns;
+    }
+}
+
+static uint64_t hist_percentile(const struct latency_hist *hist, double p) {
+    uint64_t target = (uint64_t)(hist->total * p / 100.0);
+    uint64_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += hist->counts[b];
+        if (seen > target) {
+            return hist_value(b);
         }
-        i += options[i + 1] + 2;  // Avanzar al siguiente campo (tipo + longitud)
     }
+    return hist->max;
 }
 
-// Función principal del cliente DHCP
-int main() {
-    int sock;
-    struct sockaddr_in relay_addr;
-    struct dhcp_packet dhcp_request, dhcp_ack, dhcp_offer;
-    socklen_t relay_addr_len = sizeof(relay_addr);
-    uint32_t offered_ip, ack_ip, subnet_mask = 0, gateway = 0, dns_server = 0;
-    time_t lease_start;  // Hora de inicio del lease
-    int lease_duration = LEASE_TIME;  // Duración del lease en segundos
-
-    // Inicializar la semilla de números aleatorios para generar el xid
-    srand(time(NULL));
-
-    // Crear un socket UDP
-    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("Error al crear socket");
-        return 1;
+// MAC de un cliente virtual: prefijo local 02:00 seguido del índice
+static void vclient_mac(uint32_t index, uint8_t *mac) {
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    mac[2] = index >> 24;
+    mac[3] = index >> 16;
+    mac[4] = index >> 8;
+    mac[5] = index;
+}
+
+static void wait_unlink(struct vclient *clients, struct wait_list *list, int32_t index) {
+    struct vclient *vc = &clients[index];
+    if (vc->sent_ns == 0) {
+        return;  // No está en la lista
     }
+    if (vc->prev >= 0) {
+        clients[vc->prev].next = vc->next;
+    } else {
+        list->head = vc->next;
+    }
+    if (vc->next >= 0) {
+        clients[vc->next].prev = vc->prev;
+    } else {
+        list->tail = vc->prev;
+    }
+    vc->sent_ns = 0;
+    list->count--;
+}
 
-    // Configurar la dirección del relay o servidor DHCP
-    memset(&relay_addr, 0, sizeof(relay_addr));
-    relay_addr.sin_family = AF_INET;
-    relay_addr.sin_port = htons(1067);  // Puerto donde escucha el servidor/relay
-    relay_addr.sin_addr.s_addr = inet_addr("192.168.0.2");  // Dirección del relay o servidor DHCP
+static void wait_append(struct vclient *clients, struct wait_list *list, int32_t index, uint64_t sent_ns) {
+    struct vclient *vc = &clients[index];
+    wait_unlink(clients, list, index);
+    vc->sent_ns = sent_ns;
+    vc->prev = list->tail;
+    vc->next = -1;
+    if (list->tail >= 0) {
+        clients[list->tail].next = index;
+    } else {
+        list->head = index;
+    }
+    list->tail = index;
+    list->count++;
+}
 
-    // Habilitar el uso de broadcast en el socket
-    int broadcastEnable = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable)) < 0) {
-        perror("Error al habilitar broadcast");
-        close(sock);
-        return 1;
+static double random_unit(void) {
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+// Envía los mensajes encolados con un solo sendmmsg
+static void flush_sends(int sock, struct mmsghdr *msgs, int *pending) {
+    int sent = 0;
+    while (sent < *pending) {
+        int n = sendmmsg(sock, msgs + sent, *pending - sent, 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error al enviar lote");
+            }
+            break;  // Lo no enviado se trata como perdido y vencerá
+        }
+        sent += n;
     }
+    *pending = 0;
+}
 
-    // Enviar un DHCP Discover al relay o servidor
-    printf("Enviando DHCP Discover al relay en IP: %s\n", inet_ntoa(relay_addr.sin_addr));
-    global_xid = rand();  // Generar un identificador único (xid) para la transacción
-    construct_dhcp_discover(&dhcp_request, global_xid);  // Construir el paquete DHCP Discover
+// El informe final va directo a stdout, después de lo que quede en el registro
+void print_load_report(const struct load_stats *stats, double seconds) {
+    log_flush();
+    printf("\n%-16s %10s %10s %9s %9s %9s %9s %9s %9s\n", "fase", "enviadas", "ok", "timeouts",
+           "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const struct latency_hist *h = &stats->hist[p];
+        printf("%-16s %10lu %10lu %9lu %9.1f %9.1f %9.1f %9.1f %9.1f\n", phase_names[p],
+               (unsigned long)stats->sent[p], (unsigned long)stats->completed[p], (unsigned long)stats->timeouts[p],
+               hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3, hist_percentile(h, 99) / 1e3,
+               hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+    }
+    uint64_t done = 0;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        done += stats->completed[p];
+    }
+    printf("Throughput: %.0f transacciones/s completadas; descartes simulados %lu; respuestas inesperadas %lu; "
+           "llegadas sin MAC disponible %lu\n", done / seconds, (unsigned long)stats->dropped,
+           (unsigned long)stats->unexpected, (unsigned long)stats->skipped);
+    if (stats->flooded > 0) {
+        printf("Inundación: %lu DISCOVER desde MACs falsas, %lu respondidos (%.1f%%)\n", (unsigned long)stats->flooded,
+               (unsigned long)stats->flood_replies, 100.0 * stats->flood_replies / stats->flooded);
+    }
+}
 
-    // Enviar el paquete DHCP Discover
-    if (sendto(sock, &dhcp_request, sizeof(dhcp_request), 0, (struct sockaddr *)&relay_addr, relay_addr_len) < 0) {
-        perror("Error al enviar DHCP Discover");
+// Socket de paquetes para el modo broadcast: envía datagramas IPv4 completos
+// a la MAC de broadcast de la interfaz y solo recibe UDP al puerto 68
+static int open_broadcast_socket(const char *interface, struct sockaddr_ll *dest) {
+    int sock = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        perror("Error al crear el socket de paquetes");
+        return -1;
+    }
+    memset(dest, 0, sizeof(*dest));
+    dest->sll_family = AF_PACKET;
+    dest->sll_protocol = htons(ETH_P_IP);
+    dest->sll_ifindex = if_nametoindex(interface);
+    dest->sll_halen = 6;
+    memset(dest->sll_addr, 0xFF, 6);
+    if (dest->sll_ifindex == 0) {
+        fprintf(stderr, "Interfaz desconocida: %s\n", interface);
         close(sock);
-        return 1;
+        return -1;
+    }
+    // El filtro va antes del bind: así no se cuela ningún paquete sin filtrar
+    if (raw_attach_udp_filter(sock, 0, 68) < 0 || bind(sock, (struct sockaddr *)dest, sizeof(*dest)) < 0) {
+        perror("Error al preparar el socket de paquetes");
+        close(sock);
+        return -1;
     }
+    return sock;
+}
 
-        printf("DHCP Discover enviado con xid = %u.\n", global_xid);
+// Completa las cabeceras de un mensaje ya construido en modo broadcast
+static void load_seal(const struct load_config *cfg, struct load_frame *frame) {
+    if (cfg->interface != NULL) {
+        raw_build_ipv4_udp(frame->headers, 0, INADDR_BROADCAST, 68, 67, DHCP_MIN_LEN);
+    }
+}
 
-    // Esperar un paquete DHCP Offer
-    if (recvfrom(sock, &dhcp_offer, sizeof(dhcp_offer), 0, (struct sockaddr *)&relay_addr, &relay_addr_len) < 0) {
-        perror("Error al recibir DHCP Offer");
-        close(sock);
+int run_load_generator(const struct load_config *cfg) {
+    struct vclient *clients = calloc(cfg->clients, sizeof(struct vclient));
+    struct load_stats *stats = calloc(1, sizeof(struct load_stats));
+    struct load_frame *tx = calloc(LOAD_BATCH, sizeof(struct load_frame));
+    struct load_frame *rx = calloc(LOAD_BATCH, sizeof(struct load_frame));
+    if (!clients || !stats || !tx || !rx) {
+        perror("Error al asignar el estado del generador");
+        return 1;
+    }
+    struct wait_list waiting = { -1, -1, 0 };
+
+    struct sockaddr_ll broadcast_dest;
+    int sock = cfg->interface != NULL ? open_broadcast_socket(cfg->interface, &broadcast_dest)
+                                      : socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        if (cfg->interface == NULL) {
+            perror("Error al crear socket");
+        }
         return 1;
     }
+    int bufsize = 8 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
 
-    offered_ip = dhcp_offer.yiaddr;  // Dirección IP ofrecida (en formato de red)
-    printf("DHCP Offer recibido: IP ofrecida = %s\n", inet_ntoa(*(struct in_addr *)&offered_ip));
+    // Temporizador de 1 ms para el ritmo de llegadas y los vencimientos
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec tick = { { 0, 1000000 }, { 0, 1000000 } };
+    timerfd_settime(timer_fd, 0, &tick, NULL);
 
-    // Imprimir los bytes de la IP ofrecida para verificar el orden
-    print_ip_bytes(dhcp_offer.yiaddr);
+    int ep = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sock };
+    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, timer_fd, &ev);
 
-    // Analizar las opciones del DHCP Offer (máscara de red, gateway, DNS)
-    parse_dhcp_options(dhcp_offer.options, &subnet_mask, &gateway, &dns_server);
-    printf("Subnet Mask: %s\n", inet_ntoa(*(struct in_addr *)&subnet_mask));
-    printf("Gateway: %s\n", inet_ntoa(*(struct in_addr *)&gateway));
-    printf("DNS Server: %s\n", inet_ntoa(*(struct in_addr *)&dns_server));
+    struct mmsghdr tx_msgs[LOAD_BATCH], rx_msgs[LOAD_BATCH];
+    struct iovec tx_iov[LOAD_BATCH], rx_iov[LOAD_BATCH];
+    memset(tx_msgs, 0, sizeof(tx_msgs));
+    memset(rx_msgs, 0, sizeof(rx_msgs));
+    // En modo broadcast los buffers empiezan en la cabecera IPv4
+    size_t headers = cfg->interface != NULL ? RAW_HEADERS_LEN : 0;
+    for (int i = 0; i < LOAD_BATCH; i++) {
+        tx_iov[i].iov_base = (uint8_t *)&tx[i].dhcp - headers;
+        tx_iov[i].iov_len = headers + DHCP_MIN_LEN;
+        tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+        tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        if (cfg->interface != NULL) {
+            tx_msgs[i].msg_hdr.msg_name = &broadcast_dest;
+            tx_msgs[i].msg_hdr.msg_namelen = sizeof(broadcast_dest);
+        } else {
+            tx_msgs[i].msg_hdr.msg_name = (void *)&cfg->target;
+            tx_msgs[i].msg_hdr.msg_namelen = sizeof(cfg->target);
+        }
+        rx_iov[i].iov_base = (uint8_t *)&rx[i].dhcp - headers;
+        rx_iov[i].iov_len = headers + sizeof(struct dhcp_packet);
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 
-    // Enviar un DHCP Request para solicitar la IP ofrecida
-    renew_lease(sock, &relay_addr, offered_ip, global_xid);
+    uint64_t start = now_ns(), end = start + (uint64_t)cfg->duration * 1000000000ull;
+    uint64_t started = 0, last_report = start, last_done = 0;
+    uint32_t next_new = 0, bound = 0;
+    int pending_tx = 0;
 
-    // Esperar un paquete DHCP ACK
-    if (recvfrom(sock, &dhcp_ack, sizeof(dhcp_ack), 0, (struct sockaddr *)&relay_addr, &relay_addr_len) < 0) {
-        perror("Error al recibir DHCP ACK");
-        close(sock);
-        return 1;
+    if (cfg->interface != NULL) {
+        LOG(LOG_INFO, "Generador de carga: %u MACs en broadcast por %s durante %d s", cfg->clients, cfg->interface,
+            cfg->duration);
+    } else {
+        LOG(LOG_INFO, "Generador de carga: %u MACs contra %I:%u durante %d s", cfg->clients,
+            cfg->target.sin_addr.s_addr, ntohs(cfg->target.sin_port), cfg->duration);
+    }
+    LOG(LOG_INFO, "Generador de carga: %.0f trans/s, %.0f%% renovaciones, %.1f%% pérdida", cfg->rate,
+        cfg->renew_mix * 100, cfg->loss * 100);
+    if (cfg->flood_rate > 0) {
+        LOG(LOG_INFO, "Generador de carga: inundación de %.0f DISCOVER/s desde MACs falsas", cfg->flood_rate);
     }
 
-    ack_ip = dhcp_ack.yiaddr;  // IP confirmada (en formato de red)
-    printf("DHCP ACK recibido: IP reconocida = %s\n", inet_ntoa(*(struct in_addr *)&ack_ip));
+    // Encola un envío para el cliente en la fase dada (se vacía con sendmmsg)
+    #define QUEUE_SEND(index, message_phase) do { \
+        struct vclient *vc_ = &clients[index]; \
+        uint8_t mac_[6]; \
+        vclient_mac(index, mac_); \
+        if ((message_phase) == PHASE_DISCOVER) { \
+            construct_dhcp_discover(&tx[pending_tx].dhcp, index, mac_); \
+        } else { \
+            construct_dhcp_request(&tx[pending_tx].dhcp, vc_->ip, index, mac_); \
+        } \
+        load_seal(cfg, &tx[pending_tx]); \
+        vc_->phase = (message_phase); \
+        wait_append(clients, &waiting, index, now_ns()); \
+        stats->sent[message_phase]++; \
+        if (random_unit() < cfg->loss) { \
+            stats->dropped++; \
+        } else if (++pending_tx == LOAD_BATCH) { \
+            flush_sends(sock, tx_msgs, &pending_tx); \
+        } \
+    } while (0)
 
+    while (1) {
+        struct epoll_event events[2];
+        int n = epoll_wait(ep, events, 2, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        uint64_t now = now_ns();
+        if (now >= end) {
+            break;
+        }
+
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+                    continue;
+                }
+                // Hora fresca: el lote de respuestas anterior pudo enviar después de 'now'
+                now = now_ns();
 
-    // Registrar la hora de inicio del lease
-    lease_start = time(NULL);
+                // Vencimientos: la lista está ordenada por hora de envío
+                while (waiting.head >= 0 && now - clients[waiting.head].sent_ns >= LOAD_TIMEOUT_MS * 1000000ull) {
+                    struct vclient *vc = &clients[waiting.head];
+                    stats->timeouts[vc->phase]++;
+                    if (vc->state == VC_WAIT_RENEW) {
+                        vc->state = VC_BOUND;
+                        bound++;
+                    } else {
+                        vc->state = VC_IDLE;
+                    }
+                    wait_unlink(clients, &waiting, waiting.head);
+                }
 
-    // Bucle para renovar el lease antes de que expire
-    while (1) {  // Repetir indefinidamente
-        sleep(lease_duration / 2);  // Dormir hasta la mitad del lease
+                // Llegadas según la tasa configurada
+                uint64_t due = (uint64_t)((now - start) / 1e9 * cfg->rate);
+                while (started < due) {
+                    started++;
+                    if (bound > 0 && random_unit() < cfg->renew_mix) {
+                        // Renovar un cliente con lease elegido al azar
+                        uint32_t index = (uint32_t)(random_unit() * cfg->clients);
+                        for (uint32_t probe = 0; probe < cfg->clients && clients[index].state != VC_BOUND; probe++) {
+                            index = (index + 1) % cfg->clients;
+                        }
+                        clients[index].state = VC_WAIT_RENEW;
+                        bound--;
+                        QUEUE_SEND(index, PHASE_RENEW);
+                    } else {
+                        // Nuevo cliente: el siguiente sin lease
+                        uint32_t probe = 0;
+                        while (clients[next_new].state != VC_IDLE && probe++ < cfg->clients) {
+                            next_new = (next_new + 1) % cfg->clients;
+                        }
+                        if (clients[next_new].state != VC_IDLE) {
+                            stats->skipped++;  // Todas las MACs están ocupadas
+                            continue;
+                        }
+                        uint32_t index = next_new;
+                        next_new = (next_new + 1) % cfg->clients;
+                        clients[index].state = VC_WAIT_OFFER;
+                        QUEUE_SEND(index, PHASE_DISCOVER);
+                    }
+                }
 
-        // Renovar el lease antes de que expire usando el mismo xid
-        renew_lease(sock, &relay_addr, offered_ip, global_xid);
+                // Inundación: DISCOVER sin seguimiento desde una MAC nueva cada vez
+                uint64_t flood_due = (uint64_t)((now - start) / 1e9 * cfg->flood_rate);
+                while (stats->flooded < flood_due) {
+                    uint8_t mac[6] = { 0x02, 0x01 };
+                    uint32_t spoofed = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+                    memcpy(mac + 2, &spoofed, 4);
+                    construct_dhcp_discover(&tx[pending_tx].dhcp, FLOOD_XID | (uint32_t)stats->flooded, mac);
+                    load_seal(cfg, &tx[pending_tx]);
+                    stats->flooded++;
+                    if (++pending_tx == LOAD_BATCH) {
+                        flush_sends(sock, tx_msgs, &pending_tx);
+                    }
+                }
+            } else {
+                // Respuestas del servidor en lotes
+                int received;
+                while ((received = recvmmsg(sock, rx_msgs, LOAD_BATCH, MSG_DONTWAIT, NULL)) > 0) {
+                    uint64_t arrival = now_ns();
+                    for (int r = 0; r < received; r++) {
+                        struct dhcp_options options;
+                        struct dhcp_packet *reply = &rx[r].dhcp;
+                        size_t len = rx_msgs[r].msg_len;
+                        struct raw_datagram datagram;
+                        if (headers > 0) {
+                            // Solo cabeceras IPv4 sin opciones, como las que genera el servidor
+                            if (raw_parse_ipv4_udp(rx[r].headers, len, &datagram) < 0 ||
+                                datagram.payload != (uint8_t *)reply) {
+                                stats->unexpected++;
+                                continue;
+                            }
+                            len = datagram.len;
+                        }
+                        if (dhcp_options_parse_packet(&options, reply, len) == DHCP_OPTIONS_BAD_HEADER) {
+                            stats->unexpected++;
+                            continue;
+                        }
+                        uint32_t index = ntohl(reply->xid);
+                        uint8_t type = dhcp_message_type(&options);
+                        if (cfg->flood_rate > 0 && (index & FLOOD_XID)) {
+                            stats->flood_replies++;
+                            continue;
+                        }
+                        if (index >= cfg->clients || clients[index].sent_ns == 0) {
+                            stats->unexpected++;
+                            continue;
+                        }
+                        struct vclient *vc = &clients[index];
+                        if (vc->state == VC_WAIT_OFFER && type == DHCP_OFFER) {
+                            hist_record(&stats->hist[PHASE_DISCOVER], arrival - vc->sent_ns);
+                            stats->completed[PHASE_DISCOVER]++;
+                            vc->ip = reply->yiaddr;
+                            vc->state = VC_WAIT_ACK;
+                            QUEUE_SEND(index, PHASE_REQUEST);
+                        } else if ((vc->state == VC_WAIT_ACK || vc->state == VC_WAIT_RENEW) && type == DHCP_ACK) {
+                            hist_record(&stats->hist[vc->phase], arrival - vc->sent_ns);
+                            stats->completed[vc->phase]++;
+                            vc->state = VC_BOUND;
+                            wait_unlink(clients, &waiting, index);
+                            bound++;
+                        } else {
+                            // NAK u otra respuesta: el cliente vuelve a empezar
+                            stats->unexpected++;
+                            if (vc->state == VC_WAIT_RENEW) {
+                                bound++;
+                                vc->state = VC_BOUND;
+                            } else {
+                                vc->state = VC_IDLE;
+                            }
+                            wait_unlink(clients, &waiting, index);
+                        }
+                    }
+                }
+            }
+        }
+        if (pending_tx > 0) {
+            flush_sends(sock, tx_msgs, &pending_tx);
+        }
 
-        // Esperar un nuevo DHCP ACK para confirmar la renovación
-        if (recvfrom(sock, &dhcp_ack, sizeof(dhcp_ack), 0, (struct sockaddr *)&relay_addr, &relay_addr_len) < 0) {
-            perror("Error al recibir DHCP ACK.");
-            continue;
+        if (now - last_report >= 1000000000ull) {
+            uint64_t done = 0;
+            for (int p = 0; p < PHASE_COUNT; p++) {
+                done += stats->completed[p];
+            }
+            LOG(LOG_INFO, "[%.0f s] %.0f trans/s, %u con lease, %u en vuelo", (now - start) / 1e9,
+                (done - last_done) / ((now - last_report) / 1e9), bound, waiting.count);
+            last_done = done;
+            last_report = now;
         }
+    }
+    #undef QUEUE_SEND
 
-        ack_ip = dhcp_ack.yiaddr;  // IP confirmada (en formato de red)
-        printf("DHCP ACK recibido: IP reconocida = %s\n", inet_ntoa(*(struct in_addr *)&ack_ip));
+    print_load_report(stats, (now_ns() - start) / 1e9);
+    close(ep);
+    close(timer_fd);
+    close(sock);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Agente de cliente: mantiene varios leases (uno por interfaz o MAC virtual)
+// en un solo proceso dirigido por eventos. Cada lease sigue los estados de
+// RFC 2131 con temporizadores T1 (renovar) y T2 (reenlazar) y reenvíos con
+// espera exponencial y jitter. Los vencimientos de todos los leases forman un
+// montículo y un único timerfd absoluto apunta al más próximo: sin eventos el
+// proceso queda bloqueado en epoll_wait, tenga uno o cien mil leases.
+// ---------------------------------------------------------------------------
+
+enum agent_state {
+    AG_INIT,        // Sin lease; al vencer el temporizador se envía DISCOVER
+    AG_SELECTING,   // DISCOVER enviado, esperando OFFER
+    AG_REQUESTING,  // REQUEST con la IP ofrecida, esperando ACK
+    AG_BOUND,       // Con lease hasta T1
+    AG_RENEWING,    // Entre T1 y T2: REQUEST al servidor del lease
+    AG_REBINDING,   // Entre T2 y el vencimiento: REQUEST a cualquier servidor
+};
+
+struct agent_lease {
+    char name[IFNAMSIZ];   // Interfaz, o "leaseN" para los virtuales
+    uint8_t mac[6];
+    uint8_t state;
+    uint8_t attempts;      // Envíos sin respuesta en la transacción actual
+    uint32_t xid;          // Bits bajos: índice del lease (AGENT_INDEX_BITS)
+    uint32_t ip;           // IP ofrecida o asignada (orden de red)
+    uint32_t server_id;    // Servidor que la ofreció (orden de red)
+    uint32_t heap_pos;     // Posición en el montículo de vencimientos
+    uint64_t deadline;     // Próximo evento (ns de CLOCK_MONOTONIC)
+    uint64_t t1, t2, expires;
+};
+
+struct agent_config {
+    struct sockaddr_in target;
+    int target_given;      // Con -s, el reenlace también va a 'target' en vez de en broadcast
+    char **interfaces;     // Interfaces de -i (su MAC identifica al lease)
+    int interface_count;
+    uint32_t virtual_count;  // Leases virtuales de -a
+    int duration;          // Segundos hasta liberar y salir; <= 0 sin límite
+};
+
+struct agent {
+    struct agent_lease *leases;
+    uint32_t *heap;        // Índices de leases; montículo mínimo por 'deadline'
+    uint32_t count;
+    uint32_t bound;        // Leases con dirección (BOUND, RENEWING o REBINDING)
+    int sock;
+    struct sockaddr_in target;  // DISCOVER y REQUEST de SELECTING/REQUESTING
+    struct sockaddr_in rebind;  // REQUEST de REBINDING: broadcast, o 'target' con -s
+};
 
-        // Reiniciar el tiempo del lease
-        lease_start = time(NULL);
+static uint64_t agent_deadline_at(const struct agent *agent, uint32_t pos) {
+    return agent->leases[agent->heap[pos]].deadline;
+}
+
+static void agent_heap_swap(struct agent *agent, uint32_t a, uint32_t b) {
+    uint32_t la = agent->heap[a], lb = agent->heap[b];
+    agent->heap[a] = lb;
+    agent->heap[b] = la;
+    agent->leases[lb].heap_pos = a;
+    agent->leases[la].heap_pos = b;
+}
+
+static void agent_heap_down(struct agent *agent, uint32_t pos) {
+    while (1) {
+        uint32_t child = 2 * pos + 1;
+        if (child >= agent->count) {
+            break;
+        }
+        if (child + 1 < agent->count && agent_deadline_at(agent, child + 1) < agent_deadline_at(agent, child)) {
+            child++;
+        }
+        if (agent_deadline_at(agent, pos) <= agent_deadline_at(agent, child)) {
+            break;
+        }
+        agent_heap_swap(agent, pos, child);
+        pos = child;
     }
+}
+
+// Cambia el próximo evento del lease y lo recoloca en el montículo
+static void agent_schedule(struct agent *agent, struct agent_lease *lease, uint64_t deadline) {
+    uint32_t pos = lease->heap_pos;
+    lease->deadline = deadline;
+    while (pos > 0 && agent_deadline_at(agent, pos) < agent_deadline_at(agent, (pos - 1) / 2)) {
+        agent_heap_swap(agent, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+    agent_heap_down(agent, pos);
+}
 
-    printf("Lease expirado.\n");
+// Nueva transacción: parte alta aleatoria y el índice del lease en la baja
+static void agent_new_xid(struct agent *agent, struct agent_lease *lease) {
+    lease->xid = ((uint32_t)rand() << AGENT_INDEX_BITS) | (uint32_t)(lease - agent->leases);
+    lease->attempts = 0;
+}
 
-    // Cerrar el socket antes de salir
-    close(sock);
+// Espera del reenvío: 4 s, 8 s, 16 s... hasta 64 s, con ±1 s al azar (RFC 2131 4.1)
+static uint64_t agent_backoff_ns(const struct agent_lease *lease) {
+    uint64_t ms = (uint64_t)AGENT_RETRANSMIT_MS << (lease->attempts < 4 ? lease->attempts : 4);
+    if (ms > AGENT_RETRANSMIT_MAX_MS) {
+        ms = AGENT_RETRANSMIT_MAX_MS;
+    }
+    return (uint64_t)((ms + (random_unit() * 2 - 1) * AGENT_JITTER_MS) * 1e6);
+}
+
+// Reenvío al renovar o reenlazar: espera exponencial, pero nunca más de la
+// mitad de lo que queda hasta 'limit' (T2 o el vencimiento) ni menos de 1 s
+static uint64_t agent_retry_before(const struct agent_lease *lease, uint64_t now, uint64_t limit) {
+    uint64_t interval = agent_backoff_ns(lease), half = (limit - now) / 2;
+    if (half < AGENT_MIN_RETRANSMIT_MS * 1000000ull) {
+        half = AGENT_MIN_RETRANSMIT_MS * 1000000ull;
+    }
+    if (interval > half) {
+        interval = half;
+    }
+    return now + interval < limit ? now + interval : limit;
+}
+
+// Vuelve a INIT; el DISCOVER sale tras un retardo aleatorio para no sincronizar la flota
+static void agent_restart(struct agent *agent, struct agent_lease *lease, uint64_t now) {
+    lease->state = AG_INIT;
+    lease->ip = 0;
+    agent_schedule(agent, lease, now + (uint64_t)(random_unit() * AGENT_START_SPREAD_MS * 1e6));
+}
+
+static size_t agent_put_server_id(uint8_t *options, size_t pos, uint32_t server_id) {
+    options[pos] = DHCP_OPT_SERVER_ID;
+    options[pos + 1] = 4;
+    memcpy(&options[pos + 2], &server_id, 4);
+    return pos + 6;
+}
+
+// Envía el mensaje 'type' que corresponde al estado del lease
+static void agent_send(struct agent *agent, struct agent_lease *lease, uint8_t type) {
+    struct dhcp_packet packet;
+    size_t pos;
+    if (type == DHCP_DISCOVER) {
+        construct_dhcp_discover(&packet, lease->xid, lease->mac);
+    } else if (lease->state == AG_REQUESTING) {
+        // Respuesta a un OFFER: IP solicitada (opción 50) y servidor elegido (opción 54)
+        construct_dhcp_request(&packet, lease->ip, lease->xid, lease->mac);
+        pos = agent_put_server_id(packet.options, 9, lease->server_id);
+        packet.options[pos] = DHCP_OPT_END;
+    } else {
+        // Renovación, reenlace o RELEASE: la dirección va en ciaddr, sin opción 50
+        construct_dhcp_request(&packet, 0, lease->xid, lease->mac);
+        packet.ciaddr = lease->ip;
+        packet.flags = 0;  // Con dirección el cliente ya acepta respuestas unicast
+        packet.options[2] = type;
+        pos = 3;
+        if (type == DHCP_RELEASE) {
+            pos = agent_put_server_id(packet.options, pos, lease->server_id);
+        }
+        packet.options[pos] = DHCP_OPT_END;
+    }
+    // Con dirección, RENEWING y RELEASE van en unicast al servidor del lease
+    // (RFC 2131 4.4.5) y REBINDING a cualquier servidor
+    struct sockaddr_in to = agent->target;
+    if (lease->state == AG_RENEWING || type == DHCP_RELEASE) {
+        to.sin_port = htons(DHCP_SERVER_PORT);
+        to.sin_addr.s_addr = lease->server_id;
+    } else if (lease->state == AG_REBINDING) {
+        to = agent->rebind;
+    }
+    if (sendto(agent->sock, &packet, DHCP_MIN_LEN, 0, (struct sockaddr *)&to, sizeof(to)) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Error al enviar mensaje DHCP");  // El reenvío lo volverá a intentar
+    }
+}
+
+// Vence el temporizador de un lease: envía o reenvía según el estado
+static void agent_timer(struct agent *agent, struct agent_lease *lease, uint64_t now) {
+    switch (lease->state) {
+        case AG_INIT:
+            agent_new_xid(agent, lease);
+            lease->state = AG_SELECTING;
+            agent_send(agent, lease, DHCP_DISCOVER);
+            agent_schedule(agent, lease, now + agent_backoff_ns(lease));
+            break;
+        case AG_SELECTING:
+            lease->attempts++;
+            agent_send(agent, lease, DHCP_DISCOVER);
+            agent_schedule(agent, lease, now + agent_backoff_ns(lease));
+            break;
+        case AG_REQUESTING:
+            if (++lease->attempts >= AGENT_REQUEST_TRIES) {
+                LOG(LOG_WARN, "%s: sin ACK para %I, se vuelve a INIT.", lease->name, lease->ip);
+                agent_restart(agent, lease, now);
+                break;
+            }
+            agent_send(agent, lease, DHCP_REQUEST);
+            agent_schedule(agent, lease, now + agent_backoff_ns(lease));
+            break;
+        case AG_BOUND:
+            // T1: renovar con el servidor que concedió el lease
+            agent_new_xid(agent, lease);
+            lease->state = AG_RENEWING;
+            LOG(LOG_DEBUG, "%s: T1, renovando %I.", lease->name, lease->ip);
+            agent_send(agent, lease, DHCP_REQUEST);
+            agent_schedule(agent, lease, agent_retry_before(lease, now, lease->t2));
+            break;
+        case AG_RENEWING:
+            if (now < lease->t2) {
+                lease->attempts++;
+                agent_send(agent, lease, DHCP_REQUEST);
+                agent_schedule(agent, lease, agent_retry_before(lease, now, lease->t2));
+                break;
+            }
+            // T2 sin respuesta: cualquier servidor puede extender el lease
+            agent_new_xid(agent, lease);
+            lease->state = AG_REBINDING;
+            LOG(LOG_WARN, "%s: T2 sin respuesta del servidor %I, reenlazando %I.", lease->name, lease->server_id,
+                lease->ip);
+            agent_send(agent, lease, DHCP_REQUEST);
+            agent_schedule(agent, lease, agent_retry_before(lease, now, lease->expires));
+            break;
+        case AG_REBINDING:
+            if (now < lease->expires) {
+                lease->attempts++;
+                agent_send(agent, lease, DHCP_REQUEST);
+                agent_schedule(agent, lease, agent_retry_before(lease, now, lease->expires));
+                break;
+            }
+            LOG(LOG_WARN, "%s: lease de %I vencido, se vuelve a INIT.", lease->name, lease->ip);
+            agent->bound--;
+            agent_restart(agent, lease, now);
+            break;
+    }
+}
+
+// ACK: (re)inicia el lease y programa T1. T1 y T2 llevan la misma variación
+// aleatoria (±5%) para que los clientes concedidos a la vez no renueven a la vez.
+static void agent_bind(struct agent *agent, struct agent_lease *lease, const struct dhcp_options *options,
+                       const struct dhcp_packet *reply, uint64_t now) {
+    uint32_t value, lease_time = LEASE_TIME, t1, t2;
+    if (dhcp_option_get32(options, DHCP_OPT_LEASE_TIME, &value)) {
+        lease_time = ntohl(value);
+    }
+    t1 = dhcp_option_get32(options, DHCP_OPT_RENEWAL_TIME, &value) ? ntohl(value) : lease_time / 2;
+    t2 = dhcp_option_get32(options, DHCP_OPT_REBINDING_TIME, &value) ? ntohl(value) : (uint64_t)lease_time * 7 / 8;
+    if (t2 > lease_time) {
+        t2 = lease_time;
+    }
+    if (t1 > t2) {
+        t1 = t2;
+    }
+    double fuzz = 1 + (random_unit() * 2 - 1) * AGENT_T_FUZZ;
+    lease->expires = now + lease_time * 1000000000ull;
+    lease->t2 = now + (uint64_t)(t2 * fuzz * 1e9);
+    lease->t1 = now + (uint64_t)(t1 * fuzz * 1e9);
+    if (lease->t2 > lease->expires) {
+        lease->t2 = lease->expires;
+    }
+    if (lease->t1 > lease->t2) {
+        lease->t1 = lease->t2;
+    }
+
+    if (lease->state == AG_REQUESTING) {
+        uint32_t mask = 0, gateway = 0, dns = 0;
+        dhcp_option_get32(options, DHCP_OPT_SUBNET_MASK, &mask);
+        dhcp_option_get32(options, DHCP_OPT_ROUTER, &gateway);
+        dhcp_option_get32(options, DHCP_OPT_DNS, &dns);
+        agent->bound++;
+        LOG(LOG_INFO, "%s: IP %I asignada por %I, lease de %u s.", lease->name, reply->yiaddr, lease->server_id,
+            lease_time);
+        LOG(LOG_INFO, "%s: máscara %I, gateway %I, DNS %I.", lease->name, mask, gateway, dns);
+    } else {
+        LOG(LOG_DEBUG, "%s: lease de %I renovado por %u s.", lease->name, reply->yiaddr, lease_time);
+    }
+    lease->ip = reply->yiaddr;
+    lease->state = AG_BOUND;
+    lease->attempts = 0;
+    agent_schedule(agent, lease, lease->t1);
+}
+
+// Respuesta del servidor o relay: el xid lleva el índice del lease
+static void agent_reply(struct agent *agent, const struct dhcp_packet *reply, size_t len, uint32_t source,
+                        uint64_t now) {
+    struct dhcp_options options;
+    if (dhcp_options_parse_packet(&options, reply, len) == DHCP_OPTIONS_BAD_HEADER) {
+        return;
+    }
+    uint32_t xid = ntohl(reply->xid), index = xid & (AGENT_MAX_LEASES - 1);
+    if (index >= agent->count) {
+        return;
+    }
+    struct agent_lease *lease = &agent->leases[index];
+    if (lease->xid != xid || memcmp(reply->chaddr, lease->mac, 6) != 0) {
+        return;  // Respuesta de una transacción anterior o de otro cliente
+    }
+    uint8_t type = dhcp_message_type(&options);
+    int waiting_ack = lease->state == AG_REQUESTING || lease->state == AG_RENEWING || lease->state == AG_REBINDING;
+    if (type == DHCP_OFFER && lease->state == AG_SELECTING) {
+        lease->ip = reply->yiaddr;
+        if (!dhcp_option_get32(&options, DHCP_OPT_SERVER_ID, &lease->server_id)) {
+            lease->server_id = source;
+        }
+        LOG(LOG_DEBUG, "%s: OFFER de %I del servidor %I.", lease->name, lease->ip, lease->server_id);
+        lease->state = AG_REQUESTING;
+        lease->attempts = 0;
+        agent_send(agent, lease, DHCP_REQUEST);
+        agent_schedule(agent, lease, now + agent_backoff_ns(lease));
+    } else if (type == DHCP_ACK && waiting_ack) {
+        agent_bind(agent, lease, &options, reply, now);
+    } else if (type == DHCP_NAK && waiting_ack) {
+        LOG(LOG_WARN, "%s: NAK para %I, se vuelve a INIT.", lease->name, lease->ip);
+        if (lease->state != AG_REQUESTING) {
+            agent->bound--;
+        }
+        agent_restart(agent, lease, now);
+    }
+}
+
+// MAC de una interfaz real, para que el servidor la identifique como ese equipo
+static int interface_mac(int sock, const char *name, uint8_t *mac) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
+        fprintf(stderr, "No se pudo leer la MAC de %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
     return 0;
 }
+
+static void agent_arm(int timer_fd, uint64_t deadline) {
+    struct itimerspec when = { { 0, 0 }, { deadline / 1000000000ull, deadline % 1000000000ull } };
+    if (deadline == 0) {
+        when.it_value.tv_nsec = 1;  // Un valor 0 desarmaría el temporizador
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+int run_agent(const struct agent_config *cfg) {
+    struct agent agent = { .target = cfg->target, .rebind = cfg->target };
+    if (!cfg->target_given) {
+        agent.rebind.sin_port = htons(DHCP_SERVER_PORT);
+        agent.rebind.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    }
+    agent.count = cfg->interface_count + cfg->virtual_count;
+    if (agent.count == 0) {
+        agent.count = 1;  // Sin -i ni -a: un único lease con client_mac
+    }
+    agent.leases = calloc(agent.count, sizeof(struct agent_lease));
+    agent.heap = calloc(agent.count, sizeof(uint32_t));
+    if (!agent.leases || !agent.heap) {
+        perror("Error al asignar los leases del agente");
+        return 1;
+    }
+    agent.sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (agent.sock < 0) {
+        perror("Error al crear socket");
+        return 1;
+    }
+    int broadcastEnable = 1, bufsize = 4 << 20;
+    if (setsockopt(agent.sock, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable)) < 0) {
+        perror("Error al habilitar broadcast");
+        return 1;
+    }
+    setsockopt(agent.sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    // Identidad de cada lease: MAC de la interfaz o client_mac más el índice
+    uint64_t now = now_ns();
+    for (uint32_t i = 0; i < agent.count; i++) {
+        struct agent_lease *lease = &agent.leases[i];
+        if ((int)i < cfg->interface_count) {
+            snprintf(lease->name, sizeof(lease->name), "%s", cfg->interfaces[i]);
+            if (interface_mac(agent.sock, cfg->interfaces[i], lease->mac) < 0) {
+                return 1;
+            }
+        } else {
+            uint32_t n = i - cfg->interface_count;
+            uint32_t tail = ((client_mac[3] << 16) | (client_mac[4] << 8) | client_mac[5]) + n;
+            snprintf(lease->name, sizeof(lease->name), "lease%u", n);
+            memcpy(lease->mac, client_mac, 3);
+            lease->mac[3] = tail >> 16;
+            lease->mac[4] = tail >> 8;
+            lease->mac[5] = tail;
+        }
+        lease->state = AG_INIT;
+        lease->deadline = now + (uint64_t)(random_unit() * AGENT_START_SPREAD_MS * 1e6);
+        lease->heap_pos = i;
+        agent.heap[i] = i;
+    }
+    for (uint32_t i = agent.count / 2; i-- > 0;) {
+        agent_heap_down(&agent, i);
+    }
+
+    // SIGINT/SIGTERM llegan por signalfd (bloqueadas en main antes de crear hilos)
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    int signal_fd = signalfd(-1, &stop_signals, SFD_NONBLOCK);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    int ep = epoll_create1(0);
+    if (signal_fd < 0 || timer_fd < 0 || ep < 0) {
+        perror("Error al preparar el bucle de eventos");
+        return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = agent.sock };
+    epoll_ctl(ep, EPOLL_CTL_ADD, agent.sock, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, timer_fd, &ev);
+    ev.data.fd = signal_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    uint64_t end = cfg->duration > 0 ? now + (uint64_t)cfg->duration * 1000000000ull : UINT64_MAX;
+    LOG(LOG_INFO, "Agente: %u leases contra %I:%u.", agent.count, cfg->target.sin_addr.s_addr,
+        ntohs(cfg->target.sin_port));
+
+    struct dhcp_packet reply;
+    struct sockaddr_in source;
+    socklen_t source_len;
+    int running = 1;
+    while (running) {
+        uint64_t next = agent.leases[agent.heap[0]].deadline;
+        agent_arm(timer_fd, next < end ? next : end);
+
+        struct epoll_event events[3];
+        int n = epoll_wait(ep, events, 3, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("Error en epoll_wait");
+            break;
+        }
+        now = now_ns();
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.fd == agent.sock) {
+                ssize_t len;
+                source_len = sizeof(source);
+                while ((len = recvfrom(agent.sock, &reply, sizeof(reply), 0, (struct sockaddr *)&source,
+                                       &source_len)) > 0) {
+                    agent_reply(&agent, &reply, len, source.sin_addr.s_addr, now);
+                    source_len = sizeof(source);
+                }
+            } else if (events[e].data.fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    perror("Error al leer el temporizador");
+                }
+            } else {
+                running = 0;
+            }
+        }
+        // Atender todos los leases vencidos; cada uno se reprograma en el futuro
+        while (agent.leases[agent.heap[0]].deadline <= now) {
+            agent_timer(&agent, &agent.leases[agent.heap[0]], now);
+        }
+        if (now >= end) {
+            running = 0;
+        }
+    }
+
+    // Al salir se liberan los leases para que el servidor recupere las direcciones
+    uint32_t released = 0;
+    for (uint32_t i = 0; i < agent.count; i++) {
+        struct agent_lease *lease = &agent.leases[i];
+        if (lease->state == AG_BOUND || lease->state == AG_RENEWING || lease->state == AG_REBINDING) {
+            agent_new_xid(&agent, lease);
+            agent_send(&agent, lease, DHCP_RELEASE);
+            released++;
+        }
+    }
+    LOG(LOG_INFO, "Agente: %u leases liberados de %u.", released, agent.count);
+    log_flush();
+    close(ep);
+    close(timer_fd);
+    close(signal_fd);
+    close(agent.sock);
+    free(agent.heap);
+    free(agent.leases);
+    return 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-l] [-s ip:puerto] [-i interfaz]... [-a leases] [-n macs] [-R tasa] [-m renovaciones] [-L pérdida] [-d segundos] [-F tasa] [-v nivel]\n", prog);
+    fprintf(stderr, "  -l          modo generador de carga (por defecto: agente de cliente)\n");
+    fprintf(stderr, "  -s IP:PORT  servidor o relay de destino (por defecto 192.168.0.2:1067)\n");
+    fprintf(stderr, "              (agente: también del reenlace en T2, que sin -s va en broadcast al puerto 67)\n");
+    fprintf(stderr, "  -i IFACE    agente: un lease con la MAC de la interfaz (se puede repetir); generador: enviar\n"
+                    "              como clientes sin dirección, en broadcast desde 0.0.0.0 por IFACE (ignora -s)\n");
+    fprintf(stderr, "  -a N        agente: N leases más con MACs virtuales (por defecto 1 si no hay -i)\n");
+    fprintf(stderr, "  -n N        MACs virtuales del generador (por defecto 10000)\n");
+    fprintf(stderr, "  -R N        transacciones iniciadas por segundo (por defecto 1000)\n");
+    fprintf(stderr, "  -m F        fracción de renovaciones entre 0 y 1 (por defecto 0.5)\n");
+    fprintf(stderr, "  -L F        probabilidad de perder un envío entre 0 y 1 (por defecto 0)\n");
+    fprintf(stderr, "  -d N        duración en segundos (generador: 10 por defecto; agente: sin límite)\n");
+    fprintf(stderr, "  -F N        además, N DISCOVER/s desde MACs falsas aleatorias (inundación)\n");
+    fprintf(stderr, "  -v NIVEL    nivel de registro: error, warn, info (por defecto) o debug\n");
+}
+
+// Función principal del cliente DHCP
+int main(int argc, char *argv[]) {
+    // Inicializar la semilla de números aleatorios para generar los xid
+    srand(time(NULL) ^ getpid());
+
+    struct load_config load = { .clients = 10000, .rate = 1000, .renew_mix = 0.5, .loss = 0, .duration = 10 };
+    load.target.sin_family = AF_INET;
+    load.target.sin_port = htons(1067);
+    load.target.sin_addr.s_addr = inet_addr("192.168.0.2");
+    struct agent_config agent = { .duration = 0 };
+    char **interfaces = calloc(argc, sizeof(char *));
+    agent.interfaces = interfaces;
+    int load_mode = 0, opt, level = LOG_INFO, duration = -1, target_given = 0;
+    while ((opt = getopt(argc, argv, "ls:i:a:n:R:m:L:d:F:v:h")) != -1) {
+        switch (opt) {
+            case 'l':
+                load_mode = 1;
+                break;
+            case 's': {
+                char *colon = strchr(optarg, ':');
+                if (colon != NULL) {
+                    *colon = '\0';
+                    load.target.sin_port = htons(atoi(colon + 1));
+                }
+                load.target.sin_addr.s_addr = inet_addr(optarg);
+                target_given = 1;
+                break;
+            }
+            case 'i':
+                interfaces[agent.interface_count++] = optarg;
+                break;
+            case 'a':
+                agent.virtual_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                load.clients = strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                load.rate = atof(optarg);
+                break;
+            case 'm':
+                load.renew_mix = atof(optarg);
+                break;
+            case 'L':
+                load.loss = atof(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'F':
+                load.flood_rate = atof(optarg);
+                break;
+            case 'v':
+                if ((level = log_parse_level(optarg)) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!load_mode) {
+        // El agente recibe SIGINT/SIGTERM por signalfd; se bloquean antes de
+        // arrancar el hilo de registro para que este las herede bloqueadas
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        sigprocmask(SIG_BLOCK, &stop_signals, NULL);
+    }
+    if (log_start(level) < 0) {
+        perror("Error al arrancar el hilo de registro");
+        return 1;
+    }
+    if (load_mode) {
+        load.duration = duration >= 0 ? duration : 10;
+        load.interface = agent.interface_count > 0 ? interfaces[0] : NULL;
+        if (load.clients == 0 || load.clients >= FLOOD_XID || load.rate <= 0 || load.flood_rate < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_load_generator(&load);
+    }
+
+    if ((uint64_t)agent.interface_count + agent.virtual_count > AGENT_MAX_LEASES) {
+        usage(argv[0]);
+        return 1;
+    }
+    agent.target = load.target;
+    agent.target_given = target_given;
+    agent.duration = duration;
+    int status = run_agent(&agent);
+    free(interfaces);
+    return status;
+}
@@ -0,0 +1,392 @@
+// Registro asíncrono compartido por el servidor, el relay y el cliente.
+//
+// Los hilos que registran no formatean ni escriben nada: LOG() copia la
+// cadena de formato (que debe ser un literal) y hasta LOG_MAX_ARGS argumentos
+// en un registro binario de 64 bytes dentro de un anillo SPSC propio del hilo.
+// Un hilo de fondo vacía todos los anillos, formatea los registros y los
+// escribe en stdout con una sola llamada write() por tanda. Si un anillo se
+// llena, el registro se descarta (y se cuenta) en lugar de bloquear al hilo.
+//
+// El formato admite %d, %u, %x, %ld, %lu, %zu, %s (solo cadenas que vivan
+// para siempre), %f con precisión opcional (%.1f), %% y dos conversiones
+// propias: %I (IPv4 uint32_t en orden de red) y %M (MAC, puntero a 6 bytes).
+//
+// El nivel se puede cambiar en marcha: SIGUSR1 sube la verbosidad y SIGUSR2
+// la baja. Los mensajes por paquete van en LOG_DEBUG.
+#ifndef DHCP_LOG_H
+#define DHCP_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SIZE 4096   // Registros por hilo (potencia de 2)
+#define LOG_MAX_THREADS 256  // Hilos que pueden registrar
+#define LOG_MAX_ARGS 5       // Argumentos por registro
+#define LOG_IDLE_US 1000     // Pausa del hilo de fondo cuando no hay nada que escribir...
+#define LOG_IDLE_MAX_US 32000  // ...que se dobla en cada vuelta vacía hasta este máximo
+
+enum log_level { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG };
+
+struct log_record {
+    uint64_t time_ns;            // CLOCK_REALTIME
+    const char *fmt;             // Literal de formato
+    uint64_t args[LOG_MAX_ARGS]; // Argumentos ya convertidos (doubles por sus bits, MAC empaquetada)
+    uint16_t thread;             // Identificador del anillo (hilo) que lo escribió
+    uint8_t level;
+};
+
+// Anillo de un solo productor (su hilo) y un solo consumidor (el hilo de fondo)
+struct log_ring {
+    _Alignas(64) _Atomic uint32_t head;  // Lo avanza el productor
+    _Alignas(64) _Atomic uint32_t tail;  // Lo avanza el consumidor
+    _Atomic uint64_t dropped;            // Registros perdidos con el anillo lleno
+    uint16_t id;
+    _Alignas(64) struct log_record records[LOG_RING_SIZE];
+};
+
+static _Atomic int log_level = LOG_INFO;
+static struct log_ring *_Atomic log_rings[LOG_MAX_THREADS];
+static _Atomic int log_ring_count;
+static __thread struct log_ring *log_self;
+static pthread_t log_thread;
+static _Atomic int log_running;
+static _Atomic int log_stop_requested;
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;  // Un solo consumidor a la vez
+static const char *const log_level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+static inline int log_enabled(enum log_level level) {
+    return (int)level <= atomic_load_explicit(&log_level, memory_order_relaxed);
+}
+
+static inline void log_set_level(enum log_level level) {
+    atomic_store_explicit(&log_level, level, memory_order_relaxed);
+}
+
+// Convierte "error", "warn", "info" o "debug" en un nivel; -1 si no es válido
+static inline int log_parse_level(const char *name) {
+    static const char *const names[] = { "error", "warn", "info", "debug" };
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline struct log_ring *log_register(void) {
+    int id = atomic_fetch_add(&log_ring_count, 1);
+    if (id >= LOG_MAX_THREADS) {
+        atomic_fetch_sub(&log_ring_count, 1);
+        return NULL;
+    }
+    struct log_ring *ring = aligned_alloc(64, sizeof(struct log_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->id = id;
+    atomic_store_explicit(&log_rings[id], ring, memory_order_release);
+    return ring;
+}
+
+// Recoge los argumentos según la cadena de formato
+static inline int log_collect(const char *fmt, va_list ap, uint64_t *args) {
+    int n = 0;
+    for (const char *p = fmt; *p != '\0' && n < LOG_MAX_ARGS; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        if (*p == '.') {
+            p++;
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        int is_long = 0;
+        while (*p == 'l' || *p == 'z') {
+            is_long = 1;
+            p++;
+        }
+        switch (*p) {
+            case 'd':
+                args[n++] = is_long ? (uint64_t)va_arg(ap, long) : (uint64_t)(int64_t)va_arg(ap, int);
+                break;
+            case 'u':
+            case 'x':
+            case 'I':
+                args[n++] = is_long ? (uint64_t)va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                break;
+            case 'f': {
+                double value = va_arg(ap, double);
+                memcpy(&args[n++], &value, sizeof(value));
+                break;
+            }
+            case 's':
+                args[n++] = (uintptr_t)va_arg(ap, const char *);
+                break;
+            case 'M': {
+                const uint8_t *mac = va_arg(ap, const uint8_t *);
+                uint64_t packed = 0;
+                memcpy(&packed, mac, 6);
+                args[n++] = packed;
+                break;
+            }
+            case '\0':
+                return n;
+        }
+    }
+    return n;
+}
+
+// Formatea un registro en 'out' (al menos 512 bytes). Devuelve la longitud.
+static inline size_t log_format(const struct log_record *record, char *out, size_t size) {
+    static time_t cached_seconds = -1;  // localtime_r solo una vez por segundo
+    static struct tm tm;
+    time_t seconds = record->time_ns / 1000000000ull;
+    if (seconds != cached_seconds) {
+        localtime_r(&seconds, &tm);
+        cached_seconds = seconds;
+    }
+    int len = snprintf(out, size, "%02d:%02d:%02d.%06lu [%s] [t%u] ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                       (unsigned long)(record->time_ns % 1000000000ull / 1000), log_level_names[record->level],
+                       record->thread);
+    int n = 0;
+    for (const char *p = record->fmt; *p != '\0' && (size_t)len < size - 32; p++) {
+        if (*p != '%') {
+            out[len++] = *p;
+            continue;
+        }
+        p++;
+        int precision = 6;
+        if (*p == '.') {
+            precision = 0;
+            for (p++; *p >= '0' && *p <= '9'; p++) {
+                precision = precision * 10 + (*p - '0');
+            }
+        }
+        while (*p == 'l' || *p == 'z') {
+            p++;
+        }
+        if (*p == '%') {
+            out[len++] = '%';
+            continue;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        uint64_t arg = n < LOG_MAX_ARGS ? record->args[n++] : 0;
+        size_t room = size - 32 - len;
+        switch (*p) {
+            case 'd':
+                len += snprintf(out + len, room, "%lld", (long long)(int64_t)arg);
+                break;
+            case 'u':
+                len += snprintf(out + len, room, "%llu", (unsigned long long)arg);
+                break;
+            case 'x':
+                len += snprintf(out + len, room, "%llx", (unsigned long long)arg);
+                break;
+            case 'f': {
+                double value;
+                memcpy(&value, &arg, sizeof(value));
+                len += snprintf(out + len, room, "%.*f", precision, value);
+                break;
+            }
+            case 's':
+                len += snprintf(out + len, room, "%s", (const char *)(uintptr_t)arg);
+                break;
+            case 'I': {
+                const uint8_t *b = (const uint8_t *)&arg;  // uint32_t en orden de red
+                len += snprintf(out + len, room, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+                break;
+            }
+            case 'M': {
+                const uint8_t *b = (const uint8_t *)&arg;
+                len += snprintf(out + len, room, "%02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3], b[4], b[5]);
+                break;
+            }
+        }
+        if ((size_t)len > size - 32) {
+            len = size - 32;
+        }
+    }
+    while (len > 0 && out[len - 1] == '\n') {
+        len--;  // Los mensajes pueden traer su propio salto de línea
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+static inline void log_write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// Vacía todos los anillos una vez. Devuelve cuántos registros escribió.
+static inline size_t log_drain_locked(void) {
+    static char buffer[1 << 16];
+    static uint64_t reported_drops;
+    size_t used = 0, total = 0;
+    uint64_t drops = 0;
+    int count = atomic_load_explicit(&log_ring_count, memory_order_acquire);
+    for (int r = 0; r < count && r < LOG_MAX_THREADS; r++) {
+        struct log_ring *ring = atomic_load_explicit(&log_rings[r], memory_order_acquire);
+        if (ring == NULL) {
+            continue;
+        }
+        drops += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            if (used > sizeof(buffer) - 1024) {  // Siempre queda sitio para un registro y el aviso final
+                log_write_all(buffer, used);
+                used = 0;
+            }
+            used += log_format(&ring->records[tail & (LOG_RING_SIZE - 1)], buffer + used, 512);
+            total++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    if (drops > reported_drops) {
+        used += snprintf(buffer + used, 128, "[log] %lu registros descartados por anillos llenos\n",
+                         (unsigned long)(drops - reported_drops));
+        reported_drops = drops;
+    }
+    if (used > 0) {
+        log_write_all(buffer, used);
+    }
+    return total;
+}
+
+static inline size_t log_drain(void) {
+    pthread_mutex_lock(&log_drain_lock);
+    size_t total = log_drain_locked();
+    pthread_mutex_unlock(&log_drain_lock);
+    return total;
+}
+
+static inline void log_record_v(enum log_level level, const char *fmt, va_list ap) {
+    struct log_ring *ring = log_self;
+    if (ring == NULL && (ring = log_self = log_register()) == NULL) {
+        return;
+    }
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SIZE) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    struct log_record *record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->time_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    record->fmt = fmt;
+    record->thread = ring->id;
+    record->level = level;
+    log_collect(fmt, ap, record->args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static inline void log_record(enum log_level level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_record_v(level, fmt, ap);
+    va_end(ap);
+    // Sin hilo de fondo (antes de log_start) se escribe en el momento
+    if (!atomic_load_explicit(&log_running, memory_order_acquire)) {
+        log_drain();
+    }
+}
+
+// Registra un mensaje si su nivel está activo; los argumentos no se evalúan si no lo está
+#define LOG(level, ...) do { \
+        if (log_enabled(level)) { \
+            log_record((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+static inline void *log_main(void *arg) {
+    (void)arg;
+    useconds_t idle = LOG_IDLE_US;
+    while (!atomic_load_explicit(&log_stop_requested, memory_order_acquire)) {
+        if (log_drain() > 0) {
+            idle = LOG_IDLE_US;
+            continue;
+        }
+        // Sin actividad el hilo apenas se despierta; con tráfico vuelve a 1 ms
+        usleep(idle);
+        idle = idle * 2 < LOG_IDLE_MAX_US ? idle * 2 : LOG_IDLE_MAX_US;
+    }
+    log_drain();
+    return NULL;
+}
+
+static inline void log_signal(int sig) {
+    int level = atomic_load_explicit(&log_level, memory_order_relaxed);
+    if (sig == SIGUSR1 && level < LOG_DEBUG) {
+        atomic_store_explicit(&log_level, level + 1, memory_order_relaxed);
+    } else if (sig == SIGUSR2 && level > LOG_ERROR) {
+        atomic_store_explicit(&log_level, level - 1, memory_order_relaxed);
+    }
+}
+
+// Espera a que el hilo de fondo haya escrito todo lo registrado hasta ahora
+static inline void log_flush(void) {
+    if (!atomic_load_explicit(&log_running, memory_order_acquire)) {
+        log_drain();
+        return;
+    }
+    int count = atomic_load_explicit(&log_ring_count, memory_order_acquire);
+    for (int r = 0; r < count && r < LOG_MAX_THREADS; r++) {
+        struct log_ring *ring = atomic_load_explicit(&log_rings[r], memory_order_acquire);
+        if (ring == NULL) {
+            continue;
+        }
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while ((int32_t)(head - atomic_load_explicit(&ring->tail, memory_order_acquire)) > 0) {
+            usleep(100);
+        }
+    }
+}
+
+static inline void log_stop(void) {
+    if (atomic_exchange(&log_running, 0)) {
+        atomic_store_explicit(&log_stop_requested, 1, memory_order_release);
+        pthread_join(log_thread, NULL);
+    }
+}
+
+// Arranca el hilo de fondo e instala SIGUSR1/SIGUSR2 para cambiar el nivel.
+// Lo pendiente se escribe al salir del proceso con exit().
+static inline int log_start(enum log_level level) {
+    log_set_level(level);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = log_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    if (pthread_create(&log_thread, NULL, log_main, NULL) != 0) {
+        return -1;
+    }
+    atomic_store_explicit(&log_running, 1, memory_order_release);
+    atexit(log_stop);
+    return 0;
+}
+
+#endif
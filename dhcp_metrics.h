@@ -0,0 +1,171 @@
+// Métricas compartidas por el servidor y el relay.
+//
+// Cada hilo escribe solo en sus propios contadores e histogramas (alineados a
+// una línea de caché), así que actualizar una métrica es una carga y un
+// almacenamiento relajados, sin instrucciones con lock ni líneas compartidas.
+// Quien exporta suma los valores de todos los hilos en el momento de la
+// consulta. Los histogramas usan buckets de potencias de 2 en nanosegundos.
+//
+// La exportación es texto de Prometheus (versión 0.0.4) servido por un socket
+// Unix desde el bucle de eventos del programa: con "GET" se responde como
+// HTTP/1.0 (curl --unix-socket), con cualquier otra cosa se envía el texto tal cual.
+#ifndef DHCP_METRICS_H
+#define DHCP_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <sys/un.h>
+
+#define METRICS_HIST_BUCKETS 32  // Bucket k: [2^k, 2^(k+1)) ns; el último acumula hasta ~4.3 s
+
+struct metrics_histogram {
+    _Atomic uint64_t buckets[METRICS_HIST_BUCKETS];
+    _Atomic uint64_t sum_ns;
+};
+
+// Suma en un contador con un único escritor: no necesita lectura-modificación-escritura atómica
+static inline void metrics_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline uint64_t metrics_read(_Atomic uint64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static inline int metrics_bucket(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+    int k = 63 - __builtin_clzll(ns);
+    return k < METRICS_HIST_BUCKETS ? k : METRICS_HIST_BUCKETS - 1;
+}
+
+static inline void metrics_observe(struct metrics_histogram *hist, uint64_t ns) {
+    metrics_add(&hist->buckets[metrics_bucket(ns)], 1);
+    metrics_add(&hist->sum_ns, ns);
+}
+
+// Acumula 'hist' en arrays normales para exportarlo sumado entre hilos
+static inline void metrics_merge(const struct metrics_histogram *hist, uint64_t *buckets, uint64_t *sum_ns) {
+    for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+        buckets[b] += metrics_read((_Atomic uint64_t *)&hist->buckets[b]);
+    }
+    *sum_ns += metrics_read((_Atomic uint64_t *)&hist->sum_ns);
+}
+
+static inline void metrics_write_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Una muestra; 'labels' es NULL o el contenido entre llaves, p. ej. type="offer"
+static inline void metrics_write_value(FILE *out, const char *name, const char *labels, double value) {
+    char text[32];
+    if (value >= 0 && value < 9.2e18 && value == (double)(uint64_t)value) {
+        snprintf(text, sizeof(text), "%lu", (unsigned long)(uint64_t)value);  // Contadores exactos
+    } else {
+        snprintf(text, sizeof(text), "%.9g", value);
+    }
+    if (labels != NULL && labels[0] != '\0') {
+        fprintf(out, "%s{%s} %s\n", name, labels, text);
+    } else {
+        fprintf(out, "%s %s\n", name, text);
+    }
+}
+
+// Histograma acumulado con límites en segundos, más _sum y _count
+static inline void metrics_write_histogram(FILE *out, const char *name, const char *labels,
+                                           const uint64_t *buckets, uint64_t sum_ns) {
+    const char *sep = (labels != NULL && labels[0] != '\0') ? "," : "";
+    if (labels == NULL) {
+        labels = "";
+    }
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_HIST_BUCKETS - 1; b++) {
+        cumulative += buckets[b];
+        fprintf(out, "%s_bucket{%s%sle=\"%.9g\"} %lu\n", name, labels, sep, (double)(2ull << b) / 1e9,
+                (unsigned long)cumulative);
+    }
+    cumulative += buckets[METRICS_HIST_BUCKETS - 1];
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, (unsigned long)cumulative);
+    if (labels[0] != '\0') {
+        fprintf(out, "%s_sum{%s} %.9f\n%s_count{%s} %lu\n", name, labels, sum_ns / 1e9, name, labels,
+                (unsigned long)cumulative);
+    } else {
+        fprintf(out, "%s_sum %.9f\n%s_count %lu\n", name, sum_ns / 1e9, name, (unsigned long)cumulative);
+    }
+}
+
+// Abre el socket Unix de métricas en 'path' (se reemplaza si ya existe)
+static inline int metrics_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Ruta del socket de métricas demasiado larga: %s\n", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Error al crear el socket de métricas");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("Error al enlazar el socket de métricas");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Atiende las conexiones pendientes: genera el texto con 'write_metrics' y lo
+// envía. La petición se espera como mucho 5 ms y el envío 100 ms, para que un
+// cliente lento no detenga el bucle de eventos que llama a esta función.
+static inline void metrics_serve(int listen_fd, void (*write_metrics)(FILE *out)) {
+    int client;
+    while ((client = accept(listen_fd, NULL, NULL)) >= 0) {
+        struct timeval timeout = { 0, 100000 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        struct pollfd readable = { client, POLLIN, 0 };
+        char request[512];
+        ssize_t request_len = poll(&readable, 1, 5) > 0 ? recv(client, request, sizeof(request), MSG_DONTWAIT) : 0;
+        int http = request_len >= 3 && memcmp(request, "GET", 3) == 0;
+
+        char *body = NULL;
+        size_t body_len = 0;
+        FILE *out = open_memstream(&body, &body_len);
+        if (out == NULL) {
+            close(client);
+            continue;
+        }
+        write_metrics(out);
+        fclose(out);
+
+        if (http) {
+            char header[128];
+            int header_len = snprintf(header, sizeof(header),
+                                      "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                      "Content-Length: %zu\r\n\r\n", body_len);
+            send(client, header, header_len, MSG_NOSIGNAL);
+        }
+        for (size_t sent = 0; sent < body_len;) {
+            ssize_t n = send(client, body + sent, body_len - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        free(body);
+        close(client);
+    }
+}
+
+#endif
@@ -0,0 +1,126 @@
+// Análisis de opciones DHCP compartido por el servidor, el relay y el cliente.
+//
+// dhcp_options_parse() recorre una sola vez el bloque de opciones (formato TLV:
+// código, longitud, valor) y anota la posición y longitud de cada opción sin
+// copiar nada. Después, cualquier opción se consulta en O(1) por su código.
+// Las opciones PAD (0) se saltan, END (255) termina el recorrido y ninguna
+// longitud puede salirse del buffer recibido.
+#ifndef DHCP_OPTIONS_H
+#define DHCP_OPTIONS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define DHCP_OPTIONS_OFFSET 240    // Posición de las opciones (tras la cookie mágica)
+#define DHCP_COOKIE_OFFSET 236     // Posición de la cookie mágica
+
+// Códigos de opción usados en el proyecto
+#define DHCP_OPT_PAD 0
+#define DHCP_OPT_SUBNET_MASK 1
+#define DHCP_OPT_ROUTER 3
+#define DHCP_OPT_DNS 6
+#define DHCP_OPT_REQUESTED_IP 50
+#define DHCP_OPT_LEASE_TIME 51
+#define DHCP_OPT_MESSAGE_TYPE 53
+#define DHCP_OPT_SERVER_ID 54
+#define DHCP_OPT_RENEWAL_TIME 58    // T1
+#define DHCP_OPT_REBINDING_TIME 59  // T2
+#define DHCP_OPT_CLIENT_ID 61
+#define DHCP_OPT_END 255
+
+// Resultado de dhcp_options_parse()
+#define DHCP_OPTIONS_OK 0
+#define DHCP_OPTIONS_TRUNCATED -1  // Una longitud se sale del buffer; se conserva lo anterior
+#define DHCP_OPTIONS_NO_END -2     // El buffer se acabó sin la opción END
+#define DHCP_OPTIONS_BAD_HEADER -3 // Paquete más corto que la cabecera o sin cookie mágica
+
+struct dhcp_options {
+    const uint8_t *base;   // Bloque de opciones analizado (no se copia)
+    uint64_t present[4];   // Un bit por código de opción encontrado
+    uint16_t offset[256];  // Posición del valor de cada opción dentro de 'base'
+    uint8_t length[256];   // Longitud del valor de cada opción
+};
+
+static inline int dhcp_option_present(const struct dhcp_options *opts, uint8_t code) {
+    return (opts->present[code >> 6] >> (code & 63)) & 1;
+}
+
+// Indexa las opciones de 'options' (longitud 'len'). Solo se limpia el mapa de
+// presencia, así que el coste es proporcional a las opciones que hay. Si un
+// código aparece varias veces se conserva la primera aparición.
+static inline int dhcp_options_parse(struct dhcp_options *opts, const uint8_t *options, size_t len) {
+    memset(opts->present, 0, sizeof(opts->present));
+    opts->base = options;
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t code = options[i];
+        if (code == DHCP_OPT_PAD) {
+            i++;
+            continue;
+        }
+        if (code == DHCP_OPT_END) {
+            return DHCP_OPTIONS_OK;
+        }
+        if (i + 1 >= len || i + 2 + options[i + 1] > len) {
+            return DHCP_OPTIONS_TRUNCATED;
+        }
+        if (!dhcp_option_present(opts, code)) {
+            opts->present[code >> 6] |= 1ull << (code & 63);
+            opts->offset[code] = (uint16_t)(i + 2);
+            opts->length[code] = options[i + 1];
+        }
+        i += 2 + options[i + 1];
+    }
+    return DHCP_OPTIONS_NO_END;
+}
+
+// Comprueba la cabecera de un paquete DHCP completo de 'packet_len' bytes e
+// indexa sus opciones
+static inline int dhcp_options_parse_packet(struct dhcp_options *opts, const void *packet, size_t packet_len) {
+    const uint8_t *bytes = packet;
+    uint32_t cookie;
+    memset(opts->present, 0, sizeof(opts->present));
+    opts->base = bytes + DHCP_OPTIONS_OFFSET;
+    if (packet_len < DHCP_OPTIONS_OFFSET) {
+        return DHCP_OPTIONS_BAD_HEADER;
+    }
+    memcpy(&cookie, bytes + DHCP_COOKIE_OFFSET, 4);
+    if (cookie != htonl(0x63825363)) {
+        return DHCP_OPTIONS_BAD_HEADER;
+    }
+    return dhcp_options_parse(opts, bytes + DHCP_OPTIONS_OFFSET, packet_len - DHCP_OPTIONS_OFFSET);
+}
+
+// Valor de la opción 'code' o NULL si no está; su longitud queda en '*len'
+static inline const uint8_t *dhcp_option_get(const struct dhcp_options *opts, uint8_t code, uint8_t *len) {
+    if (!dhcp_option_present(opts, code)) {
+        return NULL;
+    }
+    if (len != NULL) {
+        *len = opts->length[code];
+    }
+    return opts->base + opts->offset[code];
+}
+
+// Lee una opción de 4 bytes (direcciones en orden de red). Devuelve 1 si existe.
+static inline int dhcp_option_get32(const struct dhcp_options *opts, uint8_t code, uint32_t *value) {
+    uint8_t len;
+    const uint8_t *data = dhcp_option_get(opts, code, &len);
+    if (data == NULL || len != 4) {
+        return 0;
+    }
+    memcpy(value, data, 4);
+    return 1;
+}
+
+// Tipo de mensaje DHCP (opción 53) o 0 si falta o es inválida
+static inline uint8_t dhcp_message_type(const struct dhcp_options *opts) {
+    uint8_t len;
+    const uint8_t *data = dhcp_option_get(opts, DHCP_OPT_MESSAGE_TYPE, &len);
+    return (data != NULL && len == 1) ? data[0] : 0;
+}
+
+#endif
@@ -0,0 +1,156 @@
+// Tramas IPv4/UDP en crudo compartidas por el servidor y el cliente.
+//
+// Un cliente sin dirección envía sus mensajes como broadcast desde 0.0.0.0 y
+// solo puede recibir la respuesta como trama dirigida a su MAC o a la de
+// broadcast, así que los programas que hablan con él por un socket de
+// paquetes (AF_PACKET) construyen y analizan ellos mismos las cabeceras IPv4
+// y UDP. Aquí están esas cabeceras, su suma de comprobación y el filtro BPF
+// clásico que deja pasar al socket solo el UDP dirigido a un puerto.
+#ifndef DHCP_RAW_H
+#define DHCP_RAW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#define RAW_ETH_LEN 14        // Cabecera Ethernet sin VLAN
+#define RAW_IP_LEN 20         // Cabecera IPv4 sin opciones (la única que se genera)
+#define RAW_UDP_LEN 8
+#define RAW_HEADERS_LEN (RAW_IP_LEN + RAW_UDP_LEN)
+#define RAW_ETHERTYPE_IP 0x0800
+#define RAW_BROADCAST_FLAG 0x8000  // Bit de broadcast del campo flags de BOOTP
+
+struct raw_ipv4 {
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t src;
+    uint32_t dst;
+};
+
+struct raw_udp {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t len;
+    uint16_t checksum;
+};
+
+// Datagrama UDP extraído de una cabecera IPv4; direcciones y puertos en orden de red
+struct raw_datagram {
+    uint32_t src, dst;
+    uint16_t src_port, dst_port;
+    uint8_t *payload;
+    size_t len;
+};
+
+// Suma de comprobación de Internet (RFC 1071) sobre 'len' bytes, partiendo de 'sum'
+static inline uint32_t raw_sum(const void *data, size_t len, uint32_t sum) {
+    const uint8_t *bytes = data;
+    for (; len > 1; bytes += 2, len -= 2) {
+        sum += (uint32_t)bytes[0] << 8 | bytes[1];
+    }
+    if (len > 0) {
+        sum += (uint32_t)bytes[0] << 8;
+    }
+    return sum;
+}
+
+static inline uint16_t raw_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return htons((uint16_t)~sum);
+}
+
+// Escribe en 'ip' las cabeceras IPv4 y UDP de un datagrama cuyos 'len' bytes
+// de datos ya están detrás de ellas, con sus dos sumas de comprobación
+static inline void raw_build_ipv4_udp(void *ip, uint32_t src, uint32_t dst, uint16_t src_port, uint16_t dst_port,
+                                      size_t len) {
+    struct raw_ipv4 *hdr = ip;
+    struct raw_udp *udp = (struct raw_udp *)((uint8_t *)ip + RAW_IP_LEN);
+    hdr->version_ihl = 0x45;
+    hdr->tos = 0x10;  // Mínimo retardo, como los clientes DHCP habituales
+    hdr->total_len = htons((uint16_t)(RAW_HEADERS_LEN + len));
+    hdr->id = 0;
+    hdr->frag = 0;
+    hdr->ttl = 64;
+    hdr->protocol = IPPROTO_UDP;
+    hdr->checksum = 0;
+    hdr->src = src;
+    hdr->dst = dst;
+    hdr->checksum = raw_fold(raw_sum(hdr, RAW_IP_LEN, 0));
+
+    udp->src_port = htons(src_port);
+    udp->dst_port = htons(dst_port);
+    udp->len = htons((uint16_t)(RAW_UDP_LEN + len));
+    udp->checksum = 0;
+    // Pseudocabecera: direcciones, protocolo y longitud UDP
+    uint32_t sum = raw_sum(&hdr->src, 8, IPPROTO_UDP + RAW_UDP_LEN + (uint32_t)len);
+    uint16_t checksum = raw_fold(raw_sum(udp, RAW_UDP_LEN + len, sum));
+    udp->checksum = checksum != 0 ? checksum : 0xFFFF;  // 0 significaría "sin suma"
+}
+
+// Analiza un paquete IPv4 de 'len' bytes. Devuelve 0 con el datagrama en 'out'
+// si es UDP, no está fragmentado y sus longitudes caben en el buffer; si no, -1.
+static inline int raw_parse_ipv4_udp(uint8_t *ip, size_t len, struct raw_datagram *out) {
+    const struct raw_ipv4 *hdr = (const struct raw_ipv4 *)ip;
+    if (len < RAW_HEADERS_LEN || (hdr->version_ihl >> 4) != 4 || hdr->protocol != IPPROTO_UDP ||
+        (ntohs(hdr->frag) & 0x3FFF) != 0) {
+        return -1;
+    }
+    size_t ihl = (size_t)(hdr->version_ihl & 0x0F) * 4;
+    size_t total = ntohs(hdr->total_len);
+    if (ihl < RAW_IP_LEN || total > len || total < ihl + RAW_UDP_LEN) {
+        return -1;
+    }
+    const struct raw_udp *udp = (const struct raw_udp *)(ip + ihl);
+    size_t udp_len = ntohs(udp->len);
+    if (udp_len < RAW_UDP_LEN || udp_len > total - ihl) {
+        return -1;
+    }
+    out->src = hdr->src;
+    out->dst = hdr->dst;
+    out->src_port = udp->src_port;
+    out->dst_port = udp->dst_port;
+    out->payload = ip + ihl + RAW_UDP_LEN;
+    out->len = udp_len - RAW_UDP_LEN;
+    return 0;
+}
+
+// Filtro BPF clásico que solo acepta UDP no fragmentado al puerto 'port'. La
+// cabecera IPv4 empieza en 'ip_offset': 14 en un socket SOCK_RAW (el filtro ve
+// la trama Ethernet) y 0 en uno SOCK_DGRAM. El socket debe estar ligado a
+// ETH_P_IP, así que no hace falta mirar el tipo de trama.
+static inline int raw_attach_udp_filter(int sock, uint32_t ip_offset, uint16_t port) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ip_offset + 9),          // Protocolo
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, ip_offset + 6),          // Fragmento
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, 4, 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ip_offset),             // X = longitud de la cabecera IPv4
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, ip_offset + 2),          // Puerto de destino
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0x40000),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+// Filtro que lo descarta todo: deja un socket ligado a su puerto (así el kernel
+// no responde con ICMP) sin que reciba nada
+static inline int raw_attach_drop_filter(int sock) {
+    struct sock_filter code[] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+    struct sock_fprog prog = { 1, code };
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+#endif
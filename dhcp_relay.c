@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -5,11 +6,44 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "dhcp_options.h"
+#include "dhcp_metrics.h"
+#include "dhcp_log.h"
+#include "dhcp_replay.h"
+#include "dhcp_uring.h"
 
 // Definiciones de puertos DHCP
 #define DHCP_SERVER_PORT 67  // Puerto del servidor DHCP
 #define DHCP_CLIENT_PORT 68  // Puerto del cliente DHCP
 #define BUFFER_SIZE 1024     // Tamaño del buffer para los paquetes
+#define RELAY_PORT 1067      // Puerto donde escucha el relay
+#define RELAY_BATCH 64       // Datagramas por recvmmsg/sendmmsg
+#define URING_ENTRIES 256    // SQEs del anillo con -U
+#define URING_BUFFERS 1024   // Buffers de recepción provistos con -U (potencia de 2)
+#define DEFAULT_MAX_PENDING 65536  // Transacciones en vuelo como máximo
+#define DEFAULT_TIMEOUT_MS 2000    // Vida de una transacción sin respuesta
+#define TICK_MS 1                  // Resolución del temporizador de vencimientos y reintentos
+#define STATS_INTERVAL 10          // Segundos entre informes de estadísticas
+#define MAX_UPSTREAMS 16           // Servidores DHCP a los que se puede reenviar
+#define RING_POINTS 128            // Puntos de cada servidor en el anillo de hash consistente
+#define INITIAL_RTO_MS 100         // Timeout por intento mientras no hay muestras de RTT
+#define MIN_RTO_US 5000            // Cota inferior del timeout por intento
+#define DEFAULT_MAX_RTO_MS 100     // Un servidor que tarda más que esto se considera lento
+#define FAIL_THRESHOLD 3           // Timeouts seguidos para dar un servidor por caído
+#define HOLD_DOWN_MS 1000          // Tiempo antes de volver a probar un servidor caído
+
+// Campo 'op' de BOOTP: distingue peticiones de clientes y respuestas de servidores
+#define BOOTREQUEST 1
+#define BOOTREPLY 2
+
+// Mensajes de cliente que no llevan respuesta del servidor
+#define DHCP_DECLINE 4
+#define DHCP_RELEASE 7
 
 // Estructura que representa un paquete DHCP
 struct dhcp_packet {
@@ -31,35 +65,951 @@ struct dhcp_packet {
     uint8_t options[312];  // Opciones DHCP
 };
 
-// Función para obtener el tipo de mensaje DHCP del paquete
-uint8_t get_dhcp_message_type(struct dhcp_packet *packet) {
-    // Recorrer las opciones buscando la opción 53 (tipo de mensaje DHCP)
-    for (int i = 0; i < sizeof(packet->options); i++) {
-        if (packet->options[i] == 53) { // 53 es el tipo de mensaje
-            return packet->options[i + 2]; // El tipo está dos posiciones después
+// Función para obtener el tipo de mensaje DHCP de un paquete de 'len' bytes
+uint8_t get_dhcp_message_type(struct dhcp_packet *packet, size_t len) {
+    struct dhcp_options options;
+    // Indexar las opciones respetando los límites TLV y buscar la opción 53
+    if (dhcp_options_parse_packet(&options, packet, len) == DHCP_OPTIONS_BAD_HEADER) {
+        return 0;
+    }
+    return dhcp_message_type(&options);  // 0 si no es un tipo válido
+}
+
+// Servidor DHCP de destino y su estado de salud
+struct upstream {
+    struct sockaddr_in addr;
+    uint32_t srtt_us;       // RTT suavizado (0 hasta la primera muestra)
+    uint32_t rttvar_us;     // Variación del RTT
+    uint32_t rto_us;        // Timeout por intento: srtt + 4 * rttvar, acotado
+    uint32_t consecutive;   // Timeouts seguidos sin ninguna respuesta
+    uint8_t down;           // Marcado como caído
+    uint64_t down_until;    // Hasta cuándo no recibe tráfico nuevo
+    int32_t oldest, newest; // Transacciones esperando respuesta de este servidor, por hora de envío
+    uint32_t inflight;
+    uint64_t sent, replies, timeouts, failovers;
+    struct metrics_histogram rtt;  // Muestras de RTT válidas (primer intento)
+};
+
+// Punto del anillo de hash consistente
+struct ring_point {
+    uint32_t hash;
+    uint8_t upstream;
+};
+
+// Transacción en vuelo: a quién devolver la respuesta del servidor
+struct pending_entry {
+    uint32_t xid;              // xid del cliente (orden de red)
+    uint8_t mac[6];            // chaddr del cliente
+    uint8_t upstream;          // Servidor del intento actual
+    uint8_t attempts;          // Intentos desde la última petición del cliente
+    uint16_t tried;            // Servidores ya probados (un bit por servidor)
+    uint16_t len;              // Longitud del paquete guardado para reintentos
+    struct sockaddr_in client; // Dirección de origen del cliente
+    uint64_t first_ns;         // Primera vez que se reenvió la petición
+    uint64_t sent_ns;          // Último reenvío a un servidor
+    int32_t prev, next;        // Lista del servidor, o pila de libres (next)
+};
+
+// Tabla de transacciones pendientes indexada por (xid, chaddr).
+// Las entradas viven en un array con pila de libres; el índice hash usa
+// sondeo lineal con borrado por desplazamiento hacia atrás, así que no hay
+// lápidas y las búsquedas fallidas siguen siendo cortas.
+struct pending_table {
+    struct pending_entry *entries;
+    struct dhcp_packet *packets; // Copia de cada petición para reintentar en otro servidor
+    uint32_t capacity;
+    int32_t free_head;
+    int32_t *index;            // Posición en 'entries' o -1 si el hueco está libre
+    uint32_t index_mask;
+    uint32_t count;
+};
+
+struct relay_config {
+    uint16_t port;               // Puerto de escucha del relay
+    uint32_t giaddr;             // Dirección que se escribe en giaddr (orden de red)
+    uint32_t max_pending;
+    uint32_t timeout_ms;         // Vida total de una transacción
+    uint32_t max_rto_ms;         // Timeout máximo de un intento antes de pasar a otro servidor
+    int uring;                   // 1: recibir y reenviar con io_uring
+};
+
+struct relay_stats {
+    uint64_t requests;     // Peticiones reenviadas al servidor
+    uint64_t replies;      // Respuestas devueltas a su cliente
+    uint64_t retransmits;  // Peticiones repetidas de una transacción ya abierta
+    uint64_t failovers;    // Reintentos en otro servidor tras un timeout
+    uint64_t timeouts;     // Transacciones que vencieron sin respuesta
+    uint64_t orphans;      // Respuestas sin transacción pendiente
+    uint64_t full;         // Peticiones descartadas con la tabla llena
+    uint64_t invalid;      // Paquetes que no son DHCP válidos o de origen desconocido
+    uint64_t received;     // Datagramas recibidos
+    uint64_t syscalls;     // Llamadas al sistema de E/S de red (esperas, recepciones, envíos)
+    struct metrics_histogram transaction;  // Desde el primer reenvío hasta la respuesta
+};
+
+struct relay_config config = {
+    .port = RELAY_PORT,
+    .max_pending = DEFAULT_MAX_PENDING,
+    .timeout_ms = DEFAULT_TIMEOUT_MS,
+    .max_rto_ms = DEFAULT_MAX_RTO_MS,
+};
+struct upstream upstreams[MAX_UPSTREAMS];
+int upstream_count = 0;
+struct ring_point ring[MAX_UPSTREAMS * RING_POINTS];
+int ring_size = 0;
+struct pending_table pending;
+struct relay_stats stats;
+int relay_sock = -1;  // Socket del relay (sin abrir al reproducir una traza)
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Mezcla de 64 bits (finalizador de splitmix64)
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t mac_key(const uint8_t *mac) {
+    uint64_t key = 0;
+    memcpy(&key, mac, 6);
+    return key;
+}
+
+static uint32_t pending_hash(uint32_t xid, const uint8_t *mac) {
+    return (uint32_t)mix64(mac_key(mac) ^ ((uint64_t)xid << 32));
+}
+
+// ---------------------------------------------------------------------------
+// Servidores: anillo de hash consistente y seguimiento de salud
+// ---------------------------------------------------------------------------
+
+static int compare_points(const void *a, const void *b) {
+    uint32_t x = ((const struct ring_point *)a)->hash, y = ((const struct ring_point *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+// Cada servidor ocupa RING_POINTS posiciones pseudoaleatorias del anillo. Un
+// cliente va al primer punto a partir del hash de su MAC, así que añadir o
+// quitar un servidor solo mueve a los clientes de los tramos afectados.
+void build_ring(void) {
+    ring_size = 0;
+    for (int u = 0; u < upstream_count; u++) {
+        uint64_t id = ((uint64_t)upstreams[u].addr.sin_addr.s_addr << 16) | upstreams[u].addr.sin_port;
+        for (int k = 0; k < RING_POINTS; k++) {
+            ring[ring_size].hash = (uint32_t)mix64((id << 8) ^ k);
+            ring[ring_size].upstream = u;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring[0]), compare_points);
+}
+
+// Un servidor caído vuelve a probarse pasado HOLD_DOWN_MS, pero con una sola
+// transacción en vuelo hasta que responda
+static int upstream_usable(const struct upstream *up, uint64_t now) {
+    return !up->down || (now >= up->down_until && up->inflight == 0);
+}
+
+// Servidor para un cliente: el dueño de su tramo del anillo o, si está caído
+// o ya se probó ('tried'), el siguiente servidor distinto en el anillo.
+// Si todos están caídos se usa el primero no probado; -1 si se probaron todos.
+int choose_upstream(const uint8_t *mac, uint16_t tried, uint64_t now) {
+    uint32_t h = (uint32_t)mix64(mac_key(mac));
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    int fallback = -1;
+    for (int k = 0; k < ring_size; k++) {
+        int u = ring[(lo + k) % ring_size].upstream;
+        if (tried & (1u << u)) {
+            continue;
+        }
+        if (upstream_usable(&upstreams[u], now)) {
+            return u;
+        }
+        if (fallback < 0) {
+            fallback = u;
+        }
+    }
+    return fallback;
+}
+
+int find_upstream(const struct sockaddr_in *addr) {
+    for (int u = 0; u < upstream_count; u++) {
+        if (upstreams[u].addr.sin_addr.s_addr == addr->sin_addr.s_addr && upstreams[u].addr.sin_port == addr->sin_port) {
+            return u;
+        }
+    }
+    return -1;
+}
+
+static uint32_t clamp_rto(uint64_t rto_us) {
+    uint64_t max_us = (uint64_t)config.max_rto_ms * 1000;
+    if (rto_us < MIN_RTO_US) {
+        rto_us = MIN_RTO_US;
+    }
+    return rto_us > max_us ? max_us : rto_us;
+}
+
+// Respuesta de un servidor: vuelve a estar sano y, si la muestra es fiable
+// (primer intento, algoritmo de Karn), se actualiza su RTT como en RFC 6298
+void upstream_reply(int u, int64_t rtt_us) {
+    struct upstream *up = &upstreams[u];
+    up->replies++;
+    up->consecutive = 0;
+    if (up->down) {
+        up->down = 0;
+        LOG(LOG_INFO, "Servidor %I:%u recuperado", up->addr.sin_addr.s_addr, ntohs(up->addr.sin_port));
+    }
+    if (rtt_us < 0) {
+        return;
+    }
+    metrics_observe(&up->rtt, (uint64_t)rtt_us * 1000);
+    if (up->srtt_us == 0) {
+        up->srtt_us = rtt_us > 0 ? rtt_us : 1;
+        up->rttvar_us = rtt_us / 2;
+    } else {
+        int64_t delta = rtt_us - (int64_t)up->srtt_us;
+        up->rttvar_us = (3 * (uint64_t)up->rttvar_us + (delta < 0 ? -delta : delta)) / 4;
+        up->srtt_us = (7 * (uint64_t)up->srtt_us + rtt_us) / 8;
+    }
+    up->rto_us = clamp_rto((uint64_t)up->srtt_us + 4 * (uint64_t)up->rttvar_us);
+}
+
+// ---------------------------------------------------------------------------
+// Tabla de transacciones pendientes
+// ---------------------------------------------------------------------------
+
+void pending_init(struct pending_table *table, uint32_t capacity) {
+    uint32_t slots = 1;
+    while (slots < capacity * 2) {
+        slots <<= 1;  // Factor de carga máximo del índice: 50%
+    }
+    table->entries = malloc(sizeof(struct pending_entry) * capacity);
+    table->packets = malloc(sizeof(struct dhcp_packet) * capacity);  // Páginas tocadas solo al usarse
+    table->index = malloc(sizeof(int32_t) * slots);
+    if (table->entries == NULL || table->packets == NULL || table->index == NULL) {
+        perror("Error al asignar la tabla de transacciones");
+        exit(1);
+    }
+    memset(table->index, 0xff, sizeof(int32_t) * slots);
+    table->capacity = capacity;
+    table->index_mask = slots - 1;
+    for (uint32_t i = 0; i < capacity; i++) {
+        table->entries[i].next = (i + 1 < capacity) ? (int32_t)(i + 1) : -1;
+    }
+    table->free_head = 0;
+    table->count = 0;
+}
+
+// Hueco del índice que contiene (xid, mac) o el hueco libre donde iría
+static uint32_t pending_slot(struct pending_table *table, uint32_t xid, const uint8_t *mac) {
+    uint32_t slot = pending_hash(xid, mac) & table->index_mask;
+    while (table->index[slot] >= 0) {
+        struct pending_entry *e = &table->entries[table->index[slot]];
+        if (e->xid == xid && memcmp(e->mac, mac, 6) == 0) {
+            break;
+        }
+        slot = (slot + 1) & table->index_mask;
+    }
+    return slot;
+}
+
+// Saca la entrada de la lista del servidor al que espera
+static void pending_unlink(struct pending_table *table, int32_t i) {
+    struct pending_entry *e = &table->entries[i];
+    struct upstream *up = &upstreams[e->upstream];
+    if (e->prev >= 0) {
+        table->entries[e->prev].next = e->next;
+    } else {
+        up->oldest = e->next;
+    }
+    if (e->next >= 0) {
+        table->entries[e->next].prev = e->prev;
+    } else {
+        up->newest = e->prev;
+    }
+    up->inflight--;
+}
+
+// Envía (o reenvía) la petición guardada al siguiente servidor adecuado y la
+// pone al final de su lista. Devuelve el servidor elegido.
+static int pending_forward(struct pending_table *table, int32_t i, uint64_t now) {
+    struct pending_entry *e = &table->entries[i];
+    int u = choose_upstream(e->mac, e->tried, now);
+    if (u < 0) {
+        // Ya se probaron todos: se empieza otra ronda por el mejor disponible
+        e->tried = 0;
+        u = choose_upstream(e->mac, 0, now);
+    }
+    struct upstream *up = &upstreams[u];
+    e->upstream = u;
+    e->tried |= 1u << u;
+    e->attempts++;
+    e->sent_ns = now;
+    e->prev = up->newest;
+    e->next = -1;
+    if (up->newest >= 0) {
+        table->entries[up->newest].next = i;
+    } else {
+        up->oldest = i;
+    }
+    up->newest = i;
+    up->inflight++;
+    up->sent++;
+    return u;
+}
+
+// Registra (o refresca, si es una retransmisión) la transacción de un cliente,
+// guarda una copia de la petición y elige su servidor.
+// Devuelve la entrada, o -1 si la tabla está llena.
+int32_t pending_track(struct pending_table *table, const struct dhcp_packet *packet, size_t len,
+                      const struct sockaddr_in *client, uint64_t now) {
+    uint32_t slot = pending_slot(table, packet->xid, packet->chaddr);
+    int32_t i = table->index[slot];
+    if (i >= 0) {
+        stats.retransmits++;
+        pending_unlink(table, i);
+    } else {
+        if (table->free_head < 0) {
+            return -1;
+        }
+        i = table->free_head;
+        table->free_head = table->entries[i].next;
+        table->index[slot] = i;
+        table->count++;
+        table->entries[i].xid = packet->xid;
+        memcpy(table->entries[i].mac, packet->chaddr, 6);
+    }
+    struct pending_entry *e = &table->entries[i];
+    e->client = *client;
+    e->first_ns = now;
+    e->attempts = 0;
+    e->tried = 0;
+    e->len = len;
+    memcpy(&table->packets[i], packet, len);
+    pending_forward(table, i, now);
+    return i;
+}
+
+// Borra la entrada del hueco 'slot' y desplaza hacia atrás las que la siguen
+// en la misma cadena de sondeo
+static void pending_remove_slot(struct pending_table *table, uint32_t slot) {
+    int32_t i = table->index[slot];
+    pending_unlink(table, i);
+    table->entries[i].next = table->free_head;
+    table->free_head = i;
+    table->count--;
+
+    uint32_t hole = slot;
+    uint32_t next = (slot + 1) & table->index_mask;
+    while (table->index[next] >= 0) {
+        struct pending_entry *e = &table->entries[table->index[next]];
+        uint32_t home = pending_hash(e->xid, e->mac) & table->index_mask;
+        // Se mueve si su posición ideal no está entre el hueco y su sitio actual
+        if (((next - home) & table->index_mask) >= ((next - hole) & table->index_mask)) {
+            table->index[hole] = table->index[next];
+            hole = next;
+        }
+        next = (next + 1) & table->index_mask;
+    }
+    table->index[hole] = -1;
+}
+
+// Busca la transacción de una respuesta del servidor 'u', copia su cliente y
+// la cierra. Devuelve 0 si no había ninguna pendiente.
+int pending_complete(struct pending_table *table, int u, uint32_t xid, const uint8_t *mac,
+                     struct sockaddr_in *client, uint64_t now) {
+    uint32_t slot = pending_slot(table, xid, mac);
+    if (table->index[slot] < 0) {
+        return 0;
+    }
+    struct pending_entry *e = &table->entries[table->index[slot]];
+    // Solo el primer intento da una muestra de RTT sin ambigüedad
+    int64_t rtt_us = (e->upstream == u && e->attempts == 1) ? (int64_t)((now - e->sent_ns) / 1000) : -1;
+    upstream_reply(u, rtt_us);
+    metrics_observe(&stats.transaction, now - e->first_ns);
+    *client = e->client;
+    pending_remove_slot(table, slot);
+    return 1;
+}
+
+// Reintenta en otro servidor la transacción 'i', o la cierra si ya superó
+// su vida total. El reintento sale por 'output': el socket del relay o, al
+// reproducir una traza, el resumen de salidas.
+static void pending_retry(struct pending_table *table,
+                          void (*output)(const struct dhcp_packet *, size_t, const struct sockaddr_in *), int32_t i,
+                          uint64_t now) {
+    struct pending_entry *e = &table->entries[i];
+    if (now - e->first_ns >= (uint64_t)config.timeout_ms * 1000000ull) {
+        stats.timeouts++;
+        pending_remove_slot(table, pending_slot(table, e->xid, e->mac));
+        return;
+    }
+    int previous = e->upstream;
+    pending_unlink(table, i);
+    int u = pending_forward(table, i, now);
+    if (u != previous) {
+        stats.failovers++;
+        upstreams[previous].failovers++;
+    }
+    output(&table->packets[i], e->len, &upstreams[u].addr);
+}
+
+// Timeout de un intento en el servidor 'u'. Como en TCP, el timeout del
+// servidor se duplica; tras FAIL_THRESHOLD seguidos se da por caído y todas
+// sus transacciones pasan de inmediato a otro servidor.
+static void upstream_timeout(struct pending_table *table,
+                             void (*output)(const struct dhcp_packet *, size_t, const struct sockaddr_in *), int u,
+                             uint64_t now) {
+    struct upstream *up = &upstreams[u];
+    up->timeouts++;
+    up->rto_us = clamp_rto((uint64_t)up->rto_us * 2);
+    if (++up->consecutive < FAIL_THRESHOLD || (up->down && now < up->down_until)) {
+        return;
+    }
+    if (!up->down) {
+        LOG(LOG_WARN, "Servidor %I:%u caído tras %u timeouts seguidos; redirigiendo su tráfico",
+            up->addr.sin_addr.s_addr, ntohs(up->addr.sin_port), up->consecutive);
+    }
+    up->down = 1;
+    up->down_until = now + HOLD_DOWN_MS * 1000000ull;
+    // Con un solo servidor los reintentos vuelven a esta lista: se recorre una vez
+    for (uint32_t n = up->inflight; n > 0 && up->oldest >= 0; n--) {
+        pending_retry(table, output, up->oldest, now);
+    }
+}
+
+// Revisa la cabeza de la lista de cada servidor: las transacciones que
+// superan el timeout de su servidor se reintentan en otro
+void pending_expire(struct pending_table *table,
+                    void (*output)(const struct dhcp_packet *, size_t, const struct sockaddr_in *), uint64_t now) {
+    for (int u = 0; u < upstream_count; u++) {
+        struct upstream *up = &upstreams[u];
+        while (up->oldest >= 0 && now - table->entries[up->oldest].sent_ns >= (uint64_t)up->rto_us * 1000) {
+            int32_t i = up->oldest;
+            upstream_timeout(table, output, u, now);
+            if (up->oldest == i) {
+                pending_retry(table, output, i, now);
+            }
+        }
+    }
+}
+
+// Núcleo del relay: decide qué hacer con un paquete de 'len' bytes llegado de
+// 'source', sin tocar ningún socket. Una petición de cliente se registra y va a
+// su servidor; la respuesta de un servidor conocido vuelve al cliente de su
+// transacción. El paquete se modifica en el sitio (giaddr). Devuelve 1 con el
+// destino en 'destination' si hay que enviarlo, o 0 si se descarta.
+int relay_packet(struct dhcp_packet *packet, size_t len, const struct sockaddr_in *source,
+                 struct sockaddr_in *destination, uint64_t now) {
+    // Identificar el tipo de paquete DHCP recibido (Discover, Request, Offer, ACK...)
+    uint8_t type = get_dhcp_message_type(packet, len);
+    if (type == 0) {
+        stats.invalid++;
+        return 0;
+    }
+    if (packet->op == BOOTREQUEST && (type == DHCP_RELEASE || type == DHCP_DECLINE)) {
+        // Sin respuesta que esperar: abrir una transacción solo haría que se
+        // reintentara en los servidores hasta vencer
+        packet->giaddr = config.giaddr;
+        *destination = upstreams[choose_upstream(packet->chaddr, 0, now)].addr;
+        stats.requests++;
+        return 1;
+    }
+    if (packet->op == BOOTREQUEST) {
+        // Petición de un cliente: recordar a quién responder y reenviar a su servidor
+        packet->giaddr = config.giaddr;
+        int32_t entry = pending_track(&pending, packet, len, source, now);
+        if (entry < 0) {
+            stats.full++;
+            return 0;
+        }
+        *destination = upstreams[pending.entries[entry].upstream].addr;
+        stats.requests++;
+        LOG(LOG_DEBUG, "Petición de %M (xid %x) reenviada a %I:%u", packet->chaddr, ntohl(packet->xid),
+            destination->sin_addr.s_addr, ntohs(destination->sin_port));
+        return 1;
+    }
+    if (packet->op == BOOTREPLY) {
+        // Respuesta de un servidor conocido: devolverla al cliente de esa transacción
+        int u = find_upstream(source);
+        if (u < 0) {
+            stats.invalid++;
+            return 0;
+        }
+        if (!pending_complete(&pending, u, packet->xid, packet->chaddr, destination, now)) {
+            stats.orphans++;
+            return 0;
+        }
+        stats.replies++;
+        LOG(LOG_DEBUG, "Respuesta para %M (xid %x) devuelta a %I:%u", packet->chaddr, ntohl(packet->xid),
+            destination->sin_addr.s_addr, ntohs(destination->sin_port));
+        return 1;
+    }
+    stats.invalid++;
+    return 0;
+}
+
+// Salida de los reintentos en funcionamiento normal: el socket del relay
+static void send_datagram(const struct dhcp_packet *packet, size_t len, const struct sockaddr_in *to) {
+    stats.syscalls++;
+    if (sendto(relay_sock, packet, len, 0, (const struct sockaddr *)to, sizeof(*to)) < 0) {
+        perror("Error al reintentar en otro servidor");
+    }
+}
+
+void report_stats(void) {
+    // Cada registro lleva como mucho LOG_MAX_ARGS argumentos
+    LOG(LOG_INFO, "Relay: %lu reenviadas, %lu respondidas, %lu retransmisiones, %lu reintentos en otro servidor, "
+        "%u en vuelo", (unsigned long)stats.requests, (unsigned long)stats.replies,
+        (unsigned long)stats.retransmits, (unsigned long)stats.failovers, pending.count);
+    LOG(LOG_INFO, "Relay: %lu vencidas, %lu huérfanas, %lu descartadas (tabla llena), %lu inválidas, "
+        "%.2f llamadas por datagrama", (unsigned long)stats.timeouts, (unsigned long)stats.orphans,
+        (unsigned long)stats.full, (unsigned long)stats.invalid,
+        stats.received > 0 ? (double)stats.syscalls / stats.received : 0.0);
+    for (int u = 0; u < upstream_count; u++) {
+        struct upstream *up = &upstreams[u];
+        LOG(LOG_INFO, "  %I:%u %s, srtt %.2f ms, rto %.2f ms", up->addr.sin_addr.s_addr, ntohs(up->addr.sin_port),
+            up->down ? "caído" : "activo", up->srtt_us / 1e3, up->rto_us / 1e3);
+        LOG(LOG_INFO, "    %lu enviadas, %lu respuestas, %lu timeouts, %lu desviadas, %u en vuelo",
+            (unsigned long)up->sent, (unsigned long)up->replies, (unsigned long)up->timeouts,
+            (unsigned long)up->failovers, up->inflight);
+    }
+}
+
+// Escribe las métricas del relay en formato de texto de Prometheus. El relay
+// tiene un solo hilo y las exporta desde su propio bucle, así que lee todo sin
+// sincronización.
+void write_relay_metrics(FILE *out) {
+    static const struct { const char *name; const char *help; size_t offset; } counters[] = {
+        { "dhcp_relay_requests_total", "Client requests forwarded to a server.", offsetof(struct relay_stats, requests) },
+        { "dhcp_relay_replies_total", "Server replies returned to their client.", offsetof(struct relay_stats, replies) },
+        { "dhcp_relay_retransmits_total", "Client retransmissions of an open transaction.", offsetof(struct relay_stats, retransmits) },
+        { "dhcp_relay_failovers_total", "Attempts moved to another server after a timeout.", offsetof(struct relay_stats, failovers) },
+        { "dhcp_relay_timeouts_total", "Transactions dropped without a reply.", offsetof(struct relay_stats, timeouts) },
+        { "dhcp_relay_orphan_replies_total", "Replies with no pending transaction.", offsetof(struct relay_stats, orphans) },
+        { "dhcp_relay_table_full_total", "Requests dropped because the pending table was full.", offsetof(struct relay_stats, full) },
+        { "dhcp_relay_invalid_total", "Invalid packets or replies from unknown sources.", offsetof(struct relay_stats, invalid) },
+        { "dhcp_relay_received_total", "Datagrams received.", offsetof(struct relay_stats, received) },
+        { "dhcp_relay_io_syscalls_total", "Network I/O system calls (waits, receives, sends, io_uring_enter).", offsetof(struct relay_stats, syscalls) },
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        metrics_write_header(out, counters[i].name, "counter", counters[i].help);
+        metrics_write_value(out, counters[i].name, NULL, *(uint64_t *)((char *)&stats + counters[i].offset));
+    }
+    metrics_write_header(out, "dhcp_relay_pending", "gauge", "Transactions waiting for a server reply.");
+    metrics_write_value(out, "dhcp_relay_pending", NULL, pending.count);
+    uint64_t buckets[METRICS_HIST_BUCKETS] = {0}, sum_ns = 0;
+    metrics_merge(&stats.transaction, buckets, &sum_ns);
+    metrics_write_header(out, "dhcp_relay_transaction_seconds", "histogram",
+                         "Time from the first forward of a request to the reply, including retries.");
+    metrics_write_histogram(out, "dhcp_relay_transaction_seconds", NULL, buckets, sum_ns);
+
+    char labels[MAX_UPSTREAMS][48];
+    for (int u = 0; u < upstream_count; u++) {
+        snprintf(labels[u], sizeof(labels[u]), "upstream=\"%s:%d\"", inet_ntoa(upstreams[u].addr.sin_addr),
+                 ntohs(upstreams[u].addr.sin_port));
+    }
+    static const struct { const char *name; const char *type; const char *help; } per_upstream[] = {
+        { "dhcp_relay_upstream_up", "gauge", "1 if the server is taking traffic, 0 if it is marked down." },
+        { "dhcp_relay_upstream_srtt_seconds", "gauge", "Smoothed round-trip time of the server." },
+        { "dhcp_relay_upstream_rto_seconds", "gauge", "Current per-attempt timeout of the server." },
+        { "dhcp_relay_upstream_inflight", "gauge", "Transactions waiting for this server." },
+        { "dhcp_relay_upstream_sent_total", "counter", "Attempts sent to the server." },
+        { "dhcp_relay_upstream_replies_total", "counter", "Replies received from the server." },
+        { "dhcp_relay_upstream_timeouts_total", "counter", "Attempts to the server that timed out." },
+        { "dhcp_relay_upstream_failovers_total", "counter", "Attempts moved away from the server." },
+    };
+    for (size_t m = 0; m < sizeof(per_upstream) / sizeof(per_upstream[0]); m++) {
+        metrics_write_header(out, per_upstream[m].name, per_upstream[m].type, per_upstream[m].help);
+        for (int u = 0; u < upstream_count; u++) {
+            struct upstream *up = &upstreams[u];
+            double values[] = { !up->down, up->srtt_us / 1e6, up->rto_us / 1e6, up->inflight,
+                                up->sent, up->replies, up->timeouts, up->failovers };
+            metrics_write_value(out, per_upstream[m].name, labels[u], values[m]);
+        }
+    }
+    metrics_write_header(out, "dhcp_relay_upstream_rtt_seconds", "histogram", "Round-trip time samples of first attempts.");
+    for (int u = 0; u < upstream_count; u++) {
+        uint64_t rtt[METRICS_HIST_BUCKETS] = {0}, rtt_sum = 0;
+        metrics_merge(&upstreams[u].rtt, rtt, &rtt_sum);
+        metrics_write_histogram(out, "dhcp_relay_upstream_rtt_seconds", labels[u], rtt, rtt_sum);
+    }
+}
+
+// Convierte "ip[:puerto]" en una dirección; devuelve 0 si no es válida
+int parse_address(const char *text, uint16_t default_port, struct sockaddr_in *addr) {
+    char host[64];
+    const char *colon = strchr(text, ':');
+    size_t host_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (host_len >= sizeof(host)) {
+        return 0;
+    }
+    memcpy(host, text, host_len);
+    host[host_len] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(colon ? atoi(colon + 1) : default_port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1;
+}
+
+int add_upstream(const char *text) {
+    if (upstream_count == MAX_UPSTREAMS) {
+        fprintf(stderr, "Demasiados servidores (máximo %d)\n", MAX_UPSTREAMS);
+        return 0;
+    }
+    struct upstream *up = &upstreams[upstream_count];
+    memset(up, 0, sizeof(*up));
+    if (!parse_address(text, DHCP_SERVER_PORT, &up->addr)) {
+        fprintf(stderr, "Servidor inválido: %s\n", text);
+        return 0;
+    }
+    up->rto_us = INITIAL_RTO_MS * 1000;
+    up->oldest = up->newest = -1;
+    upstream_count++;
+    return 1;
+}
+
+// Salidas de una reproducción: no se envían, solo se cuentan y se resumen
+static uint64_t replay_digest = REPLAY_HASH_INIT;
+static uint64_t replay_outputs;
+
+static void replay_output(const struct dhcp_packet *packet, size_t len, const struct sockaddr_in *to) {
+    replay_digest = replay_hash(replay_digest, &to->sin_addr.s_addr, 4);
+    replay_digest = replay_hash(replay_digest, &to->sin_port, 2);
+    replay_digest = replay_hash(replay_digest, packet, len);
+    replay_outputs++;
+}
+
+// Reproduce una traza (pcap o sintética) contra relay_packet() sin sockets: los
+// paquetes dirigidos al puerto del relay entran con su origen y hora de la
+// traza, y los vencimientos avanzan con esa hora. Una traza sintética no trae
+// respuestas de servidores, así que cada petición reenviada recibe al momento
+// una respuesta simulada de su servidor (OFFER a un DISCOVER, ACK a un REQUEST).
+// Informa de paquetes por segundo, reservas de memoria por paquete y un
+// resumen de las salidas que sirve de prueba de regresión.
+int run_replay(const char *spec) {
+    struct replay_trace trace;
+    if (replay_open(&trace, spec, config.port) < 0) {
+        replay_close(&trace);
+        return 1;
+    }
+    struct dhcp_packet packet;
+    struct sockaddr_in source = { .sin_family = AF_INET }, destination;
+    uint64_t processed = 0, skipped = 0, next_tick = TICK_MS * 1000000ull;
+
+    LOG(LOG_INFO, "Reproduciendo %zu paquetes de %s.", trace.count, spec);
+    int64_t allocations = replay_allocation_count();
+    uint64_t start = now_ns();
+    for (size_t k = 0; k < trace.count; k++) {
+        const struct replay_packet *p = &trace.packets[k];
+        for (; p->time_ns >= next_tick; next_tick += TICK_MS * 1000000ull) {
+            pending_expire(&pending, replay_output, next_tick);
+        }
+        if (p->dst_port != htons(config.port) || p->len == 0) {
+            skipped++;
+            continue;
+        }
+        size_t len = p->len < sizeof(packet) ? p->len : sizeof(packet);
+        memcpy(&packet, p->data, len);
+        source.sin_addr.s_addr = p->src_addr;
+        source.sin_port = p->src_port;
+        processed++;
+        if (!relay_packet(&packet, len, &source, &destination, p->time_ns)) {
+            continue;
+        }
+        replay_output(&packet, len, &destination);
+        if (trace.synthetic && packet.op == BOOTREQUEST) {
+            // Respuesta simulada del servidor elegido
+            packet.op = BOOTREPLY;
+            packet.yiaddr = htonl(0x0a000000 | (ntohl(packet.xid) & 0xffffff));
+            packet.options[2] = packet.options[2] == 1 ? 2 : 5;
+            struct sockaddr_in server = destination;
+            processed++;
+            if (relay_packet(&packet, len, &server, &destination, p->time_ns)) {
+                replay_output(&packet, len, &destination);
+            }
+        }
+    }
+    uint64_t ns = now_ns() - start;
+    if (allocations >= 0) {
+        allocations = replay_allocation_count() - allocations;
+    }
+
+    // El informe va directo a stdout, después de lo que quede en el registro
+    log_flush();
+    printf("Reproducción de %s: %zu paquetes, %lu procesados, %lu ignorados\n", spec, trace.count,
+           (unsigned long)processed, (unsigned long)skipped);
+    printf("Rendimiento: %.0f paquetes/s (%.1f ns por paquete)\n", processed > 0 ? processed / (ns / 1e9) : 0.0,
+           processed > 0 ? (double)ns / processed : 0.0);
+    if (allocations >= 0) {
+        printf("Memoria: %ld reservas, %.4f por paquete\n", (long)allocations,
+               processed > 0 ? (double)allocations / processed : 0.0);
+    } else {
+        printf("Memoria: reservas no contadas (compilado con AddressSanitizer)\n");
+    }
+    printf("Salidas: %lu (%lu peticiones reenviadas, %lu respuestas devueltas, %lu reintentos por timeout, "
+           "%lu en otro servidor)\n", (unsigned long)replay_outputs, (unsigned long)stats.requests,
+           (unsigned long)stats.replies, (unsigned long)(replay_outputs - stats.requests - stats.replies),
+           (unsigned long)stats.failovers);
+    printf("Transacciones vencidas: %lu; resumen %016lx\n", (unsigned long)stats.timeouts,
+           (unsigned long)replay_digest);
+    replay_close(&trace);
+    return 0;
+}
+
+// Vencimientos y reintentos de cada tick del temporizador, y el informe periódico
+static void relay_tick(int timer_fd, uint64_t now, uint64_t *last_report) {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+        pending_expire(&pending, send_datagram, now);
+    }
+    if (now - *last_report >= STATS_INTERVAL * 1000000000ull) {
+        report_stats();
+        *last_report = now;
+    }
+}
+
+// Operaciones del bucle de io_uring, en los 32 bits altos de user_data
+enum uring_op { URING_RECV = 1, URING_SEND, URING_TIMER, URING_METRICS };
+
+// Reenvío en vuelo, uno por buffer de recepción: el paquete sale del mismo
+// buffer en que llegó, que no se devuelve al kernel hasta el completado del envío
+struct uring_forward {
+    struct sockaddr_in destination;
+    struct iovec iov;
+    struct msghdr msg;
+};
+
+// Bucle del relay sobre io_uring: recvmsg multishot con buffers provistos,
+// reenvío como sendmsg desde el propio buffer y un solo io_uring_enter por
+// vuelta. Solo vuelve, con -1, si el kernel no admite io_uring o el recvmsg
+// multishot antes de recibir nada; main() sigue entonces con epoll y recvmmsg.
+int relay_uring(int timer_fd, int metrics_fd, uint64_t *last_report) {
+    static struct uring_forward forwards[URING_BUFFERS];
+    struct uring ring;
+    if (uring_init(&ring, URING_ENTRIES, URING_BUFFERS * 4) < 0) {
+        return -1;
+    }
+    struct msghdr recv_msg = { .msg_namelen = sizeof(struct sockaddr_in) };
+    if (uring_buffers_init(&ring, URING_BUFFERS, URING_PAYLOAD_OFFSET(sizeof(struct sockaddr_in), 0) +
+                           sizeof(struct dhcp_packet), 0) < 0) {
+        int saved = errno;
+        uring_close(&ring);
+        errno = saved;
+        return -1;
+    }
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        forwards[i].msg.msg_name = &forwards[i].destination;
+        forwards[i].msg.msg_namelen = sizeof(struct sockaddr_in);
+        forwards[i].msg.msg_iov = &forwards[i].iov;
+        forwards[i].msg.msg_iovlen = 1;
+    }
+
+    int recv_armed = 0, timer_armed = 0, metrics_armed = metrics_fd < 0;
+    unsigned sends = 0;  // sendmsg encolados desde la última entrada al kernel
+    uint64_t served = 0;
+    while (1) {
+        struct io_uring_sqe *sqe;
+        if (!recv_armed && (sqe = uring_get_sqe(&ring)) != NULL) {
+            uring_prep_recvmsg_multishot(sqe, &ring, relay_sock, &recv_msg, URING_DATA(URING_RECV, 0));
+            recv_armed = 1;
+        }
+        if (!timer_armed && (sqe = uring_get_sqe(&ring)) != NULL) {
+            uring_prep_poll_multishot(sqe, timer_fd, URING_DATA(URING_TIMER, 0));
+            timer_armed = 1;
+        }
+        if (!metrics_armed && (sqe = uring_get_sqe(&ring)) != NULL) {
+            uring_prep_poll_multishot(sqe, metrics_fd, URING_DATA(URING_METRICS, 0));
+            metrics_armed = 1;
+        }
+        // Los reenvíos se completan durante la propia llamada: se esperan
+        // también sus completados para no dar una vuelta solo por ellos
+        stats.syscalls++;
+        int submitted = uring_submit(&ring, sends + 1);
+        sends = 0;
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("Error en io_uring_enter");
+        }
+
+        uint64_t now = now_ns();
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek(&ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            int bid = uring_cqe_buffer(cqe);
+            uring_cqe_seen(&ring);
+
+            if (URING_TAG(data) == URING_SEND) {
+                if (res < 0 && res != -EAGAIN) {
+                    errno = -res;
+                    perror("Error al reenviar paquete");  // El cliente retransmitirá
+                }
+                uring_buffer_recycle(&ring, URING_INDEX(data));
+            } else if (URING_TAG(data) == URING_TIMER) {
+                timer_armed = more;
+                relay_tick(timer_fd, now, last_report);
+            } else if (URING_TAG(data) == URING_METRICS) {
+                metrics_armed = more;
+                metrics_serve(metrics_fd, write_relay_metrics);
+            } else if (URING_TAG(data) == URING_RECV) {
+                recv_armed = more;
+                if (bid < 0) {
+                    if (res == -EINVAL && served == 0) {
+                        uring_close(&ring);  // Kernel sin recvmsg multishot
+                        errno = EINVAL;
+                        return -1;
+                    }
+                    if (res < 0 && res != -ENOBUFS) {
+                        errno = -res;
+                        perror("Error al recibir paquetes");
+                    }
+                    continue;
+                }
+                served++;
+                stats.received++;
+                struct io_uring_recvmsg_out *out;
+                uint8_t *payload;
+                ssize_t len = uring_recvmsg_parse(uring_buffer(&ring, bid), res, &recv_msg, sizeof(struct dhcp_packet),
+                                                  &out, &payload);
+                struct uring_forward *forward = &forwards[bid];
+                if (len < 0 || !relay_packet((struct dhcp_packet *)payload, len, (struct sockaddr_in *)(out + 1),
+                                             &forward->destination, now)) {
+                    uring_buffer_recycle(&ring, bid);
+                    continue;
+                }
+                forward->iov.iov_base = payload;
+                forward->iov.iov_len = len;
+                while ((sqe = uring_get_sqe(&ring)) == NULL) {
+                    stats.syscalls++;
+                    uring_submit(&ring, 0);  // Anillo de envío lleno: publicar lo encolado
+                    sends = 0;
+                }
+                uring_prep_sendmsg(sqe, relay_sock, &forward->msg, URING_DATA(URING_SEND, bid));
+                sends++;
+            }
         }
     }
-    return 0;  // Si no se encuentra, devuelve 0 (no es un tipo válido)
+    return 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-p puerto] [-s ip[:puerto]]... [-g giaddr] [-n pendientes] [-t ms] [-r ms] [-m socket] [-l nivel] [-P traza] [-U]\n", prog);
+    fprintf(stderr, "  -p PORT     puerto de escucha del relay (por defecto %d)\n", RELAY_PORT);
+    fprintf(stderr, "  -s IP:PORT  servidor DHCP; se repite para varios (por defecto 192.168.0.1:%d)\n", DHCP_SERVER_PORT);
+    fprintf(stderr, "  -g IP       dirección que se escribe en giaddr (por defecto 192.168.0.2)\n");
+    fprintf(stderr, "  -n N        transacciones en vuelo como máximo (por defecto %d)\n", DEFAULT_MAX_PENDING);
+    fprintf(stderr, "  -t MS       vida de una transacción sin respuesta (por defecto %d ms)\n", DEFAULT_TIMEOUT_MS);
+    fprintf(stderr, "  -r MS       timeout máximo de un intento antes de probar otro servidor (por defecto %d ms)\n",
+            DEFAULT_MAX_RTO_MS);
+    fprintf(stderr, "  -m PATH     exponer métricas de Prometheus en el socket Unix PATH\n");
+    fprintf(stderr, "  -l NIVEL    nivel de registro: error, warn, info (por defecto) o debug (un mensaje por paquete)\n");
+    fprintf(stderr, "  -P TRAZA    reproducir un pcap o synthetic:CLIENTES[:RENOVACIONES] sin sockets, medir y salir\n");
+    fprintf(stderr, "  -U          recibir y reenviar con io_uring; sin soporte del kernel se usa recvmmsg/sendmmsg\n");
 }
 
-int main() {
-    int relay_sock;  // Descriptor del socket del relay
-    struct sockaddr_in relay_addr, client_addr, server_addr;  // Direcciones del relay, cliente y servidor
-    struct dhcp_packet dhcp_request;  // Paquete DHCP para manejar las solicitudes
-    socklen_t addr_len = sizeof(client_addr);  // Tamaño de la estructura de la dirección
-    ssize_t recv_len;  // Variable para almacenar la longitud del mensaje recibido
+int main(int argc, char *argv[]) {
+    struct sockaddr_in relay_addr;  // Dirección del relay
+    int opt;
+    const char *metrics_path = NULL;
+    const char *replay_spec = NULL;
+    int level = LOG_INFO;
+
+    config.giaddr = inet_addr("192.168.0.2");  // IP del relay
+    while ((opt = getopt(argc, argv, "p:s:g:n:t:r:m:l:P:Uh")) != -1) {
+        switch (opt) {
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 's':
+                if (!add_upstream(optarg)) {
+                    return 1;
+                }
+                break;
+            case 'g':
+                if (inet_pton(AF_INET, optarg, &config.giaddr) != 1) {
+                    fprintf(stderr, "giaddr inválido: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                config.max_pending = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                config.timeout_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                config.max_rto_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                metrics_path = optarg;
+                break;
+            case 'P':
+                replay_spec = optarg;
+                break;
+            case 'U':
+                config.uring = 1;
+                break;
+            case 'l':
+                if ((level = log_parse_level(optarg)) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (config.max_pending == 0 || config.timeout_ms == 0 || config.max_rto_ms == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (log_start(level) < 0) {
+        perror("Error al arrancar el hilo de registro");
+        return 1;
+    }
+    if (upstream_count == 0) {
+        add_upstream("192.168.0.1");  // IP del servidor DHCP
+    }
+    for (int u = 0; u < upstream_count; u++) {
+        upstreams[u].rto_us = clamp_rto(upstreams[u].rto_us);
+    }
+    build_ring();
+    pending_init(&pending, config.max_pending);
+    if (replay_spec != NULL) {
+        return run_replay(replay_spec);
+    }
 
-    // Crear un socket UDP para el relay
-    if ((relay_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    // Crear un socket UDP no bloqueante para el relay
+    if ((relay_sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0) {
         perror("Error al crear socket del relay");
         exit(1);
     }
+    int bufsize = 8 << 20;
+    setsockopt(relay_sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(relay_sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
 
     // Configurar la dirección del relay para escuchar en cualquier interfaz
     memset(&relay_addr, 0, sizeof(relay_addr));  // Limpiar la estructura
     relay_addr.sin_family = AF_INET;  // IPv4
     relay_addr.sin_addr.s_addr = htonl(INADDR_ANY);  // Escuchar en cualquier interfaz disponible
-    relay_addr.sin_port = htons(1067);  // Usar un puerto arbitrario para el relay
+    relay_addr.sin_port = htons(config.port);
 
     // Enlazar el socket a la dirección del relay
     if (bind(relay_sock, (struct sockaddr *)&relay_addr, sizeof(relay_addr)) < 0) {
@@ -68,61 +1018,116 @@ int main() {
         exit(1);
     }
 
-    // Ciclo principal del relay: recibir y reenviar paquetes
-    while (1) {
-        printf("Esperando paquete DHCP del cliente...\n");
+    // Temporizador para vencer transacciones y publicar estadísticas
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec tick = { { 0, TICK_MS * 1000000 }, { 0, TICK_MS * 1000000 } };
+    timerfd_settime(timer_fd, 0, &tick, NULL);
 
-        // Recibir paquete DHCP (Discover o Request) desde el cliente
-        recv_len = recvfrom(relay_sock, &dhcp_request, sizeof(dhcp_request), 0, (struct sockaddr *)&client_addr, &addr_len);
-        if (recv_len < 0) {
-            perror("Error al recibir paquete del cliente");
-            continue;
+    int ep = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = relay_sock };
+    epoll_ctl(ep, EPOLL_CTL_ADD, relay_sock, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, timer_fd, &ev);
+    int metrics_fd = -1;
+    if (metrics_path != NULL) {
+        if ((metrics_fd = metrics_listen(metrics_path)) < 0) {
+            exit(1);
         }
+        ev.data.fd = metrics_fd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, metrics_fd, &ev);
+    }
 
-        printf("Paquete recibido con tamaño: %zd bytes\n", recv_len);
-        printf("Paquete recibido del cliente con xid: %u\n", ntohl(dhcp_request.xid));
-
-        // Identificar el tipo de paquete DHCP recibido (Discover, Request, etc.)
-        uint8_t dhcp_message_type = get_dhcp_message_type(&dhcp_request);
-
-        // Configurar la dirección del servidor DHCP para reenviar el paquete
-        memset(&server_addr, 0, sizeof(server_addr));  // Limpiar la estructura
-        server_addr.sin_family = AF_INET;  // IPv4
-        server_addr.sin_port = htons(DHCP_SERVER_PORT);  // Puerto del servidor DHCP (67)
-        server_addr.sin_addr.s_addr = inet_addr("192.168.0.1");  // IP del servidor DHCP
+    // Los paquetes se reenvían desde el mismo buffer en que se recibieron
+    static struct dhcp_packet packets[RELAY_BATCH];
+    struct sockaddr_in sources[RELAY_BATCH], destinations[RELAY_BATCH];
+    struct mmsghdr rx_msgs[RELAY_BATCH], tx_msgs[RELAY_BATCH];
+    struct iovec rx_iov[RELAY_BATCH], tx_iov[RELAY_BATCH];
+    memset(rx_msgs, 0, sizeof(rx_msgs));
+    memset(tx_msgs, 0, sizeof(tx_msgs));
+    for (int i = 0; i < RELAY_BATCH; i++) {
+        rx_iov[i].iov_base = &packets[i];
+        rx_iov[i].iov_len = sizeof(struct dhcp_packet);
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rx_msgs[i].msg_hdr.msg_name = &sources[i];
+    }
 
-        // Modificar el campo giaddr (Gateway IP Address) antes de reenviar el paquete al servidor
-        dhcp_request.giaddr = inet_addr("192.168.0.2");  // IP del relay
-        printf("Reenviando paquete al servidor DHCP con giaddr: %s\n", inet_ntoa(*(struct in_addr *)&dhcp_request.giaddr));
+    uint64_t last_report = now_ns();
+    LOG(LOG_INFO, "Relay escuchando en el puerto %d con %d servidor(es), giaddr %I", config.port, upstream_count,
+        config.giaddr);
+    if (config.uring && relay_uring(timer_fd, metrics_fd, &last_report) < 0) {
+        perror("Aviso: io_uring no disponible, se usa recvmmsg");
+    }
 
-        // Reenviar el paquete DHCP al servidor
-        if (sendto(relay_sock, &dhcp_request, recv_len, 0, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-            perror("Error al reenviar paquete al servidor DHCP");
+    // Ciclo principal del relay: nunca se bloquea esperando una respuesta concreta
+    while (1) {
+        struct epoll_event events[3];
+        int n = epoll_wait(ep, events, 3, -1);
+        stats.syscalls++;
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait");
+            }
             continue;
         }
 
-        printf("Paquete reenviado al servidor DHCP.\n");
-
-        // Esperar la respuesta del servidor DHCP (Offer o ACK)
-        printf("Esperando respuesta del servidor DHCP...\n");
-        int resp_len = recvfrom(relay_sock, &dhcp_request, sizeof(dhcp_request), 0, NULL, NULL);
-        if (resp_len < 0) {
-            perror("Error al recibir respuesta del servidor DHCP");
-            continue;
-        }
+        for (int e = 0; e < n; e++) {
+            uint64_t now = now_ns();
+            if (events[e].data.fd == metrics_fd) {
+                metrics_serve(metrics_fd, write_relay_metrics);
+                continue;
+            }
+            if (events[e].data.fd == timer_fd) {
+                relay_tick(timer_fd, now, &last_report);
+                continue;
+            }
 
-        printf("Respuesta del servidor DHCP recibida, tamaño: %d bytes\n", resp_len);
+            int received;
+            while (1) {
+                for (int i = 0; i < RELAY_BATCH; i++) {
+                    rx_msgs[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+                }
+                received = recvmmsg(relay_sock, rx_msgs, RELAY_BATCH, MSG_DONTWAIT, NULL);
+                stats.syscalls++;
+                if (received <= 0) {
+                    break;
+                }
+                stats.received += received;
+                now = now_ns();
 
-        // Identificar el tipo de mensaje recibido del servidor (Offer o ACK)
-        dhcp_message_type = get_dhcp_message_type(&dhcp_request);
+                int out = 0;
+                for (int i = 0; i < received; i++) {
+                    struct dhcp_packet *packet = &packets[i];
+                    size_t len = rx_msgs[i].msg_len;
+                    if (!relay_packet(packet, len, &sources[i], &destinations[out], now)) {
+                        continue;
+                    }
+                    tx_iov[out].iov_base = packet;
+                    tx_iov[out].iov_len = len;
+                    tx_msgs[out].msg_hdr.msg_iov = &tx_iov[out];
+                    tx_msgs[out].msg_hdr.msg_iovlen = 1;
+                    tx_msgs[out].msg_hdr.msg_name = &destinations[out];
+                    tx_msgs[out].msg_hdr.msg_namelen = sizeof(destinations[out]);
+                    out++;
+                }
 
-        // Reenviar la respuesta del servidor al cliente
-        if (sendto(relay_sock, &dhcp_request, resp_len, 0, (struct sockaddr *)&client_addr, addr_len) < 0) {
-            perror("Error al reenviar respuesta al cliente");
-            continue;
+                // Reenviar todo el lote con una sola llamada
+                for (int sent = 0; sent < out;) {
+                    int r = sendmmsg(relay_sock, tx_msgs + sent, out - sent, 0);
+                    stats.syscalls++;
+                    if (r < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            perror("Error al reenviar lote");
+                        }
+                        break;  // El cliente retransmitirá
+                    }
+                    sent += r;
+                }
+            }
+            if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error al recibir paquetes");
+            }
         }
-
-        printf("Respuesta DHCP reenviada al cliente.\n");
     }
 
     // Cerrar el socket del relay antes de salir
@@ -0,0 +1,436 @@
+// Reproducción de trazas compartida por el servidor y el relay.
+//
+// Con -P, cada programa lee una traza y pasa sus paquetes directamente a su
+// núcleo de protocolo (el código que convierte un paquete recibido en los
+// paquetes a enviar), sin sockets ni hilos, tan rápido como puede. Así se
+// mide el coste del protocolo aislado de la red y se obtienen pruebas de
+// regresión deterministas: la misma traza con la misma configuración produce
+// siempre las mismas salidas y, por tanto, el mismo resumen.
+//
+// Una traza es un fichero pcap (microsegundos o nanosegundos, cualquier orden
+// de bytes; enlaces Ethernet con o sin VLAN, Linux "cooked" v1/v2, IPv4 en
+// crudo o loopback BSD) o una traza sintética "synthetic:CLIENTES[:RENOVACIONES]":
+// cada cliente envía un DISCOVER, un REQUEST y luego las renovaciones pedidas,
+// por rondas, a 1 µs de tiempo de traza entre paquetes. La traza "options" es
+// el corpus de opciones malformadas: antes de reproducirla se comprueba que
+// dhcp_options_parse_packet() da en cada caso el resultado esperado.
+//
+// El número de reservas de memoria se cuenta sustituyendo malloc, calloc,
+// realloc y aligned_alloc del proceso por versiones que suman uno a un
+// contador y llaman a las de glibc. Con AddressSanitizer no se sustituyen
+// (ASan ya intercepta esas funciones) y la cuenta no está disponible.
+#ifndef DHCP_REPLAY_H
+#define DHCP_REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "dhcp_options.h"
+
+#define REPLAY_PACKET_LEN 300      // Tamaño de los paquetes sintéticos (mínimo BOOTP)
+#define REPLAY_PACKET_GAP_NS 1000  // Tiempo de traza entre paquetes sintéticos
+#define REPLAY_HASH_INIT 0xcbf29ce484222325ull  // Base de FNV-1a de 64 bits
+#define REPLAY_CORPUS_SLOT 576     // Hueco de cada paquete del corpus (máximo de RFC 2131)
+#define REPLAY_CASE_NO_COOKIE 1    // El paquete del caso lleva la cookie mágica a cero
+
+// Un datagrama UDP de la traza; direcciones y puertos en orden de red
+struct replay_packet {
+    uint64_t time_ns;     // Desde el primer paquete de la traza
+    const uint8_t *data;  // Carga UDP: el mensaje DHCP
+    uint32_t len;
+    uint32_t src_addr, dst_addr;
+    uint16_t src_port, dst_port;
+};
+
+struct replay_trace {
+    struct replay_packet *packets;
+    size_t count;
+    uint8_t *storage;  // Paquetes de una traza sintética
+    int synthetic;     // 1: solo trae peticiones de clientes, sin respuestas de servidores
+    void *map;         // Fichero pcap proyectado en memoria
+    size_t map_len;
+};
+
+#if !defined(__SANITIZE_ADDRESS__)
+static _Atomic uint64_t replay_allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&replay_allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&replay_allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&replay_allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    atomic_fetch_add_explicit(&replay_allocations, 1, memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+// Reservas de memoria hechas hasta ahora por todo el proceso, o -1 si no se cuentan
+static inline int64_t replay_allocation_count(void) {
+    return (int64_t)atomic_load_explicit(&replay_allocations, memory_order_relaxed);
+}
+#else
+static inline int64_t replay_allocation_count(void) {
+    return -1;
+}
+#endif
+
+// FNV-1a de 64 bits: resume las salidas para compararlas entre ejecuciones
+static inline uint64_t replay_hash(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static inline uint32_t replay_get32(const uint8_t *p, int swap) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+// Posición de la cabecera IPv4 dentro de una trama del enlace 'linktype', o -1
+static inline long replay_ipv4_offset(const uint8_t *frame, uint32_t caplen, uint32_t linktype) {
+    uint16_t ethertype;
+    long offset;
+    switch (linktype) {
+        case 0:  // Loopback BSD: familia de 4 bytes en el orden del equipo que capturó
+            return (caplen >= 4 && (frame[0] == 2 || frame[3] == 2)) ? 4 : -1;
+        case 1:  // Ethernet, con una o dos etiquetas VLAN
+            offset = 12;
+            if (caplen < 14) {
+                return -1;
+            }
+            ethertype = (frame[offset] << 8) | frame[offset + 1];
+            while ((ethertype == 0x8100 || ethertype == 0x88a8) && caplen >= (uint32_t)offset + 6) {
+                offset += 4;
+                ethertype = (frame[offset] << 8) | frame[offset + 1];
+            }
+            return ethertype == 0x0800 ? offset + 2 : -1;
+        case 101:  // IPv4 en crudo
+        case 228:
+            return 0;
+        case 113:  // Linux "cooked" v1: protocolo en los bytes 14-15
+            return (caplen >= 16 && frame[14] == 0x08 && frame[15] == 0x00) ? 16 : -1;
+        case 276:  // Linux "cooked" v2: protocolo en los bytes 0-1
+            return (caplen >= 20 && frame[0] == 0x08 && frame[1] == 0x00) ? 20 : -1;
+    }
+    return -1;
+}
+
+// Extrae el datagrama UDP de una trama; devuelve 1 si lo es (IPv4, sin fragmentar)
+static inline int replay_parse_frame(const uint8_t *frame, uint32_t caplen, uint32_t linktype,
+                                     struct replay_packet *out) {
+    long ip = replay_ipv4_offset(frame, caplen, linktype);
+    if (ip < 0 || caplen < (uint32_t)ip + 20) {
+        return 0;
+    }
+    const uint8_t *hdr = frame + ip;
+    uint32_t ihl = (hdr[0] & 0x0f) * 4, total = (hdr[2] << 8) | hdr[3];
+    if ((hdr[0] >> 4) != 4 || ihl < 20 || hdr[9] != 17 || (((hdr[6] << 8) | hdr[7]) & 0x3fff) != 0) {
+        return 0;  // No es IPv4 + UDP, o es un fragmento
+    }
+    uint32_t available = caplen - ip;
+    if (total < available) {
+        available = total;  // Relleno de la trama Ethernet
+    }
+    if (available < ihl + 8) {
+        return 0;
+    }
+    const uint8_t *udp = hdr + ihl;
+    uint32_t udp_len = (udp[4] << 8) | udp[5];
+    out->len = available - ihl - 8;
+    if (udp_len >= 8 && udp_len - 8 < out->len) {
+        out->len = udp_len - 8;
+    }
+    memcpy(&out->src_addr, hdr + 12, 4);
+    memcpy(&out->dst_addr, hdr + 16, 4);
+    memcpy(&out->src_port, udp, 2);
+    memcpy(&out->dst_port, udp + 2, 2);
+    out->data = udp + 8;
+    return 1;
+}
+
+// Indexa los datagramas UDP de un pcap proyectado en memoria (sin copiarlos)
+static inline int replay_load_pcap(struct replay_trace *trace, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("Error al abrir la traza");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    trace->map_len = st.st_size;
+    trace->map = trace->map_len >= 24 ? mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (trace->map == MAP_FAILED) {
+        fprintf(stderr, "%s no es un fichero pcap\n", path);
+        trace->map = NULL;
+        return -1;
+    }
+    const uint8_t *data = trace->map;
+    uint32_t magic;
+    memcpy(&magic, data, 4);
+    int swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    uint32_t tick_ns = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1) ? 1 : 1000;  // Nanosegundos o microsegundos
+    if (!swap && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d) {
+        fprintf(stderr, "%s no es un fichero pcap (pcapng no está soportado)\n", path);
+        return -1;
+    }
+    uint32_t linktype = replay_get32(data + 20, swap) & 0x0fffffff;
+
+    // Primera pasada para contar los registros y reservar el índice de una vez
+    size_t records = 0;
+    for (size_t pos = 24; pos + 16 <= trace->map_len; records++) {
+        pos += 16 + replay_get32(data + pos + 8, swap);
+    }
+    trace->packets = malloc((records > 0 ? records : 1) * sizeof(struct replay_packet));
+    if (trace->packets == NULL) {
+        perror("Error al asignar el índice de la traza");
+        return -1;
+    }
+    uint64_t first = 0;
+    for (size_t pos = 24; pos + 16 <= trace->map_len;) {
+        uint32_t caplen = replay_get32(data + pos + 8, swap);
+        if (pos + 16 + caplen > trace->map_len) {
+            break;  // Registro truncado al final del fichero
+        }
+        uint64_t t = (uint64_t)replay_get32(data + pos, swap) * 1000000000ull +
+                     (uint64_t)replay_get32(data + pos + 4, swap) * tick_ns;
+        struct replay_packet *p = &trace->packets[trace->count];
+        if (replay_parse_frame(data + pos + 16, caplen, linktype, p)) {
+            if (trace->count == 0) {
+                first = t;
+            }
+            p->time_ns = t > first ? t - first : 0;
+            trace->count++;
+        }
+        pos += 16 + caplen;
+    }
+    return 0;
+}
+
+// Escribe en 'packet' (REPLAY_PACKET_LEN bytes) una solicitud de tipo 'type'
+// del cliente sintético 'client', con MAC 02:00 + índice
+static inline void replay_build_request(uint8_t *packet, uint32_t client, uint32_t xid, uint8_t type) {
+    uint32_t cookie = htonl(0x63825363), index = htonl(client);
+    xid = htonl(xid);
+    memset(packet, 0, REPLAY_PACKET_LEN);
+    packet[0] = 1;  // BOOTREQUEST
+    packet[1] = 1;  // Ethernet
+    packet[2] = 6;
+    memcpy(packet + 4, &xid, 4);
+    packet[28] = 0x02;
+    memcpy(packet + 30, &index, 4);
+    memcpy(packet + 236, &cookie, 4);
+    packet[240] = 53;  // Tipo de mensaje
+    packet[241] = 1;
+    packet[242] = type;
+    packet[243] = 255;
+}
+
+// Traza sintética: 'clients' MACs 02:00 seguidas del índice, cada una con un
+// DISCOVER, un REQUEST y 'renews' REQUEST más, enviados por rondas al puerto 'port'
+static inline int replay_synthetic(struct replay_trace *trace, uint32_t clients, uint32_t renews, uint16_t port) {
+    size_t rounds = 2 + (size_t)renews;
+    trace->synthetic = 1;
+    trace->count = (size_t)clients * rounds;
+    trace->packets = malloc(trace->count * sizeof(struct replay_packet));
+    trace->storage = malloc(trace->count * REPLAY_PACKET_LEN);
+    if (trace->packets == NULL || trace->storage == NULL) {
+        perror("Error al generar la traza sintética");
+        return -1;
+    }
+    for (size_t k = 0; k < trace->count; k++) {
+        uint32_t client = k % clients, round = k / clients;
+        uint8_t *packet = trace->storage + k * REPLAY_PACKET_LEN;
+        replay_build_request(packet, client, (round << 24) ^ client, round == 0 ? 1 : 3);  // DISCOVER y después REQUEST
+
+        struct replay_packet *p = &trace->packets[k];
+        p->time_ns = k * REPLAY_PACKET_GAP_NS;
+        p->data = packet;
+        p->len = REPLAY_PACKET_LEN;
+        p->src_addr = 0;
+        p->dst_addr = htonl(0xffffffff);
+        p->src_port = htons(68);
+        p->dst_port = htons(port);
+    }
+    return 0;
+}
+
+// Caso del corpus de opciones: las opciones son 'prefix', 'repeat' copias de
+// 'fill' y 'suffix'. El paquete es la cabecera BOOTP de un DISCOVER seguida de
+// ellas, salvo que 'packet_len' fije otra longitud total (cabeceras truncadas).
+struct replay_options_case {
+    const char *name;
+    const char *prefix;
+    size_t prefix_len;
+    uint16_t repeat;
+    uint8_t fill;
+    const char *suffix;
+    size_t suffix_len;
+    uint16_t packet_len;
+    uint8_t flags;
+    int result;    // Lo que debe devolver dhcp_options_parse_packet()
+    uint8_t type;  // Lo que debe devolver después dhcp_message_type()
+};
+
+#define REPLAY_BYTES(s) s, sizeof(s) - 1
+
+static const struct replay_options_case replay_options_corpus[] = {
+    { "mínimo", REPLAY_BYTES("\x35\x01\x01\xff"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_OK, 1 },
+    { "PAD alrededor", REPLAY_BYTES("\x00\x00\x35\x01\x03\x00"), 0, 0, REPLAY_BYTES("\xff"), 0, 0, DHCP_OPTIONS_OK, 3 },
+    { "relleno hasta 576 bytes", REPLAY_BYTES("\x35\x01\x01"), 332, 0, REPLAY_BYTES("\xff"), 0, 0, DHCP_OPTIONS_OK, 1 },
+    { "solo PAD", REPLAY_BYTES(""), 60, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_NO_END, 0 },
+    { "sin opciones", REPLAY_BYTES(""), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_NO_END, 0 },
+    { "sin END", REPLAY_BYTES("\x35\x01\x01\x0c\x02\x61\x62"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_NO_END, 1 },
+    { "END primero", REPLAY_BYTES("\xff\x35\x01\x01"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_OK, 0 },
+    { "código sin longitud", REPLAY_BYTES("\x35\x01\x01\x0c"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_TRUNCATED, 1 },
+    { "longitud fuera del buffer", REPLAY_BYTES("\x35\x01\x01\x0c\xc8\x61"), 0, 0, REPLAY_BYTES(""), 0, 0,
+      DHCP_OPTIONS_TRUNCATED, 1 },
+    { "tipo truncado al final", REPLAY_BYTES("\x00\x35\x02\x01"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_TRUNCATED, 0 },
+    { "opción de 255 bytes", REPLAY_BYTES("\x35\x01\x01\x2b\xff"), 255, 0xaa, REPLAY_BYTES("\xff"), 0, 0,
+      DHCP_OPTIONS_OK, 1 },
+    { "opción de 255 bytes sin el último", REPLAY_BYTES("\x35\x01\x01\x2b\xff"), 254, 0xaa, REPLAY_BYTES(""), 0, 0,
+      DHCP_OPTIONS_TRUNCATED, 1 },
+    { "client-id que cruza el final", REPLAY_BYTES("\x35\x01\x01\x3d\x07\x01\x02\x00\x00\x00\x00"), 0, 0,
+      REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_TRUNCATED, 1 },
+    { "tipo de longitud 0", REPLAY_BYTES("\x35\x00\xff"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_OK, 0 },
+    { "tipo de longitud 2", REPLAY_BYTES("\x35\x02\x01\x01\xff"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_OK, 0 },
+    { "tipo repetido", REPLAY_BYTES("\x35\x01\x01\x35\x01\x03\xff"), 0, 0, REPLAY_BYTES(""), 0, 0, DHCP_OPTIONS_OK, 1 },
+    { "IP solicitada de 3 bytes", REPLAY_BYTES("\x35\x01\x03\x32\x03\x0a\x00\x00\xff"), 0, 0, REPLAY_BYTES(""), 0, 0,
+      DHCP_OPTIONS_OK, 3 },
+    { "identificador de servidor de 0 bytes", REPLAY_BYTES("\x35\x01\x03\x36\x00\xff"), 0, 0, REPLAY_BYTES(""), 0, 0,
+      DHCP_OPTIONS_OK, 3 },
+    { "solo cabecera", REPLAY_BYTES(""), 0, 0, REPLAY_BYTES(""), DHCP_OPTIONS_OFFSET, 0, DHCP_OPTIONS_NO_END, 0 },
+    { "cabecera truncada", REPLAY_BYTES(""), 0, 0, REPLAY_BYTES(""), 200, 0, DHCP_OPTIONS_BAD_HEADER, 0 },
+    { "sin cookie mágica", REPLAY_BYTES("\x35\x01\x01\xff"), 0, 0, REPLAY_BYTES(""), 0, REPLAY_CASE_NO_COOKIE,
+      DHCP_OPTIONS_BAD_HEADER, 0 },
+    { "un byte", REPLAY_BYTES(""), 0, 0, REPLAY_BYTES(""), 1, 0, DHCP_OPTIONS_BAD_HEADER, 0 },
+};
+
+#define REPLAY_OPTIONS_CASES (sizeof(replay_options_corpus) / sizeof(replay_options_corpus[0]))
+
+// Escribe en 'packet' (REPLAY_CORPUS_SLOT bytes) el paquete del caso 'c' y
+// devuelve su longitud
+static inline size_t replay_build_options_case(uint8_t *packet, const struct replay_options_case *c, uint32_t client) {
+    replay_build_request(packet, client, client, 1);
+    memset(packet + DHCP_OPTIONS_OFFSET, 0, REPLAY_CORPUS_SLOT - DHCP_OPTIONS_OFFSET);
+    if (c->flags & REPLAY_CASE_NO_COOKIE) {
+        memset(packet + DHCP_COOKIE_OFFSET, 0, 4);
+    }
+    size_t pos = DHCP_OPTIONS_OFFSET;
+    memcpy(packet + pos, c->prefix, c->prefix_len);
+    pos += c->prefix_len;
+    memset(packet + pos, c->fill, c->repeat);
+    pos += c->repeat;
+    memcpy(packet + pos, c->suffix, c->suffix_len);
+    pos += c->suffix_len;
+    return c->packet_len != 0 ? c->packet_len : pos;
+}
+
+// Pasa cada caso del corpus por el analizador. Devuelve los que no dan el
+// resultado o el tipo de mensaje esperados, tras escribirlos en stderr.
+static inline int replay_check_options(void) {
+    static uint8_t packet[REPLAY_CORPUS_SLOT];
+    struct dhcp_options opts;
+    int failures = 0;
+    for (size_t k = 0; k < REPLAY_OPTIONS_CASES; k++) {
+        const struct replay_options_case *c = &replay_options_corpus[k];
+        size_t len = replay_build_options_case(packet, c, (uint32_t)k);
+        int result = dhcp_options_parse_packet(&opts, packet, len);
+        uint8_t type = dhcp_message_type(&opts);
+        if (result != c->result || type != c->type) {
+            fprintf(stderr, "Corpus de opciones, caso \"%s\": resultado %d y tipo %u, se esperaba %d y %u\n",
+                    c->name, result, type, c->result, c->type);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// Traza del corpus: un paquete por caso, cada uno de un cliente distinto
+static inline int replay_options(struct replay_trace *trace, uint16_t port) {
+    int failures = replay_check_options();
+    if (failures > 0) {
+        fprintf(stderr, "%d de %zu casos del corpus de opciones fallan\n", failures, REPLAY_OPTIONS_CASES);
+        return -1;
+    }
+    trace->synthetic = 1;
+    trace->count = REPLAY_OPTIONS_CASES;
+    trace->packets = malloc(trace->count * sizeof(struct replay_packet));
+    trace->storage = malloc(trace->count * REPLAY_CORPUS_SLOT);
+    if (trace->packets == NULL || trace->storage == NULL) {
+        perror("Error al generar el corpus de opciones");
+        return -1;
+    }
+    for (size_t k = 0; k < trace->count; k++) {
+        uint8_t *packet = trace->storage + k * REPLAY_CORPUS_SLOT;
+        struct replay_packet *p = &trace->packets[k];
+        p->time_ns = k * REPLAY_PACKET_GAP_NS;
+        p->data = packet;
+        p->len = (uint32_t)replay_build_options_case(packet, &replay_options_corpus[k], (uint32_t)k);
+        p->src_addr = 0;
+        p->dst_addr = htonl(0xffffffff);
+        p->src_port = htons(68);
+        p->dst_port = htons(port);
+    }
+    return 0;
+}
+
+// Abre "synthetic:CLIENTES[:RENOVACIONES]", el corpus "options" o un fichero pcap. 'port' es el
+// puerto de destino de los paquetes sintéticos (el del programa que reproduce).
+static inline int replay_open(struct replay_trace *trace, const char *spec, uint16_t port) {
+    memset(trace, 0, sizeof(*trace));
+    if (strncmp(spec, "synthetic:", 10) == 0) {
+        char *end;
+        unsigned long clients = strtoul(spec + 10, &end, 10), renews = 1;
+        if (*end == ':') {
+            renews = strtoul(end + 1, &end, 10);
+        }
+        if (clients == 0 || clients > 0xffffff || renews > 250 || *end != '\0') {
+            fprintf(stderr, "Traza sintética inválida: %s (synthetic:CLIENTES[:RENOVACIONES])\n", spec);
+            return -1;
+        }
+        return replay_synthetic(trace, clients, renews, port);
+    }
+    if (strcmp(spec, "options") == 0) {
+        return replay_options(trace, port);
+    }
+    return replay_load_pcap(trace, spec);
+}
+
+static inline void replay_close(struct replay_trace *trace) {
+    free(trace->packets);
+    free(trace->storage);
+    if (trace->map != NULL) {
+        munmap(trace->map, trace->map_len);
+    }
+}
+
+#endif
@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -8,15 +10,94 @@
 #include <time.h>
 #include <sys/select.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/timerfd.h>
+#include <linux/filter.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "dhcp_options.h"
+#include "dhcp_metrics.h"
+#include "dhcp_log.h"
+#include "dhcp_replay.h"
+#include "dhcp_uring.h"
+#include "dhcp_raw.h"
 
 #define DHCP_DISCOVER 1
 #define DHCP_REQUEST 3
 #define DHCP_OFFER 2
 #define DHCP_ACK 5
 #define DHCP_NAK 6
+#define DHCP_DECLINE 4
+#define DHCP_RELEASE 7
 #define DHCP_MAGIC_COOKIE 0x63825363
-#define MAX_CLIENTS 10
+#define SERVER_PORT 67             // Puerto DHCP del servidor
+#define CLIENT_PORT 68             // Puerto DHCP de los clientes (respuestas por trama)
+#define LEASE_TABLE_INITIAL 1024   // Entradas reservadas al crear la tabla de un pool; crece al doble
 #define LEASE_TIME 60   // Tiempo de arrendamiento en segundos
+#define DEFAULT_OFFER_TTL 10       // Segundos que una IP ofrecida queda reservada esperando el REQUEST
+#define DECLINE_PROBATION 600      // Segundos de cuarentena de una IP rechazada con DECLINE
+#define LEASE_OFFERED 0            // lease_table.expires de una entrada ofrecida, aún sin ACK
+#define LEASE_DECLINED UINT32_MAX  // ... y de una IP en cuarentena tras un DECLINE
+#define DEFAULT_WORKERS 4          // Hilos trabajadores por defecto
+#define DEFAULT_QUEUE_SIZE 1024    // Ranuras de la cola de solicitudes (potencia de 2)
+#define SLAB_BATCH 32              // Buffers que un trabajador acumula antes de devolverlos al depósito
+#define SLAB_NONE UINT32_MAX       // Índice de buffer nulo (fin de lista)
+#define STATS_INTERVAL 10          // Segundos entre reportes de rendimiento
+#define LAT_SUB_BITS 3             // Sub-buckets por potencia de 2 en el histograma de latencia
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+#define HASH_MAX_PROBES 16         // Palabras del mapa de bits (64 IPs cada una) que mira la asignación por hash
+#define INDEX_BUCKET_SLOTS 5       // Entradas por bucket del índice MAC (un bucket = una línea de caché)
+#define INDEX_MAX_LOAD_PCT 80      // Ocupación máxima del índice MAC para la capacidad de la tabla
+#define MAC_KEY_USED (1ull << 48)  // Marca de entrada ocupada en la clave empaquetada
+#define MAC_KEY_TOMBSTONE (1ull << 63)  // Entrada borrada; la sonda debe continuar
+#define WHEEL_BITS 8               // Ranuras por nivel de la rueda de temporizadores = 2^8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 3             // 256 s, ~18 h y ~194 días de horizonte
+#define DEFAULT_SHARD_BATCH 32     // Tamaño de lote de cada fragmento si no se da -B
+#define DHCP_MIN_REPLY_LEN 300     // Tamaño mínimo de un mensaje BOOTP (RFC 1542)
+#define JOURNAL_FLUSH_MS 5         // Ventana de commit en grupo del diario de leases
+#define JOURNAL_INITIAL_RECORDS 1024
+#define SNAPSHOT_INTERVAL 300      // Segundos entre instantáneas compactadas
+#define SNAPSHOT_CHUNK 4096        // Entradas copiadas por cada toma del mutex del pool
+#define SNAPSHOT_MAGIC "DHCPSNAP"
+#define SNAPSHOT_VERSION 1
+#define LPM_INITIAL_NODES 16       // Nodos reservados al crear el trie de subredes
+#define PKTINFO_CONTROL_LEN CMSG_SPACE(sizeof(struct in_pktinfo))  // Datos auxiliares de IP_PKTINFO
+#define RATE_SKETCH_ROWS 4         // Filas (funciones hash) de cada sketch de admisión
+#define RATE_MAC_BITS 12           // 2^12 celdas por fila para las MACs (128 KB por hilo receptor)
+#define RATE_RELAY_BITS 8          // 2^8 celdas por fila para los giaddr
+#define RATE_DRAIN_MAX 64          // Descartes seguidos que reutilizan la misma ranura de la cola
+#define RCU_MAX_READERS 256        // Hilos que pueden leer sin el mutex de los pools
+#define BENCH_SECONDS 1            // Duración de cada medida del banco de contención
+#define BENCH_CLIENTS 65536        // Leases que renuevan los lectores del banco de contención
+#define INDEX_BENCH_LOOKUPS 4000000   // Búsquedas medidas por cada tamaño del banco del índice MAC
+#define OPTIONS_BENCH_PARSES 4000000  // Análisis medidos por cada paquete del banco de opciones
+#define URING_ENTRIES 256          // SQEs del anillo de cada hilo receptor con io_uring
+#define URING_BUFFERS 1024         // Buffers de recepción provistos (potencia de 2) y respuestas en vuelo
+#define RAW_MAX_INTERFACES 32      // Interfaces de -i en modo captura
+#define RAW_BLOCK_SIZE (1 << 18)   // Bloques de 256 KB en los anillos AF_PACKET
+#define RAW_RX_BLOCKS 16           // Bloques del anillo de recepción
+#define RAW_BLOCK_TIMEOUT_MS 1     // Un bloque a medio llenar se entrega como mucho tras 1 ms
+#define RAW_FRAME_SIZE 2048        // Ranuras del anillo de envío
+#define RAW_TX_BLOCKS 4            // Bloques del anillo de envío (128 ranuras cada uno)
+#define RAW_TX_FRAMES (RAW_TX_BLOCKS * (RAW_BLOCK_SIZE / RAW_FRAME_SIZE))
+// Posición de la trama en una ranura de envío: tras la cabecera TPACKET_V3 y 2
+// bytes más, para que la cabecera IPv4 y el paquete DHCP queden alineados a 4
+#define RAW_TX_DATA_OFFSET (TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + 2)
 
 struct dhcp_packet {
     uint8_t op;
@@ -37,385 +118,4853 @@ struct dhcp_packet {
     uint8_t options[312];
 };
 
-// Estructura para almacenar asignaciones de IP
-struct ip_assignment {
-    uint32_t ip;
+// Tabla de asignaciones de un pool como struct-of-arrays. Lo que se lee en
+// cada paquete (IP, MAC y vencimiento) va en arrays densos y sin relleno; el
+// xid, que casi solo se escribe, va aparte. Los recorridos completos
+// (instantáneas, reconstrucción del índice) leen solo el array de IPs, 4 bytes
+// por entrada. La tabla empieza pequeña y crece al doble hasta 'max_capacity'.
+//
+// Las renovaciones leen y actualizan las entradas sin el mutex del pool, así
+// que los arrays que tocan no pueden moverse: se reserva espacio de direcciones
+// para 'max_capacity' entradas y las páginas se ocupan al crecer. Cada entrada
+// lleva un seqlock: quien la modifica lo deja impar mientras tanto, con o sin
+// el mutex del pool, y quien la lee sin mutex repite si cambió por el camino.
+struct lease_table {
+    uint32_t *ip;          // IP en orden de host; 0 = entrada libre
+    uint8_t (*mac)[6];     // MAC del cliente
+    uint32_t *expires;     // Hora de reloj (segundos) en que vence, LEASE_OFFERED o LEASE_DECLINED
+    uint32_t *deadline;    // Tick de vencimiento fijado por una renovación sin mutex (ver renew_lease)
+    uint32_t *seq;         // Seqlock de la entrada
+    uint32_t *xid;         // Último xid del cliente, para controlar duplicados
+    uint32_t *free;        // Pila de entradas libres para asignar sin recorrer la tabla
+    uint32_t free_top;
+    uint32_t capacity;     // Entradas reservadas
+    uint32_t max_capacity; // Límite de la configuración
+    uint32_t used;         // Entradas asignadas
+};
+
+// Índice hash de direccionamiento abierto MAC -> posición en la tabla de
+// leases. Cada bucket ocupa exactamente una línea de caché, así que una
+// búsqueda típica toca una sola línea sin importar el tamaño del pool.
+struct mac_bucket {
+    uint64_t key[INDEX_BUCKET_SLOTS];    // 0 = vacía, MAC_KEY_TOMBSTONE = borrada
+    uint32_t lease[INDEX_BUCKET_SLOTS];  // Posición de la asignación en la tabla
+    uint32_t pad;
+} __attribute__((aligned(64)));
+
+struct mac_index {
+    struct mac_bucket *buckets;
+    size_t mask;             // Número de buckets - 1
+    size_t used;             // Entradas ocupadas
+    size_t tombstones;       // Entradas borradas pendientes de limpieza
+    struct mac_bucket *spare;  // Buckets del mismo tamaño donde se reconstruye sin reservar memoria
+    uint64_t spare_epoch;    // Época en que 'spare' dejó de estar publicado (0 = nunca lo estuvo)
+};
+
+// Mapa de bits de direcciones libres del rango (bit a 1 = libre). El cursor
+// 'hint' avanza tras cada asignación para repartir las direcciones en rotación
+// en lugar de devolver siempre la más baja.
+struct ip_bitmap {
+    uint64_t *words;
+    size_t nwords;
+    uint32_t base;        // Primera IP del rango (orden de host)
+    uint32_t size;        // Número de direcciones del rango
+    uint32_t hint;        // Desplazamiento desde el que empieza la próxima búsqueda
+    uint32_t free_count;
+};
+
+// Rueda jerárquica de temporizadores para la expiración de leases, con ticks de
+// un segundo. Cada nivel cubre 256 veces el anterior; las entradas de un nivel
+// superior bajan de nivel cuando el tick actual alcanza su ranura. Programar,
+// reprogramar y cancelar son O(1); avanzar un tick solo toca las entradas que
+// vencen (más las que bajan de nivel).
+struct timer_node {
+    uint32_t expire;  // Tick de vencimiento
+    int32_t slot;     // Lista en la que está (nivel * WHEEL_SLOTS + ranura), -1 si ninguna
+    int32_t next;
+    int32_t prev;
+};
+
+struct timer_wheel {
+    uint32_t now;                               // Tick actual
+    int32_t head[WHEEL_LEVELS * WHEEL_SLOTS];   // Primera entrada de cada lista, -1 si vacía
+    struct timer_node *nodes;                   // Un nodo por entrada de la tabla de leases
+};
+
+// Registro del diario de leases. Cada registro describe el estado completo de
+// una asignación, así que reaplicarlos en orden es idempotente.
+enum journal_type {
+    JOURNAL_ASSIGN = 1,  // IP reservada para la MAC (OFFER); ya no se escribe, solo se lee de diarios antiguos
+    JOURNAL_RENEW = 2,   // Lease confirmado o renovado (ACK)
+    JOURNAL_EXPIRE = 3,  // IP liberada
+};
+
+struct journal_record {
+    uint8_t type;
     uint8_t mac[6];
-    time_t lease_start;
-    int lease_duration;
-    uint32_t xid;  // Identificador de transacción para controlar duplicados
+    uint8_t pad;
+    uint32_t ip;
+    uint32_t xid;
+    int64_t lease_start;  // Hora de reloj (time_t) del último ACK, 0 si no hay lease
+    uint32_t lease_duration;
+    uint32_t check;       // Suma de comprobación para detectar escrituras cortadas
+};
+
+// Cabecera del fichero de instantánea; le siguen 'count' registros
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t generation;  // Los diarios con generación >= esta se aplican encima
+    uint64_t count;
+    uint64_t pad;
+};
+
+// Diario de un pool: los registros se acumulan en memoria y el hilo de commit
+// en grupo los escribe con un solo write + fdatasync cada JOURNAL_FLUSH_MS. El
+// buffer tiene su propio mutex, que las renovaciones sin el mutex del pool
+// toman solo para copiar su registro.
+struct lease_journal {
+    pthread_mutex_t lock;            // Protege el buffer activo, el fichero y la generación
+    pthread_mutex_t io;              // Serializa write + fdatasync con la rotación de la instantánea
+    int fd;                          // -1 si el diario está desactivado
+    uint32_t generation;
+    struct journal_record *records;  // Buffer activo
+    size_t count;
+    size_t capacity;
+    struct journal_record *spare;    // Buffer que está escribiendo el hilo de commit
+    size_t spare_capacity;
+    _Atomic unsigned long written;   // Registros ya escritos
+    _Atomic unsigned long syncs;     // Llamadas a fdatasync
+};
+
+// Subred servida: su rango y las opciones que reciben sus clientes. Las
+// direcciones van en orden de host.
+struct subnet {
+    uint32_t network;
+    int prefix_len;
+    uint32_t range_start;
+    uint32_t range_end;
+    uint32_t router;
+    uint32_t dns;
+    uint32_t lease_time;
+    uint32_t max_leases;  // Leases como máximo (por defecto, una por dirección del rango)
+    char name[20];  // "red/prefijo", para el registro y las métricas
+};
+
+// Trie de prefijos de 4 niveles de 8 bits que elige la subred de una dirección
+// por el prefijo más largo. Cada prefijo se expande en el nivel en que termina,
+// así que una búsqueda hace como mucho 4 accesos, haya las subredes que haya.
+struct lpm_node {
+    int32_t child[256];  // Nodo del nivel siguiente, -1 si no hay
+    int32_t match[256];  // Subred con el prefijo más largo que termina en este nivel, -1 si ninguna
+};
+
+struct lpm_table {
+    struct lpm_node *nodes;  // El nodo 0 es la raíz
+    size_t count;
+    size_t capacity;
+};
+
+// Respuestas precodificadas de un pool (ver build_reply_templates)
+struct reply_templates {
+    struct dhcp_packet lease;  // OFFER/ACK
+    size_t lease_len;
+    size_t type_offset;        // Posición del tipo de mensaje en 'options'
+    struct dhcp_packet nak;
+    size_t nak_len;
+};
+
+// Estado de leases de un pool: la tabla de asignaciones y sus estructuras
+// auxiliares, protegidas por un mutex propio. Cada subred tiene un pool por
+// fragmento, con una porción de su rango, así que los pools no compiten.
+struct lease_pool {
+    pthread_mutex_t mutex;           // Protege todo el pool
+    struct lease_table leases;       // Tabla de asignaciones
+    struct mac_index index;
+    struct ip_bitmap bitmap;
+    struct timer_wheel wheel;
+    struct timer_node *timers;
+    struct reply_templates templates;
+    struct lease_journal journal;
+    uint32_t lease_time;             // Duración de los leases de su subred
+    int subnet;                      // Posición de su subred en 'subnets'
+    uint32_t offers;                 // Entradas ofrecidas que esperan su REQUEST
+    uint32_t declined;               // Entradas en cuarentena tras un DECLINE
+    _Atomic uint64_t offers_expired; // Ofertas que vencieron sin reclamar
+} __attribute__((aligned(64)));
+
+const char *journal_dir;  // Directorio del diario (-j); NULL si no se persiste
+
+// Pasadas del hilo de commit en grupo. Un ACK no sale hasta que ha terminado
+// la pasada que escribe su registro: la primera que empieza después de
+// añadirlo. Quien espera lo pide en 'wanted' y la pasada arranca sin agotar
+// la ventana de JOURNAL_FLUSH_MS.
+struct journal_commit {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;             // Para el hilo de commit: hay quien espera
+    pthread_cond_t done;             // Para los que esperan: ha terminado una pasada
+    _Atomic uint64_t started;        // Pasadas empezadas
+    _Atomic uint64_t finished;       // Pasadas terminadas (sus registros ya son durables)
+    uint64_t wanted;                 // Mayor pasada que alguien espera
+    _Atomic int stopping;            // Terminar tras una última pasada (banco del diario)
+    pthread_t thread;
+    pthread_cond_t snapshot_wake;    // Para el hilo de instantáneas: hay que parar
+    pthread_t snapshot_thread;
 };
 
-struct ip_assignment ip_pool[MAX_CLIENTS];
+struct journal_commit journal_commit = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+__thread uint64_t journal_wait_pass;  // Pasada que deben esperar las respuestas pendientes de este hilo
+
 uint32_t ip_range_start = 0xC0A80064;  // 192.168.0.100 en hexadecimal
 uint32_t ip_range_end = 0xC0A800C8;    // 192.168.0.200 en hexadecimal
+uint32_t server_id = 0xC0A80001;       // Identificador del servidor (192.168.0.1)
+
+struct subnet *subnets;  // Subredes del fichero de configuración (-c), o solo la de por defecto
+int subnet_count;
+struct lpm_table subnet_table;
 
-// Mutex para proteger el acceso a ip_pool
-pthread_mutex_t pool_mutex;
+// Un pool por subred y fragmento: el de la subred s y el fragmento f está en
+// la posición s * shard_count + f
+struct lease_pool *lease_pools;
+int pool_count = 1;
+int shard_count = 1;
 
 // Estructura para pasar datos al hilo de cliente
 struct client_request {
     int sock;
     struct sockaddr_in client_addr;
     socklen_t client_addr_len;
+    uint32_t local_addr;        // Dirección local por la que llegó (IP_PKTINFO), 0 si no consta
+    struct timespec recv_time;  // Momento de recepción (para medir latencia)
+    ssize_t recv_len;
     struct dhcp_packet dhcp_request;
 };
 
-// Inicializa el pool de IPs
-void init_ip_pool() {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        ip_pool[i].ip = 0;
-        memset(ip_pool[i].mac, 0, 6);
-        ip_pool[i].lease_start = 0;
-        ip_pool[i].lease_duration = LEASE_TIME;
-        ip_pool[i].xid = 0;
+// Buffer de paquete del modo cola: la solicitud se recibe directamente aquí y
+// el trabajador construye la respuesta en el mismo buffer
+struct packet_buffer {
+    struct client_request request;
+    struct dhcp_packet reply;
+} __attribute__((aligned(64)));
+
+// Slab de buffers de paquete, reservado entero al arrancar. Por la cola solo
+// viaja el índice de un buffer. Los libres se encadenan por índice en 'next':
+// cada hilo tiene su propia lista (slab_free) y los trabajadores devuelven los
+// suyos al depósito común de SLAB_BATCH en SLAB_BATCH con un solo CAS. El
+// receptor se lleva el depósito entero con un intercambio atómico cuando su
+// lista se vacía; como nunca se saca un solo elemento, no hay problema ABA.
+struct packet_slab {
+    struct packet_buffer *buffers;
+    uint32_t *next;
+    uint32_t count;
+    _Alignas(64) _Atomic uint32_t depot;  // Cabeza de la pila de buffers devueltos
+};
+
+// Lista de buffers libres de un hilo
+struct slab_list {
+    uint32_t head, tail, count;
+};
+
+// Ranura de la cola MPMC acotada (Vyukov). El número de secuencia indica si la
+// ranura está libre para el productor (seq == pos) o lista para un consumidor
+// (seq == pos + 1). Cada ranura ocupa su propia línea de caché.
+struct queue_slot {
+    _Atomic size_t seq;
+    uint32_t buffer;  // Índice en el slab, o SLAB_NONE si la ranura se publica vacía
+} __attribute__((aligned(64)));
+
+struct request_queue {
+    struct queue_slot *slots;  // Ranuras preasignadas al arrancar
+    size_t mask;
+    _Alignas(64) _Atomic size_t enqueue_pos;
+    _Alignas(64) _Atomic size_t dequeue_pos;
+    _Alignas(64) sem_t items;  // Despierta a los trabajadores dormidos
+    _Atomic unsigned long dropped;  // Paquetes descartados con la cola llena
+};
+
+// Contadores de métricas de cada hilo (índices de worker_stats.counters)
+enum server_counter {
+    CNT_DISCOVER,        // Mensajes recibidos por tipo
+    CNT_REQUEST,
+    CNT_RELEASE,
+    CNT_DECLINE,
+    CNT_OTHER,
+    CNT_INVALID,         // Paquetes que no son DHCP
+    CNT_OFFER,           // Respuestas construidas por tipo
+    CNT_ACK,
+    CNT_NAK,
+    CNT_UNANSWERED,      // Solicitudes sin respuesta
+    CNT_EXHAUSTED,       // DISCOVER sin direcciones libres
+    CNT_NO_SUBNET,       // Solicitudes reenviadas desde un giaddr sin subred configurada
+    CNT_RENEWS_LOCKFREE, // ACK de renovaciones hechos sin el mutex del pool
+    CNT_LOCKS,           // Adquisiciones del mutex de un pool
+    CNT_LOCKS_CONTENDED, // ... que tuvieron que esperar
+    CNT_COUNT
+};
+
+// Estadísticas por trabajador; solo las escribe su propio hilo, así que se
+// actualizan con metrics_add() sin operaciones atómicas con lock
+struct worker_stats {
+    _Atomic uint64_t handled;
+    _Atomic uint64_t batches;  // Lotes recibidos en modo por lotes
+    _Atomic uint64_t batched;  // Datagramas recibidos en esos lotes
+    _Atomic uint64_t latency[LAT_BUCKETS];  // Histograma log-lineal en ns
+    _Atomic uint64_t counters[CNT_COUNT];
+    _Atomic uint64_t syscalls;  // Llamadas al sistema de E/S de red (esperas, recepciones, envíos)
+    _Atomic uint64_t alloc_probes[HASH_MAX_PROBES + 1];  // Asignaciones por hash según las palabras miradas; la última, las que recorrieron el rango
+    struct metrics_histogram lock_wait;  // Espera en el mutex de un pool, solo si estaba ocupado
+} __attribute__((aligned(64)));
+
+// Cubos de tokens de tamaño fijo para el control de admisión. Cada celda
+// guarda la hora teórica de llegada (GCRA) en ns: un mensaje se admite si, tras
+// sumarle un intervalo, no se adelanta más de la ráfaga a la hora actual. Una
+// clave se reparte en una celda por fila y su estimación es el mínimo de esas
+// celdas (count-min), así que las colisiones solo pueden limitarla de más.
+// La memoria no depende de cuántas MACs o relays distintos aparezcan.
+struct rate_sketch {
+    uint64_t *tat;         // RATE_SKETCH_ROWS filas de 2^bits celdas
+    int bits;
+    uint64_t interval_ns;  // 1 / tasa; 0 = sin límite
+    uint64_t burst_ns;     // Ráfaga * intervalo
+};
+
+// Admisión de un hilo receptor (el principal o un fragmento). Solo la escribe
+// ese hilo, así que los contadores se actualizan con metrics_add().
+struct admission {
+    struct rate_sketch mac;    // Todos los mensajes, por MAC
+    struct rate_sketch relay;  // Solo DISCOVER, por giaddr (0 = clientes conectados directamente)
+    _Atomic uint64_t dropped_mac;
+    _Atomic uint64_t dropped_relay;
+} __attribute__((aligned(64)));
+
+// Cómo elige una IP libre un DISCOVER sin lease
+enum alloc_policy {
+    ALLOC_FIRST_FIT,      // La primera libre desde el cursor del pool
+    ALLOC_HASH_MAC,       // La preferida según un hash de chaddr, o la libre más cercana
+    ALLOC_HASH_CLIENT_ID  // Igual, pero con la opción 61 (client-id) si el cliente la envía
+};
+
+struct server_config {
+    int workers;
+    size_t queue_size;
+    int backpressure;  // 1: esperar a que haya espacio; 0: descartar
+    int batch_size;    // > 0: modo por lotes con recvmmsg/sendmmsg en el hilo principal
+    int rcvbuf;        // Tamaño de SO_RCVBUF en bytes (0 = el del sistema)
+    int shards;        // > 0: un socket SO_REUSEPORT, bucle y pool por fragmento
+    double mac_rate, mac_burst;      // Límite por MAC (0 = sin límite)
+    double relay_rate, relay_burst;  // Límite de DISCOVER por giaddr (0 = sin límite)
+    uint32_t offer_ttl;              // Segundos de reserva de una oferta sin REQUEST
+    int uring;                       // 1: recibir y enviar con io_uring en el hilo principal o en cada fragmento
+    enum alloc_policy alloc_policy;
+    int early_ack;                   // 1: responder sin esperar a que el registro del ACK sea durable
+};
+
+struct server_config config = { DEFAULT_WORKERS, DEFAULT_QUEUE_SIZE, 0, 0, 0, 0, 0, 0, 0, 0, DEFAULT_OFFER_TTL, 0,
+                                ALLOC_FIRST_FIT, 0 };
+struct request_queue request_queue;
+struct packet_slab packet_slab;
+__thread struct slab_list slab_free = { SLAB_NONE, SLAB_NONE, 0 };
+struct worker_stats *worker_stats;
+int stats_slots;  // Entradas de worker_stats en uso
+struct admission *admissions;  // Una por hilo receptor
+int admission_count;
+int raw_port_count;  // Interfaces del modo captura (-i); 0 fuera de ese modo
+_Atomic uint64_t receiver_syscalls;  // Llamadas de E/S del hilo principal cuando reparte a la cola
+__thread struct worker_stats *thread_stats;  // Estadísticas del hilo actual (NULL fuera de trabajadores y fragmentos)
+
+// Reserva las ranuras de la cola; size debe ser potencia de 2
+int queue_init(struct request_queue *q, size_t size) {
+    q->slots = aligned_alloc(64, size * sizeof(struct queue_slot));
+    if (q->slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&q->slots[i].seq, i);
     }
+    q->mask = size - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->dropped, 0);
+    sem_init(&q->items, 0, 0);
+    return 0;
 }
 
-// Encuentra una IP libre
-uint32_t find_free_ip() {
-    for (uint32_t ip = ip_range_start; ip <= ip_range_end; ip++) {
-        int is_assigned = 0;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (ip_pool[i].ip == ip) {
-                is_assigned = 1;
-                break;
+// Reserva una ranura para escribir. Devuelve NULL si la cola está llena.
+struct queue_slot *queue_claim(struct request_queue *q, size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        struct queue_slot *slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *pos_out = pos;
+                return slot;
             }
-        }
-        if (!is_assigned) {
-            return ip;
+        } else if (diff < 0) {
+            return NULL;  // Cola llena
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
         }
     }
-    return 0;  // No hay IPs libres
 }
 
-// Busca si el cliente ya tiene una IP asignada
-uint32_t find_ip_by_mac(uint8_t *mac) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (memcmp(ip_pool[i].mac, mac, 6) == 0) {
-            return ip_pool[i].ip;
+// Publica una ranura escrita y despierta a un trabajador
+void queue_publish(struct request_queue *q, struct queue_slot *slot, size_t pos) {
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    sem_post(&q->items);
+}
+
+// Toma la siguiente solicitud publicada. Devuelve NULL si no hay ninguna.
+struct queue_slot *queue_take(struct request_queue *q, size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        struct queue_slot *slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *pos_out = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL;  // Cola vacía
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
         }
     }
-    return 0;  // El cliente no tiene IP asignada
 }
 
-// Asigna una IP al cliente
-void assign_ip_to_client(uint32_t ip, uint8_t *mac, uint32_t xid) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ip_pool[i].ip == 0) {  // Buscar una entrada libre
-            ip_pool[i].ip = ip;
-            memcpy(ip_pool[i].mac, mac, 6);
-            // ip_pool[i].lease_start = time(NULL);    //Revision
-            // ip_pool[i].lease_duration = LEASE_TIME; //Revision
-            ip_pool[i].xid = xid;  // Guarda el xid para controlar duplicados
-            break;
-        }
+// Devuelve la ranura al productor una vez procesada
+void queue_release(struct request_queue *q, struct queue_slot *slot, size_t pos) {
+    atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+}
+
+// Reserva los 'count' buffers del slab, todos libres en el depósito
+int slab_init(struct packet_slab *slab, uint32_t count) {
+    slab->buffers = aligned_alloc(64, count * sizeof(struct packet_buffer));
+    slab->next = malloc(count * sizeof(uint32_t));
+    if (slab->buffers == NULL || slab->next == NULL) {
+        return -1;
     }
+    for (uint32_t i = 0; i < count; i++) {
+        slab->next[i] = i + 1 < count ? i + 1 : SLAB_NONE;
+    }
+    slab->count = count;
+    atomic_init(&slab->depot, 0);
+    return 0;
 }
 
-// Libera las IPs cuyos arrendamientos han expirado
-void release_expired_ips() {
-    pthread_mutex_lock(&pool_mutex);  // Bloquear el acceso al pool
-    time_t current_time = time(NULL);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ip_pool[i].ip != 0 && ip_pool[i].lease_start != 0) {
-            if (difftime(current_time, ip_pool[i].lease_start) > ip_pool[i].lease_duration) {
-                printf("IP Lease duration: %.f seconds\n", difftime(current_time, ip_pool[i].lease_start));
-                printf("IP %s liberada (lease expirado).\n", inet_ntoa(*(struct in_addr *)&ip_pool[i].ip));
-                fflush(stdout);  // Forzar el vaciamiento del buffer
-                // Liberar la IP
-                ip_pool[i].ip = 0;
-                memset(ip_pool[i].mac, 0, 6);
-                ip_pool[i].lease_start = 0;
-                ip_pool[i].xid = 0;
-            }
+// Toma un buffer libre de la lista del hilo, rellenándola con todo el
+// depósito si está vacía. Devuelve SLAB_NONE si no queda ninguno.
+uint32_t slab_get(struct packet_slab *slab) {
+    if (slab_free.head == SLAB_NONE) {
+        slab_free.head = atomic_exchange_explicit(&slab->depot, SLAB_NONE, memory_order_acquire);
+        if (slab_free.head == SLAB_NONE) {
+            return SLAB_NONE;
         }
     }
-    pthread_mutex_unlock(&pool_mutex);  // Desbloquear el acceso al pool
+    uint32_t buffer = slab_free.head;
+    slab_free.head = slab->next[buffer];
+    return buffer;
 }
 
-// Función para verificar si un `xid` ya fue procesado recientemente
-int is_duplicate_xid(uint32_t xid, uint8_t *mac) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (memcmp(ip_pool[i].mac, mac, 6) == 0) {
-            if (ip_pool[i].xid == xid) {
-                return 1;  // Solicitud duplicada
-            }
-        }
+// Devuelve un buffer a la lista del hilo; al juntar SLAB_BATCH, la lista
+// entera pasa al depósito
+void slab_put(struct packet_slab *slab, uint32_t buffer) {
+    slab->next[buffer] = slab_free.head;
+    if (slab_free.head == SLAB_NONE) {
+        slab_free.tail = buffer;
     }
-    return 0;  // No es un duplicado
+    slab_free.head = buffer;
+    if (++slab_free.count < SLAB_BATCH) {
+        return;
+    }
+    uint32_t head = atomic_load_explicit(&slab->depot, memory_order_relaxed);
+    do {
+        slab->next[slab_free.tail] = head;
+    } while (!atomic_compare_exchange_weak_explicit(&slab->depot, &head, slab_free.head, memory_order_release,
+                                                    memory_order_relaxed));
+    slab_free = (struct slab_list){ SLAB_NONE, SLAB_NONE, 0 };
 }
 
-// Construye un DHCP Offer
-void construct_dhcp_offer(struct dhcp_packet *packet, uint32_t offered_ip, uint8_t *mac, uint32_t xid) {
-    memset(packet, 0, sizeof(struct dhcp_packet));
+// Índice del bucket log-lineal para una latencia en ns
+int latency_bucket(uint64_t ns) {
+    if (ns < (1u << LAT_SUB_BITS)) {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (msb - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1));
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + sub;
+}
 
-    packet->op = 2;  // Servidor -> Cliente
-    packet->htype = 1;  // Ethernet
-    packet->hlen = 6;   // Tamaño de la dirección HW
-    packet->hops = 0;
-    packet->xid = htonl(xid);
-    packet->secs = 0;
-    packet->flags = htons(0x8000);  // Broadcast flag
-    packet->ciaddr = 0;
-    packet->yiaddr = htonl(offered_ip);  // IP ofrecida
-    packet->siaddr = inet_addr("192.168.0.1");
-    packet->giaddr = 0;
-    memcpy(packet->chaddr, mac, 6);
+// Límite superior (ns) del bucket dado
+uint64_t latency_bucket_value(int bucket) {
+    if (bucket < (1 << LAT_SUB_BITS)) {
+        return bucket;
+    }
+    int msb = (bucket >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << LAT_SUB_BITS) - 1);
+    return ((1ull << LAT_SUB_BITS) + sub + 1) << (msb - LAT_SUB_BITS);
+}
 
-    packet->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+uint64_t elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ull + (now.tv_nsec - start->tv_nsec);
+}
 
-    // Opciones DHCP
-    packet->options[0] = 53;
-    packet->options[1] = 1;
-    packet->options[2] = DHCP_OFFER;
+// Cuenta un evento en las métricas del hilo actual
+static inline void count_event(enum server_counter counter) {
+    if (thread_stats != NULL) {
+        metrics_add(&thread_stats->counters[counter], 1);
+    }
+}
 
-    // Máscara de red (opción 1)
-    packet->options[3] = 1;
-    packet->options[4] = 4;
-    uint32_t subnet_mask = inet_addr("255.255.255.0");
-    memcpy(&packet->options[5], &subnet_mask, 4);
+// Toma el mutex de un pool. Solo si está ocupado se mide la espera, así que
+// el caso sin contención no paga ninguna lectura de reloj.
+static void pool_lock(struct lease_pool *pool) {
+    if (pthread_mutex_trylock(&pool->mutex) == 0) {
+        count_event(CNT_LOCKS);
+        return;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&pool->mutex);
+    if (thread_stats != NULL) {
+        metrics_add(&thread_stats->counters[CNT_LOCKS], 1);
+        metrics_add(&thread_stats->counters[CNT_LOCKS_CONTENDED], 1);
+        metrics_observe(&thread_stats->lock_wait, elapsed_ns(&start));
+    }
+}
 
-    // Puerta de enlace (opción 3)
-    packet->options[9] = 3;
-    packet->options[10] = 4;
-    uint32_t gateway = inet_addr("192.168.0.1");
-    memcpy(&packet->options[11], &gateway, 4);
+// Recuperación por épocas para lo que se lee sin el mutex de un pool: los
+// buckets del índice MAC, que se sustituyen al reconstruirlo. Cada lector
+// anuncia la época global al entrar en su sección y la borra al salir. Lo que
+// se retira en una época se libera cuando ningún lector sigue en ella o en una
+// anterior. Quien retira nunca espera a los lectores.
+struct rcu_reader {
+    _Atomic uint64_t epoch;  // Época al entrar en la sección de lectura; 0 = fuera
+    _Atomic int taken;       // Ranura asignada a un hilo
+} __attribute__((aligned(64)));
 
-    // DNS (opción 6)
-    packet->options[15] = 6;
-    packet->options[16] = 4;
-    uint32_t dns_server = inet_addr("8.8.8.8");
-    memcpy(&packet->options[17], &dns_server, 4);
+struct rcu_retired {
+    void *ptr;
+    uint64_t epoch;  // Época en que dejó de estar publicado
+};
 
-    packet->options[21] = 255;  // Fin de opciones
-}
+struct rcu_state {
+    _Atomic uint64_t epoch;
+    struct rcu_reader readers[RCU_MAX_READERS];
+    pthread_mutex_t lock;                        // Protege la lista de retirados
+    struct rcu_retired *retired;
+    size_t retired_count;
+    size_t retired_capacity;
+};
 
-// Construye un DHCP ACK
-void construct_dhcp_ack(struct dhcp_packet *packet, uint32_t assigned_ip, uint8_t *mac, uint32_t xid) {
-    memset(packet, 0, sizeof(struct dhcp_packet));
+struct rcu_state rcu = { .epoch = 1, .lock = PTHREAD_MUTEX_INITIALIZER };
+__thread int rcu_slot = -1;  // Ranura del hilo en 'rcu.readers'; RCU_MAX_READERS si no quedaban
+int renew_without_lock = 1;  // 0: las renovaciones toman el mutex del pool (para el banco de contención)
 
-    packet->op = 2;
-    packet->htype = 1;
-    packet->hlen = 6;
-    packet->hops = 0;
-    packet->xid = htonl(xid);
-    packet->secs = 0;
-    packet->flags = htons(0x8000);  // Broadcast flag
-    packet->ciaddr = 0;
-    packet->yiaddr = htonl(assigned_ip);  // IP asignada
-    packet->siaddr = inet_addr("192.168.0.1");
-    packet->giaddr = 0;
-    memcpy(packet->chaddr, mac, 6);
+// Entra en una sección de lectura. Devuelve 0 si el hilo no tiene ranura; el
+// llamante debe usar entonces el camino con mutex.
+static inline int rcu_read_lock(void) {
+    if (rcu_slot < 0) {
+        // Primera lectura del hilo: buscar una ranura libre
+        for (rcu_slot = 0; rcu_slot < RCU_MAX_READERS; rcu_slot++) {
+            int free_slot = 0;
+            if (atomic_compare_exchange_strong(&rcu.readers[rcu_slot].taken, &free_slot, 1)) {
+                break;
+            }
+        }
+    }
+    if (rcu_slot == RCU_MAX_READERS) {
+        return 0;
+    }
+    atomic_store_explicit(&rcu.readers[rcu_slot].epoch, atomic_load_explicit(&rcu.epoch, memory_order_acquire),
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);  // El anuncio se ve antes que cualquier lectura de la sección
+    return 1;
+}
 
-    packet->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+static inline void rcu_read_unlock(void) {
+    atomic_store_explicit(&rcu.readers[rcu_slot].epoch, 0, memory_order_release);
+}
 
-    // Opciones DHCP
-    packet->options[0] = 53;
-    packet->options[1] = 1;
-    packet->options[2] = DHCP_ACK;
-    packet->options[3] = 255;
-
-    // Actualizar el lease
-    pthread_mutex_lock(&pool_mutex);  // Bloquear el acceso al pool
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (memcmp(ip_pool[i].mac, mac, 6) == 0 && ip_pool[i].ip == assigned_ip) {
-            ip_pool[i].lease_start = time(NULL);  // Iniciar el lease en el momento de ACK
-            ip_pool[i].lease_duration = LEASE_TIME;
-            break;
+// Devuelve la ranura del hilo; para hilos que terminan (los del banco de contención)
+void rcu_unregister(void) {
+    if (rcu_slot >= 0 && rcu_slot < RCU_MAX_READERS) {
+        atomic_store(&rcu.readers[rcu_slot].taken, 0);
+    }
+    rcu_slot = -1;
+}
+
+// Libera lo retirado que ya no puede ver ningún lector
+void rcu_reclaim(void) {
+    pthread_mutex_lock(&rcu.lock);
+    if (rcu.retired_count == 0) {
+        pthread_mutex_unlock(&rcu.lock);
+        return;
+    }
+    uint64_t oldest = UINT64_MAX;
+    for (int r = 0; r < RCU_MAX_READERS; r++) {
+        uint64_t epoch = atomic_load(&rcu.readers[r].epoch);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
         }
     }
-    pthread_mutex_unlock(&pool_mutex);  // Desbloquear el acceso al pool
+    size_t kept = 0;
+    for (size_t k = 0; k < rcu.retired_count; k++) {
+        if (rcu.retired[k].epoch < oldest) {
+            free(rcu.retired[k].ptr);
+        } else {
+            rcu.retired[kept++] = rcu.retired[k];
+        }
+    }
+    rcu.retired_count = kept;
+    pthread_mutex_unlock(&rcu.lock);
 }
 
-// Construye un DHCP NAK
-void construct_dhcp_nak(struct dhcp_packet *packet, uint8_t *mac, uint32_t xid) {
-    memset(packet, 0, sizeof(struct dhcp_packet));
+// Cierra la época actual y la devuelve: lo que deja de estar publicado ahora
+// solo lo pueden ver lectores de esa época o de una anterior
+static inline uint64_t rcu_advance(void) {
+    return atomic_fetch_add(&rcu.epoch, 1);
+}
 
-    packet->op = 2;
-    packet->htype = 1;
-    packet->hlen = 6;
-    packet->hops = 0;
-    packet->xid = htonl(xid);
-    packet->secs = 0;
-    packet->flags = htons(0x8000);  // Broadcast flag
-    packet->ciaddr = 0;
-    packet->yiaddr = 0;
-    packet->siaddr = inet_addr("192.168.0.1");
-    packet->giaddr = 0;
-    memcpy(packet->chaddr, mac, 6);
+// 1 si ya no queda ningún lector en la época 'epoch' o en una anterior
+static int rcu_quiescent(uint64_t epoch) {
+    for (int r = 0; r < RCU_MAX_READERS; r++) {
+        uint64_t reader = atomic_load(&rcu.readers[r].epoch);
+        if (reader != 0 && reader <= epoch) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-    packet->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+// Retira 'ptr', ya sustituido por otra versión publicada; se libera con free()
+// cuando termine la última sección de lectura que pudo verlo
+void rcu_retire(void *ptr) {
+    pthread_mutex_lock(&rcu.lock);
+    if (rcu.retired_count == rcu.retired_capacity) {
+        size_t capacity = rcu.retired_capacity ? rcu.retired_capacity * 2 : 16;
+        struct rcu_retired *retired = realloc(rcu.retired, capacity * sizeof(struct rcu_retired));
+        if (retired == NULL) {
+            pthread_mutex_unlock(&rcu.lock);
+            perror("Error al retirar memoria del índice");
+            return;  // Se pierde 'ptr' antes que liberarlo con lectores dentro
+        }
+        rcu.retired = retired;
+        rcu.retired_capacity = capacity;
+    }
+    rcu.retired[rcu.retired_count].ptr = ptr;
+    rcu.retired[rcu.retired_count].epoch = rcu_advance();
+    rcu.retired_count++;
+    pthread_mutex_unlock(&rcu.lock);
+    rcu_reclaim();
+}
 
-    // Opciones DHCP
-    packet->options[0] = 53;
-    packet->options[1] = 1;
-    packet->options[2] = DHCP_NAK;
-    packet->options[3] = 255;
-}
-
-// Función que maneja cada solicitud del cliente
-void *handle_client_request(void *arg) {
-    pthread_t my_id = pthread_self();
-    printf("-------------------- \n");
-    printf("Hilo creado con ID: %lu\n", (unsigned long)my_id);
-    printf("-------------------- \n");
-    struct client_request *request = (struct client_request *)arg;
-    struct dhcp_packet *dhcp_request = &request->dhcp_request;
-    uint8_t client_mac[6];
-    memcpy(client_mac, dhcp_request->chaddr, 6);
-    uint32_t xid = ntohl(dhcp_request->xid);
-    uint32_t offered_ip = 0;
+// Empaqueta los 6 bytes de la MAC en una clave de 64 bits
+static inline uint64_t mac_key(const uint8_t *mac) {
+    uint64_t key = 0;
+    memcpy(&key, mac, 6);
+    return key | MAC_KEY_USED;
+}
 
-    // Manejo de DHCP Discover
-    if (dhcp_request->options[0] == 53 && dhcp_request->options[1] == 1 && dhcp_request->options[2] == DHCP_DISCOVER) {
-        printf("DHCP Discover recibido del cliente.\n");
+static inline size_t mac_hash(uint64_t key) {
+    key *= 0x9E3779B97F4A7C15ull;
+    return (size_t)(key ^ (key >> 29));
+}
 
-        pthread_mutex_lock(&pool_mutex);  // Bloquear el acceso al pool
+// Entradas que caben en el índice sin pasar de INDEX_MAX_LOAD_PCT de ocupación
+static inline size_t mac_index_capacity(const struct mac_index *index) {
+    return (index->mask + 1) * INDEX_BUCKET_SLOTS * INDEX_MAX_LOAD_PCT / 100;
+}
 
-        offered_ip = find_ip_by_mac(client_mac); // Verificar si ya tiene IP
+// Reserva el índice para al menos 'capacity' entradas. Con buckets de 5
+// entradas la sonda sigue siendo corta al 80% de ocupación. Los buckets de
+// reserva se tocan por primera vez en la primera limpieza de borradas.
+int mac_index_init(struct mac_index *index, size_t capacity) {
+    size_t nbuckets = 1;
+    while (nbuckets * INDEX_BUCKET_SLOTS * INDEX_MAX_LOAD_PCT / 100 < capacity) {
+        nbuckets <<= 1;
+    }
+    index->buckets = aligned_alloc(64, nbuckets * sizeof(struct mac_bucket));
+    index->spare = aligned_alloc(64, nbuckets * sizeof(struct mac_bucket));
+    if (index->buckets == NULL || index->spare == NULL) {
+        free(index->buckets);
+        free(index->spare);
+        return -1;
+    }
+    memset(index->buckets, 0, nbuckets * sizeof(struct mac_bucket));
+    index->mask = nbuckets - 1;
+    index->used = 0;
+    index->tombstones = 0;
+    index->spare_epoch = 0;
+    return 0;
+}
 
-        if (offered_ip != 0) {
-            char mac_address[18];
-            sprintf(mac_address, "%02X:%02X:%02X:%02X:%02X:%02X",
-                    client_mac[0], client_mac[1], client_mac[2], 
-                    client_mac[3], client_mac[4], client_mac[5]);
-            printf("Cliente con MAC %s ya tiene una IP asignada.\n", mac_address);
-            // No necesitamos asignar una nueva IP, usamos la existente
-        } else {
-            offered_ip = find_free_ip();
-            if (offered_ip == 0) {
-                printf("No hay más direcciones IP disponibles.\n");
-                // Enviar DHCP NAK al cliente
-                struct dhcp_packet dhcp_nak;
-                construct_dhcp_nak(&dhcp_nak, client_mac, xid);
-                sendto(request->sock, &dhcp_nak, sizeof(dhcp_nak), 0, (struct sockaddr *)&request->client_addr, request->client_addr_len);
-                pthread_mutex_unlock(&pool_mutex);
-                free(request);
-                pthread_exit(NULL);
+// Busca la MAC. Devuelve la posición en la tabla de leases o -1 si no está.
+// Sin el mutex del pool debe llamarse dentro de una sección RCU; entonces puede
+// fallar mientras un escritor mueve la MAC, así que el resultado se valida
+// contra la propia entrada. La máscara se lee antes que los buckets (al revés
+// de como se publican), para no combinar buckets viejos con una máscara mayor.
+long mac_index_lookup(const struct mac_index *index, const uint8_t *mac) {
+    uint64_t key = mac_key(mac);
+    size_t mask = __atomic_load_n(&index->mask, __ATOMIC_ACQUIRE);
+    const struct mac_bucket *buckets = __atomic_load_n(&index->buckets, __ATOMIC_ACQUIRE);
+    size_t b = mac_hash(key) & mask;
+    for (size_t probes = 0; probes <= mask; probes++) {
+        const struct mac_bucket *bucket = &buckets[b];
+        for (int i = 0; i < INDEX_BUCKET_SLOTS; i++) {
+            uint64_t slot_key = __atomic_load_n(&bucket->key[i], __ATOMIC_ACQUIRE);
+            if (slot_key == key) {
+                return __atomic_load_n(&bucket->lease[i], __ATOMIC_RELAXED);
+            }
+            if (slot_key == 0) {
+                return -1;  // Una entrada vacía corta la sonda
             }
-            assign_ip_to_client(offered_ip, client_mac, xid);
         }
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
 
-        pthread_mutex_unlock(&pool_mutex);  // Desbloquear el acceso al pool
+void mac_index_rehash(struct mac_index *index);
 
-        // Construir y enviar el DHCPOFFER con la IP asignada o existente
-        struct dhcp_packet dhcp_offer;
-        construct_dhcp_offer(&dhcp_offer, offered_ip, client_mac, xid);
-        if (sendto(request->sock, &dhcp_offer, sizeof(dhcp_offer), 0, (struct sockaddr *)&request->client_addr, request->client_addr_len) < 0) {
-            perror("Error al enviar DHCP OFFER");
-        } else {
-            printf("DHCP Offer enviado a cliente. \n");
+// Publica 'fresh' en lugar de los buckets actuales del índice: primero los
+// buckets y después la máscara. Los viejos, y su reserva, se liberan cuando ya
+// no queda ningún lector que pueda estar recorriéndolos.
+static void mac_index_publish(struct mac_index *index, const struct mac_index *fresh) {
+    struct mac_bucket *old = index->buckets, *old_spare = index->spare;
+    __atomic_store_n(&index->buckets, fresh->buckets, __ATOMIC_RELEASE);
+    __atomic_store_n(&index->mask, fresh->mask, __ATOMIC_RELEASE);
+    index->used = fresh->used;
+    index->tombstones = fresh->tombstones;
+    index->spare = fresh->spare;
+    index->spare_epoch = fresh->spare_epoch;
+    if (old != NULL) {
+        rcu_retire(old);
+        rcu_retire(old_spare);
+    }
+}
+
+// Inserta o actualiza la MAC con la posición dada. La posición se escribe
+// antes que la clave, así un lector sin mutex nunca ve la clave con la
+// posición de la entrada borrada que ocupaba la ranura.
+void mac_index_insert(struct mac_index *index, const uint8_t *mac, uint32_t lease) {
+    uint64_t key = mac_key(mac);
+    size_t b = mac_hash(key) & index->mask;
+    uint64_t *free_key = NULL;
+    uint32_t *free_lease = NULL;
+    for (size_t probes = 0; probes <= index->mask; probes++) {
+        struct mac_bucket *bucket = &index->buckets[b];
+        for (int i = 0; i < INDEX_BUCKET_SLOTS; i++) {
+            if (bucket->key[i] == key) {
+                __atomic_store_n(&bucket->lease[i], lease, __ATOMIC_RELAXED);
+                return;
+            }
+            if (bucket->key[i] == MAC_KEY_TOMBSTONE && free_key == NULL) {
+                free_key = &bucket->key[i];
+                free_lease = &bucket->lease[i];
+            } else if (bucket->key[i] == 0) {
+                if (free_key == NULL) {
+                    free_key = &bucket->key[i];
+                    free_lease = &bucket->lease[i];
+                } else {
+                    index->tombstones--;  // Se reutiliza una entrada borrada
+                }
+                __atomic_store_n(free_lease, lease, __ATOMIC_RELAXED);
+                __atomic_store_n(free_key, key, __ATOMIC_RELEASE);
+                index->used++;
+                return;
+            }
+        }
+        b = (b + 1) & index->mask;
+    }
+    if (free_key != NULL) {
+        // Sin entradas vacías en todo el recorrido: reutilizar una borrada
+        __atomic_store_n(free_lease, lease, __ATOMIC_RELAXED);
+        __atomic_store_n(free_key, key, __ATOMIC_RELEASE);
+        index->used++;
+        index->tombstones--;
+    }
+}
+
+// Elimina la MAC del índice si está presente
+void mac_index_remove(struct mac_index *index, const uint8_t *mac) {
+    uint64_t key = mac_key(mac);
+    size_t b = mac_hash(key) & index->mask;
+    for (size_t probes = 0; probes <= index->mask; probes++) {
+        struct mac_bucket *bucket = &index->buckets[b];
+        for (int i = 0; i < INDEX_BUCKET_SLOTS; i++) {
+            if (bucket->key[i] == key) {
+                __atomic_store_n(&bucket->key[i], MAC_KEY_TOMBSTONE, __ATOMIC_RELAXED);
+                index->used--;
+                index->tombstones++;
+                // Demasiadas entradas borradas alargan las sondas: reconstruir
+                if (index->tombstones > (index->mask + 1) * INDEX_BUCKET_SLOTS / 8) {
+                    mac_index_rehash(index);
+                }
+                return;
+            }
+            if (bucket->key[i] == 0) {
+                return;
+            }
         }
+        b = (b + 1) & index->mask;
     }
+}
 
-    // Manejo de DHCP Request
-    else if (dhcp_request->options[0] == 53 && dhcp_request->options[1] == 1 && dhcp_request->options[2] == DHCP_REQUEST) {
-        printf("DHCP Request recibido del cliente.\n");
+// Reconstruye el índice, del mismo tamaño, sin las entradas borradas. Se
+// escribe en los buckets de reserva y los actuales pasan a ser la reserva, así
+// que expirar y liberar leases nunca reserva memoria. Si algún lector puede
+// seguir dentro de la reserva (la retirada en la limpieza anterior), se espera
+// a la siguiente eliminación.
+void mac_index_rehash(struct mac_index *index) {
+    if (index->spare_epoch != 0 && !rcu_quiescent(index->spare_epoch)) {
+        return;
+    }
+    size_t nbuckets = index->mask + 1;
+    struct mac_bucket *old = index->buckets;
+    struct mac_index fresh = { index->spare, index->mask, 0, 0, NULL, 0 };
+    memset(fresh.buckets, 0, nbuckets * sizeof(struct mac_bucket));
+    for (size_t b = 0; b < nbuckets; b++) {
+        for (int i = 0; i < INDEX_BUCKET_SLOTS; i++) {
+            uint64_t key = old[b].key[i];
+            if (key != 0 && key != MAC_KEY_TOMBSTONE) {
+                mac_index_insert(&fresh, (const uint8_t *)&key, old[b].lease[i]);
+            }
+        }
+    }
+    __atomic_store_n(&index->buckets, fresh.buckets, __ATOMIC_RELEASE);
+    index->used = fresh.used;
+    index->tombstones = 0;
+    index->spare = old;
+    index->spare_epoch = rcu_advance();
+}
 
-        pthread_mutex_lock(&pool_mutex);  // Bloquear el acceso al pool
+// Crea el mapa de bits con todo el rango [start, end] libre
+int ip_bitmap_init(struct ip_bitmap *bm, uint32_t start, uint32_t end) {
+    bm->base = start;
+    bm->size = end - start + 1;
+    bm->nwords = (bm->size + 63) / 64;
+    bm->words = aligned_alloc(64, ((bm->nwords * sizeof(uint64_t) + 63) / 64) * 64);
+    if (bm->words == NULL) {
+        return -1;
+    }
+    memset(bm->words, 0xff, bm->nwords * sizeof(uint64_t));
+    if (bm->size % 64 != 0) {
+        bm->words[bm->nwords - 1] = (1ull << (bm->size % 64)) - 1;  // Bits fuera del rango
+    }
+    bm->hint = 0;
+    bm->free_count = bm->size;
+    return 0;
+}
 
-        // Verificar si el cliente tiene una IP asignada
-        uint32_t assigned_ip = find_ip_by_mac(client_mac);
-        if (assigned_ip == 0) {
-            printf("El cliente no tiene una IP asignada previamente.\n");
-            pthread_mutex_unlock(&pool_mutex);  // Desbloquear el acceso al pool
-            free(request);
-            pthread_exit(NULL);
+// Primera palabra con algún bit libre en [from, to), o 'to' si no hay
+static size_t ip_bitmap_scan(const struct ip_bitmap *bm, size_t from, size_t to) {
+    size_t w = from;
+#ifdef __SSE2__
+    // Avanzar de dos en dos palabras mientras ambas estén llenas (a cero)
+    const __m128i zero = _mm_setzero_si128();
+    for (; w + 2 <= to; w += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&bm->words[w]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            break;
+        }
+    }
+#endif
+    for (; w < to; w++) {
+        if (bm->words[w] != 0) {
+            return w;
         }
+    }
+    return to;
+}
 
-        pthread_mutex_unlock(&pool_mutex);  // Desbloquear el acceso al pool
+// Busca una dirección libre a partir del cursor. Devuelve 0 si el rango está lleno.
+uint32_t ip_bitmap_find(const struct ip_bitmap *bm) {
+    if (bm->free_count == 0) {
+        return 0;
+    }
+    size_t w = bm->hint / 64;
+    // Primera palabra: ignorar los bits anteriores al cursor
+    uint64_t first = bm->words[w] & (~0ull << (bm->hint % 64));
+    if (first == 0) {
+        w = ip_bitmap_scan(bm, w + 1, bm->nwords);
+        if (w == bm->nwords) {
+            w = ip_bitmap_scan(bm, 0, bm->hint / 64 + 1);  // Dar la vuelta al rango
+        }
+        first = bm->words[w];
+    }
+    return bm->base + (uint32_t)(w * 64 + __builtin_ctzll(first));
+}
 
-        // Enviar el DHCPACK al cliente
-        struct dhcp_packet dhcp_ack;
-        construct_dhcp_ack(&dhcp_ack, assigned_ip, client_mac, xid);
-        if (sendto(request->sock, &dhcp_ack, sizeof(dhcp_ack), 0, (struct sockaddr *)&request->client_addr, request->client_addr_len) < 0) {
-            perror("Error al enviar DHCP ACK");
-        } else {
-            printf("DHCP ACK enviado: IP asignada = %s\n", inet_ntoa(*(struct in_addr *)&dhcp_ack.yiaddr));
+// Busca una dirección libre empezando por el desplazamiento 'off': primero en
+// su palabra (la libre más cercana a partir de él) y luego en las siguientes,
+// dando la vuelta al rango, hasta HASH_MAX_PROBES palabras. Si no hay ninguna,
+// recorre el rango desde el cursor. Deja en 'probes' las palabras miradas, o
+// HASH_MAX_PROBES + 1 si hubo que recorrer el rango. Devuelve 0 si está lleno.
+uint32_t ip_bitmap_find_near(const struct ip_bitmap *bm, uint32_t off, int *probes) {
+    *probes = HASH_MAX_PROBES + 1;
+    if (bm->free_count == 0) {
+        return 0;
+    }
+    size_t w = off / 64;
+    uint64_t word = bm->words[w] & (~0ull << (off % 64));
+    for (int p = 1; p <= HASH_MAX_PROBES; p++) {
+        if (word != 0) {
+            *probes = p;
+            return bm->base + (uint32_t)(w * 64 + __builtin_ctzll(word));
         }
+        w = w + 1 == bm->nwords ? 0 : w + 1;
+        word = bm->words[w];
     }
+    return ip_bitmap_find(bm);
+}
 
-    // Liberar la memoria asignada y terminar el hilo
-    free(request);
-    pthread_exit(NULL);
+// Marca la dirección como asignada y adelanta el cursor tras ella
+void ip_bitmap_take(struct ip_bitmap *bm, uint32_t ip) {
+    uint32_t off = ip - bm->base;
+    if (off >= bm->size || !(bm->words[off / 64] & (1ull << (off % 64)))) {
+        return;
+    }
+    bm->words[off / 64] &= ~(1ull << (off % 64));
+    bm->free_count--;
+    bm->hint = (off + 1) % bm->size;
 }
 
-int main() {
-    // Desactivar el buffering de stdout
-    setbuf(stdout, NULL);
+// Indica si la dirección pertenece al rango y está libre
+int ip_bitmap_is_free(const struct ip_bitmap *bm, uint32_t ip) {
+    uint32_t off = ip - bm->base;
+    return off < bm->size && (bm->words[off / 64] & (1ull << (off % 64))) != 0;
+}
 
-    int sock;
-    struct sockaddr_in server_addr;
-    struct dhcp_packet dhcp_request;
-    socklen_t client_addr_len = sizeof(struct sockaddr_in);
+// Devuelve la dirección al conjunto libre
+void ip_bitmap_put(struct ip_bitmap *bm, uint32_t ip) {
+    uint32_t off = ip - bm->base;
+    if (off >= bm->size || (bm->words[off / 64] & (1ull << (off % 64)))) {
+        return;
+    }
+    bm->words[off / 64] |= 1ull << (off % 64);
+    bm->free_count++;
+}
 
-    // Inicializar el mutex
-    pthread_mutex_init(&pool_mutex, NULL);
+// Añade un nodo vacío al trie. Devuelve su posición o -1 sin memoria.
+static int32_t lpm_node_new(struct lpm_table *table) {
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : LPM_INITIAL_NODES;
+        struct lpm_node *nodes = realloc(table->nodes, capacity * sizeof(struct lpm_node));
+        if (nodes == NULL) {
+            return -1;
+        }
+        table->nodes = nodes;
+        table->capacity = capacity;
+    }
+    memset(&table->nodes[table->count], 0xff, sizeof(struct lpm_node));  // Todo a -1
+    return (int32_t)table->count++;
+}
 
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(67);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+// Inserta el prefijo network/len (orden de host) con el valor dado. Los
+// prefijos se insertan de más corto a más largo, así los más largos
+// sobrescriben a los que contienen.
+int lpm_insert(struct lpm_table *table, uint32_t network, int len, int32_t value) {
+    if (table->count == 0 && lpm_node_new(table) < 0) {
+        return -1;
+    }
+    int32_t node = 0;
+    int level = 0;
+    while (len > 8 * (level + 1)) {
+        uint8_t byte = network >> (24 - 8 * level);
+        if (table->nodes[node].child[byte] < 0) {
+            int32_t child = lpm_node_new(table);
+            if (child < 0) {
+                return -1;
+            }
+            table->nodes[node].child[byte] = child;
+        }
+        node = table->nodes[node].child[byte];
+        level++;
+    }
+    int span = 8 * (level + 1) - len;  // Bits del byte de este nivel que quedan libres
+    uint32_t first = (network >> (24 - 8 * level)) & 0xff & ~((1u << span) - 1);
+    for (uint32_t byte = first; byte < first + (1u << span); byte++) {
+        table->nodes[node].match[byte] = value;
+    }
+    return 0;
+}
 
-    bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    init_ip_pool();
+// Valor del prefijo más largo que contiene 'addr' (orden de host), o -1
+int32_t lpm_lookup(const struct lpm_table *table, uint32_t addr) {
+    int32_t best = -1;
+    int32_t node = table->count > 0 ? 0 : -1;
+    for (int level = 0; level < 4 && node >= 0; level++) {
+        uint8_t byte = addr >> (24 - 8 * level);
+        if (table->nodes[node].match[byte] >= 0) {
+            best = table->nodes[node].match[byte];
+        }
+        node = table->nodes[node].child[byte];
+    }
+    return best;
+}
 
-    while (1) {
-        release_expired_ips();
+static inline uint32_t prefix_mask(int len) {
+    return len == 0 ? 0 : ~0u << (32 - len);
+}
 
-        fd_set read_fds;
-        struct timeval timeout;
-        timeout.tv_sec = 1;  // 1 second timeout
-        timeout.tv_usec = 0;
+// Subred que contiene la dirección (orden de host), o -1
+static inline int subnet_for_address(uint32_t addr) {
+    return lpm_lookup(&subnet_table, addr);
+}
 
-        FD_ZERO(&read_fds);
-        FD_SET(sock, &read_fds);
+// Añade una subred a la configuración. Devuelve -1 si el rango no es válido.
+int add_subnet(uint32_t network, int prefix_len, uint32_t start, uint32_t end, uint32_t router, uint32_t dns,
+               uint32_t lease_time) {
+    uint32_t mask = prefix_mask(prefix_len);
+    if (start > end || (start & mask) != (network & mask) || (end & mask) != (network & mask)) {
+        return -1;
+    }
+    struct subnet *grown = realloc(subnets, (subnet_count + 1) * sizeof(struct subnet));
+    if (grown == NULL) {
+        perror("Error al asignar las subredes");
+        exit(1);
+    }
+    subnets = grown;
+    struct subnet *subnet = &subnets[subnet_count++];
+    subnet->network = network & mask;
+    subnet->prefix_len = prefix_len;
+    subnet->range_start = start;
+    subnet->range_end = end;
+    subnet->router = router;
+    subnet->dns = dns;
+    subnet->lease_time = lease_time;
+    subnet->max_leases = end - start + 1;
+    struct in_addr addr = { htonl(subnet->network) };
+    char text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, text, sizeof(text));
+    snprintf(subnet->name, sizeof(subnet->name), "%s/%d", text, prefix_len);
+    return 0;
+}
 
-        int activity = select(sock + 1, &read_fds, NULL, NULL, &timeout);
+// Lee una dirección IPv4 en orden de host. Devuelve 0 si no es válida.
+static int parse_ipv4(const char *text, uint32_t *addr) {
+    struct in_addr parsed;
+    if (text == NULL || inet_pton(AF_INET, text, &parsed) != 1) {
+        return 0;
+    }
+    *addr = ntohl(parsed.s_addr);
+    return 1;
+}
 
-        if (activity < 0) {
-            perror("select error");
+// Lee el fichero de subredes. Cada línea es un comentario (#), "server-id IP"
+// o una subred:
+//   subnet RED/PREFIJO range INICIO FIN [router IP] [dns IP] [lease SEGUNDOS] [leases N]
+// Sin router se usa la primera dirección de la red; sin dns, 8.8.8.8. 'leases'
+// limita la tabla de leases, que por defecto admite una por dirección del rango.
+int load_subnets(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Error al abrir el fichero de subredes");
+        return -1;
+    }
+    char line[512];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *save;
+        char *word = strtok_r(line, " \t\r\n", &save);
+        if (word == NULL) {
             continue;
         }
-
-        if (activity == 0) {
-            // Timeout occurred, check for expired leases again
-            continue;  // No data received, loop again to check leases
+        if (strcmp(word, "server-id") == 0) {
+            uint32_t id;
+            if (!parse_ipv4(strtok_r(NULL, " \t\r\n", &save), &id)) {
+                fprintf(stderr, "%s:%d: server-id inválido\n", path, line_number);
+                fclose(file);
+                return -1;
+            }
+            server_id = id;
+            continue;
+        }
+        if (strcmp(word, "subnet") != 0) {
+            fprintf(stderr, "%s:%d: se esperaba 'subnet' o 'server-id'\n", path, line_number);
+            fclose(file);
+            return -1;
         }
 
-        if (FD_ISSET(sock, &read_fds)) {
-            struct client_request *request = malloc(sizeof(struct client_request));
-            if (request == NULL) {
-                perror("Error al asignar memoria para request");
-                continue;
+        uint32_t network = 0, start = 0, end = 0, router = 0, dns = 0x08080808, lease_time = LEASE_TIME, max_leases = 0;
+        int prefix_len = -1, have_range = 0, valid = 1;
+        char *prefix = strtok_r(NULL, " \t\r\n", &save);
+        char *slash = prefix != NULL ? strchr(prefix, '/') : NULL;
+        if (slash != NULL) {
+            *slash = '\0';
+            prefix_len = atoi(slash + 1);
+        }
+        if (!parse_ipv4(prefix, &network) || prefix_len < 0 || prefix_len > 32) {
+            valid = 0;
+        }
+        router = (network & prefix_mask(prefix_len < 0 ? 0 : prefix_len)) + 1;
+        while (valid && (word = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if (strcmp(word, "range") == 0) {
+                valid = parse_ipv4(strtok_r(NULL, " \t\r\n", &save), &start) &&
+                        parse_ipv4(strtok_r(NULL, " \t\r\n", &save), &end);
+                have_range = 1;
+            } else if (strcmp(word, "router") == 0) {
+                valid = parse_ipv4(strtok_r(NULL, " \t\r\n", &save), &router);
+            } else if (strcmp(word, "dns") == 0) {
+                valid = parse_ipv4(strtok_r(NULL, " \t\r\n", &save), &dns);
+            } else if (strcmp(word, "lease") == 0) {
+                char *value = strtok_r(NULL, " \t\r\n", &save);
+                lease_time = value != NULL ? strtoul(value, NULL, 10) : 0;
+                valid = lease_time > 0;
+            } else if (strcmp(word, "leases") == 0) {
+                char *value = strtok_r(NULL, " \t\r\n", &save);
+                max_leases = value != NULL ? strtoul(value, NULL, 10) : 0;
+                valid = max_leases > 0;
+            } else {
+                valid = 0;
             }
+        }
+        if (!valid || !have_range || add_subnet(network, prefix_len, start, end, router, dns, lease_time) < 0) {
+            fprintf(stderr, "%s:%d: subred inválida\n", path, line_number);
+            fclose(file);
+            return -1;
+        }
+        if (max_leases != 0 && max_leases < subnets[subnet_count - 1].max_leases) {
+            subnets[subnet_count - 1].max_leases = max_leases;
+        }
+    }
+    fclose(file);
+    if (subnet_count == 0) {
+        fprintf(stderr, "%s: no define ninguna subred\n", path);
+        return -1;
+    }
+    return 0;
+}
 
-            request->sock = sock;
-            request->client_addr_len = sizeof(struct sockaddr_in);
-
-            if (recvfrom(sock, &request->dhcp_request, sizeof(request->dhcp_request), 0, (struct sockaddr *)&request->client_addr, &request->client_addr_len) < 0) {
-                perror("Error al recibir datos");
-                free(request);
-                continue;
+// Construye el trie de subredes y comprueba que ningún rango invade una
+// subred más específica, que se llevaría esas direcciones
+int build_subnet_table(void) {
+    for (int len = 0; len <= 32; len++) {
+        for (int s = 0; s < subnet_count; s++) {
+            if (subnets[s].prefix_len == len && lpm_insert(&subnet_table, subnets[s].network, len, s) < 0) {
+                perror("Error al asignar el trie de subredes");
+                return -1;
             }
-
-            // Crear un nuevo hilo para manejar la solicitud del cliente
-            pthread_t thread_id;
-            if (pthread_create(&thread_id, NULL, handle_client_request, (void *)request) != 0) {
-                perror("Error al crear el hilo");
-                free(request);
+        }
+    }
+    for (int a = 0; a < subnet_count; a++) {
+        for (int b = 0; b < subnet_count; b++) {
+            const struct subnet *outer = &subnets[a], *inner = &subnets[b];
+            if (a == b || inner->prefix_len < outer->prefix_len) {
                 continue;
             }
+            if (inner->prefix_len == outer->prefix_len && inner->network == outer->network) {
+                fprintf(stderr, "Subred %s repetida\n", inner->name);
+                return -1;
+            }
+            uint32_t first = inner->network, last = inner->network | ~prefix_mask(inner->prefix_len);
+            if (inner->prefix_len > outer->prefix_len && outer->range_start <= last && outer->range_end >= first) {
+                fprintf(stderr, "El rango de %s se solapa con la subred %s\n", outer->name, inner->name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
 
-            // Separar el hilo para que limpie sus recursos al terminar
-            pthread_detach(thread_id);
+void timer_wheel_init(struct timer_wheel *wheel, struct timer_node *nodes, size_t count) {
+    wheel->now = 0;
+    wheel->nodes = nodes;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+        wheel->head[i] = -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        nodes[i].slot = -1;
+    }
+}
+
+// Quita la entrada de la lista en la que esté
+void timer_cancel(struct timer_wheel *wheel, int32_t id) {
+    struct timer_node *node = &wheel->nodes[id];
+    if (node->slot < 0) {
+        return;
+    }
+    if (node->prev >= 0) {
+        wheel->nodes[node->prev].next = node->next;
+    } else {
+        wheel->head[node->slot] = node->next;
+    }
+    if (node->next >= 0) {
+        wheel->nodes[node->next].prev = node->prev;
+    }
+    node->slot = -1;
+}
+
+// Enlaza la entrada en la ranura que corresponde a su vencimiento
+static void timer_link(struct timer_wheel *wheel, int32_t id) {
+    struct timer_node *node = &wheel->nodes[id];
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && (node->expire - wheel->now) >= (1u << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if (level == WHEEL_LEVELS - 1 && (node->expire - wheel->now) >= (1u << (WHEEL_BITS * WHEEL_LEVELS))) {
+        node->expire = wheel->now + (1u << (WHEEL_BITS * WHEEL_LEVELS)) - 1;  // Limitar al horizonte
+    }
+    int slot = level * WHEEL_SLOTS + ((node->expire >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    node->slot = slot;
+    node->prev = -1;
+    node->next = wheel->head[slot];
+    if (node->next >= 0) {
+        wheel->nodes[node->next].prev = id;
+    }
+    wheel->head[slot] = id;
+}
+
+// Programa (o reprograma) la entrada para vencer en el tick 'expire'
+void timer_schedule(struct timer_wheel *wheel, int32_t id, uint32_t expire) {
+    timer_cancel(wheel, id);
+    if ((int32_t)(expire - wheel->now) <= 0) {
+        expire = wheel->now + 1;  // Ya vencido: se atiende en el próximo tick
+    }
+    wheel->nodes[id].expire = expire;
+    timer_link(wheel, id);
+}
+
+// Avanza un tick. Devuelve la lista (enlazada por 'next') de entradas vencidas,
+// ya desenlazadas de la rueda, o -1 si no vence ninguna.
+int32_t timer_wheel_tick(struct timer_wheel *wheel) {
+    __atomic_store_n(&wheel->now, wheel->now + 1, __ATOMIC_RELAXED);  // Las renovaciones lo leen sin mutex
+    // Bajar de nivel las entradas cuya ranura superior acaba de llegar
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if ((wheel->now & ((1u << (WHEEL_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        int slot = level * WHEEL_SLOTS + ((wheel->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+        int32_t id = wheel->head[slot];
+        wheel->head[slot] = -1;
+        while (id >= 0) {
+            int32_t next = wheel->nodes[id].next;
+            timer_link(wheel, id);
+            id = next;
+        }
+    }
+    int slot = wheel->now & (WHEEL_SLOTS - 1);
+    int32_t expired = wheel->head[slot];
+    wheel->head[slot] = -1;
+    for (int32_t id = expired; id >= 0; id = wheel->nodes[id].next) {
+        wheel->nodes[id].slot = -1;
+    }
+    return expired;
+}
+
+// Codifica una opción de 4 bytes en 'options' y devuelve la nueva posición
+static size_t put_option32(uint8_t *options, size_t pos, uint8_t code, uint32_t value) {
+    options[pos] = code;
+    options[pos + 1] = 4;
+    memcpy(&options[pos + 2], &value, 4);
+    return pos + 6;
+}
+
+// Cabecera común de todas las respuestas del servidor
+static void init_reply_header(struct dhcp_packet *packet, uint32_t server_id) {
+    memset(packet, 0, sizeof(struct dhcp_packet));
+    packet->op = 2;  // Servidor -> Cliente
+    packet->htype = 1;  // Ethernet
+    packet->hlen = 6;   // Tamaño de la dirección HW
+    packet->flags = htons(0x8000);  // Broadcast flag
+    packet->siaddr = server_id;
+    packet->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+}
+
+// Longitud en el cable de una respuesta cuyas opciones ocupan 'options_len'
+static size_t reply_length(size_t options_len) {
+    size_t len = offsetof(struct dhcp_packet, options) + options_len;
+    return len < DHCP_MIN_REPLY_LEN ? DHCP_MIN_REPLY_LEN : len;
+}
+
+// Precodifica las respuestas del pool una sola vez: cabecera y bloque de
+// opciones completos, de modo que cada respuesta solo parchea xid, yiaddr,
+// chaddr y el tipo de mensaje. Las direcciones van en orden de red.
+void build_reply_templates(struct reply_templates *templates, uint32_t server_id, uint32_t subnet_mask,
+                           uint32_t gateway, uint32_t dns_server, uint32_t lease_time) {
+    // OFFER y ACK comparten opciones: tipo, máscara, gateway, DNS, lease e identificador
+    struct dhcp_packet *packet = &templates->lease;
+    init_reply_header(packet, server_id);
+    size_t pos = 0;
+    packet->options[pos++] = 53;
+    packet->options[pos++] = 1;
+    templates->type_offset = pos;
+    packet->options[pos++] = DHCP_OFFER;
+    pos = put_option32(packet->options, pos, 1, subnet_mask);        // Máscara de red
+    pos = put_option32(packet->options, pos, 3, gateway);            // Puerta de enlace
+    pos = put_option32(packet->options, pos, 6, dns_server);         // DNS
+    pos = put_option32(packet->options, pos, 51, htonl(lease_time)); // Tiempo de lease
+    pos = put_option32(packet->options, pos, 54, server_id);         // Identificador del servidor
+    packet->options[pos++] = 255;  // Fin de opciones
+    templates->lease_len = reply_length(pos);
+
+    // NAK: solo tipo de mensaje e identificador del servidor
+    packet = &templates->nak;
+    init_reply_header(packet, server_id);
+    pos = 0;
+    packet->options[pos++] = 53;
+    packet->options[pos++] = 1;
+    packet->options[pos++] = DHCP_NAK;
+    pos = put_option32(packet->options, pos, 54, server_id);
+    packet->options[pos++] = 255;
+    templates->nak_len = reply_length(pos);
+}
+
+// Siguiente entrada asignada a partir de 'from', o 'capacity' si no hay más.
+// Las entradas libres tienen la IP a cero; con SSE2 se saltan de cuatro en cuatro.
+static uint32_t lease_next_used(const struct lease_table *table, uint32_t from) {
+    uint32_t i = from;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= table->capacity; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&table->ip[i]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)) != 0xFFFF) {
+            break;
+        }
+    }
+#endif
+    for (; i < table->capacity; i++) {
+        if (table->ip[i] != 0) {
+            return i;
+        }
+    }
+    return table->capacity;
+}
+
+// Reconstruye el índice MAC desde la tabla, con tamaño para toda su capacidad.
+// Las IPs en cuarentena ya no pertenecen a su MAC y no se indexan.
+static int mac_index_rebuild(struct lease_pool *pool) {
+    struct mac_index index;
+    if (mac_index_init(&index, pool->leases.capacity) < 0) {
+        return -1;
+    }
+    for (uint32_t i = lease_next_used(&pool->leases, 0); i < pool->leases.capacity;
+         i = lease_next_used(&pool->leases, i + 1)) {
+        if (pool->leases.expires[i] != LEASE_DECLINED) {
+            mac_index_insert(&index, pool->leases.mac[i], i);
+        }
+    }
+    mac_index_publish(&pool->index, &index);
+    return 0;
+}
+
+// Reserva espacio de direcciones para 'count' elementos de 'size' bytes. Las
+// páginas se ocupan (a cero) la primera vez que se tocan, y el array no se
+// mueve nunca, así que un lector sin mutex no puede quedarse con uno liberado.
+static void *lease_array_reserve(size_t count, size_t size) {
+    void *array = mmap(NULL, count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return array == MAP_FAILED ? NULL : array;
+}
+
+// Amplía la tabla de leases del pool al doble (sin pasar del máximo). Los
+// arrays de las entradas están reservados para el máximo desde el principio y
+// solo se reubican con realloc la pila de libres y los temporizadores, que
+// únicamente se usan con el mutex. El índice solo se reconstruye cuando ya no
+// cabe la nueva capacidad. Devuelve -1 si la tabla ya está en su máximo o no hay memoria.
+int lease_table_grow(struct lease_pool *pool) {
+    struct lease_table *table = &pool->leases;
+    if (table->capacity >= table->max_capacity) {
+        return -1;
+    }
+    if (table->ip == NULL) {
+        #define RESERVE(array) do { \
+            table->array = lease_array_reserve(table->max_capacity, sizeof(*table->array)); \
+            if (table->array == NULL) { \
+                return -1; \
+            } \
+        } while (0)
+        RESERVE(ip);
+        RESERVE(mac);
+        RESERVE(expires);
+        RESERVE(deadline);
+        RESERVE(seq);
+        RESERVE(xid);
+        #undef RESERVE
+    }
+    uint32_t old = table->capacity;
+    uint32_t capacity = old == 0 ? LEASE_TABLE_INITIAL : old * 2;
+    if (capacity > table->max_capacity || capacity < old) {
+        capacity = table->max_capacity;
+    }
+    #define GROW(array) do { \
+        void *grown_ = realloc(table->array, (size_t)capacity * sizeof(*table->array)); \
+        if (grown_ == NULL) { \
+            return -1; \
+        } \
+        table->array = grown_; \
+    } while (0)
+    GROW(free);
+    void *timers = realloc(pool->timers, (size_t)capacity * sizeof(struct timer_node));
+    if (timers == NULL) {
+        return -1;
+    }
+    #undef GROW
+    pool->timers = timers;
+    pool->wheel.nodes = pool->timers;
+    for (uint32_t i = old; i < capacity; i++) {
+        pool->timers[i].slot = -1;  // Las entradas nuevas ya están a cero
+    }
+    // Las nuevas quedan en la pila por debajo de las libres que hubiera
+    memmove(table->free + (capacity - old), table->free, table->free_top * sizeof(uint32_t));
+    for (uint32_t i = old; i < capacity; i++) {
+        table->free[capacity - 1 - i] = i;
+    }
+    table->free_top += capacity - old;
+    table->capacity = capacity;
+    if (pool->index.buckets == NULL || capacity > mac_index_capacity(&pool->index)) {
+        return mac_index_rebuild(pool);
+    }
+    return 0;
+}
+
+// Bytes reservados por la tabla de leases de un pool y sus estructuras auxiliares
+size_t pool_memory(const struct lease_pool *pool) {
+    size_t per_entry = 6 * sizeof(uint32_t) + 6 + sizeof(struct timer_node);
+    uint32_t capacity = __atomic_load_n(&pool->leases.capacity, __ATOMIC_RELAXED);
+    size_t buckets = 2 * (__atomic_load_n(&pool->index.mask, __ATOMIC_RELAXED) + 1);  // Publicados y reserva
+    return per_entry * capacity + buckets * sizeof(struct mac_bucket) + pool->bitmap.nwords * sizeof(uint64_t);
+}
+
+// Inicializa un pool de IPs de la subred dada para el rango [start, end] con
+// hasta 'max_leases' asignaciones
+void init_ip_pool(struct lease_pool *pool, int subnet, uint32_t start, uint32_t end, uint32_t max_leases) {
+    pthread_mutex_init(&pool->mutex, NULL);
+    memset(&pool->leases, 0, sizeof(pool->leases));
+    memset(&pool->index, 0, sizeof(pool->index));
+    pool->timers = NULL;
+    pool->subnet = subnet;
+    pool->lease_time = subnets[subnet].lease_time;
+    pool->leases.max_capacity = max_leases;
+    pool->offers = 0;
+    pool->declined = 0;
+    atomic_init(&pool->offers_expired, 0);
+    timer_wheel_init(&pool->wheel, NULL, 0);
+    if (lease_table_grow(pool) < 0) {
+        perror("Error al asignar la tabla de leases");
+        exit(1);
+    }
+    if (ip_bitmap_init(&pool->bitmap, start, end) < 0) {
+        perror("Error al asignar el mapa de direcciones libres");
+        exit(1);
+    }
+    build_reply_templates(&pool->templates, htonl(server_id), htonl(prefix_mask(subnets[subnet].prefix_len)),
+                          htonl(subnets[subnet].router), htonl(subnets[subnet].dns), pool->lease_time);
+    pthread_mutex_init(&pool->journal.lock, NULL);
+    pthread_mutex_init(&pool->journal.io, NULL);
+    pool->journal.fd = -1;
+}
+
+// Crea los pools vacíos: uno por subred y fragmento, cada uno con su porción del rango
+int create_pools(void) {
+    shard_count = config.shards > 0 ? config.shards : 1;
+    pool_count = subnet_count * shard_count;
+    lease_pools = aligned_alloc(64, pool_count * sizeof(struct lease_pool));
+    if (lease_pools == NULL) {
+        perror("Error al asignar los pools");
+        return -1;
+    }
+    for (int s = 0; s < subnet_count; s++) {
+        uint32_t range_start = subnets[s].range_start;
+        uint32_t range_size = subnets[s].range_end - range_start + 1;
+        if ((uint32_t)shard_count > range_size) {
+            fprintf(stderr, "Más fragmentos (%d) que direcciones en el rango de %s (%u)\n", shard_count,
+                    subnets[s].name, range_size);
+            return -1;
+        }
+        for (int i = 0; i < shard_count; i++) {
+            uint32_t start = range_start + (uint64_t)range_size * i / shard_count;
+            uint32_t end = range_start + (uint64_t)range_size * (i + 1) / shard_count - 1;
+            uint32_t max_leases = (subnets[s].max_leases + shard_count - 1) / shard_count;
+            init_ip_pool(&lease_pools[s * shard_count + i], s, start, end,
+                         max_leases < end - start + 1 ? max_leases : end - start + 1);
+        }
+        LOG(LOG_DEBUG, "Subred %s: rango %I - %I, lease de %u s", subnets[s].name, htonl(subnets[s].range_start),
+            htonl(subnets[s].range_end), subnets[s].lease_time);
+    }
+    return 0;
+}
+
+static uint32_t journal_checksum(const struct journal_record *record) {
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint32_t hash = 2166136261u;  // FNV-1a sobre todo menos el campo 'check'
+    for (size_t i = 0; i < offsetof(struct journal_record, check); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Describe la entrada i del pool. El diario guarda inicio y duración; el
+// inicio se deduce del vencimiento, así que inicio + duración es siempre el vencimiento.
+static void journal_fill(struct journal_record *record, uint8_t type, const struct lease_pool *pool, uint32_t i) {
+    const struct lease_table *table = &pool->leases;
+    memset(record, 0, sizeof(*record));
+    record->type = type;
+    memcpy(record->mac, table->mac[i], 6);
+    record->ip = table->ip[i];
+    record->xid = table->xid[i];
+    record->lease_duration = pool->lease_time;
+    record->lease_start = table->expires[i] != 0 ? (int64_t)table->expires[i] - pool->lease_time : 0;
+    record->check = journal_checksum(record);
+}
+
+// Añade un registro al diario del pool. Se llama con el seqlock de la entrada
+// tomado, así los registros de una misma entrada quedan en el orden de sus cambios.
+void journal_append(struct lease_pool *pool, uint8_t type, uint32_t i) {
+    struct lease_journal *journal = &pool->journal;
+    if (journal_dir == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&journal->lock);
+    if (journal->fd < 0) {
+        pthread_mutex_unlock(&journal->lock);
+        return;
+    }
+    if (journal->count == journal->capacity) {
+        // Crecer en lugar de escribir aquí, para no desordenar los registros
+        size_t capacity = journal->capacity ? journal->capacity * 2 : JOURNAL_INITIAL_RECORDS;
+        struct journal_record *records = realloc(journal->records, capacity * sizeof(struct journal_record));
+        if (records == NULL) {
+            pthread_mutex_unlock(&journal->lock);
+            perror("Error al ampliar el diario de leases");
+            return;
+        }
+        journal->records = records;
+        journal->capacity = capacity;
+    }
+    journal_fill(&journal->records[journal->count++], type, pool, i);
+    if (type == JOURNAL_RENEW && !config.early_ack) {
+        // Leído bajo el mutex del diario: si la pasada que lo vacía aún no ha
+        // empezado, será la siguiente a 'started' y se llevará este registro
+        uint64_t pass = atomic_load(&journal_commit.started) + 1;
+        if (pass > journal_wait_pass) {
+            journal_wait_pass = pass;
+        }
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// Espera a que sean durables los registros de ACK que este hilo ha añadido al
+// diario. Se llama justo antes de enviar respuestas: un ACK enviado y perdido
+// en una caída dejaría la dirección libre para otro cliente al recuperar.
+void journal_wait_durable(void) {
+    uint64_t pass = journal_wait_pass;
+    if (pass == 0) {
+        return;
+    }
+    journal_wait_pass = 0;
+    if (atomic_load(&journal_commit.finished) >= pass) {
+        return;
+    }
+    pthread_mutex_lock(&journal_commit.lock);
+    if (pass > journal_commit.wanted) {
+        journal_commit.wanted = pass;
+        pthread_cond_signal(&journal_commit.wake);
+    }
+    while (atomic_load(&journal_commit.finished) < pass) {
+        pthread_cond_wait(&journal_commit.done, &journal_commit.lock);
+    }
+    pthread_mutex_unlock(&journal_commit.lock);
+}
+
+// Seqlock de la entrada i. Los escritores con el mutex del pool esperan a que
+// quede libre; una renovación sin mutex lo intenta una vez y, si está ocupado,
+// sigue por el camino con mutex.
+static inline int lease_try_write(struct lease_table *table, uint32_t i) {
+    uint32_t seq = __atomic_load_n(&table->seq[i], __ATOMIC_RELAXED);
+    return (seq & 1) == 0 &&
+           __atomic_compare_exchange_n(&table->seq[i], &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void lease_write_begin(struct lease_table *table, uint32_t i) {
+    while (!lease_try_write(table, i)) {
+        sched_yield();  // Quien la tiene solo actualiza la entrada y copia un registro al diario
+    }
+}
+
+static inline void lease_write_end(struct lease_table *table, uint32_t i) {
+    __atomic_store_n(&table->seq[i], __atomic_load_n(&table->seq[i], __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+// Lectura sin mutex: se toma la secuencia, se copian los campos y se repite si
+// lease_read_retry() indica que la entrada cambió mientras tanto
+static inline uint32_t lease_read_begin(const struct lease_table *table, uint32_t i) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&table->seq[i], __ATOMIC_ACQUIRE)) & 1) {
+        sched_yield();
+    }
+    return seq;
+}
+
+static inline int lease_read_retry(const struct lease_table *table, uint32_t i, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&table->seq[i], __ATOMIC_RELAXED) != seq;
+}
+
+// Fragmento dueño de una MAC. Usa los bytes 2..5 de chaddr en orden de red,
+// igual que el filtro BPF que reparte los paquetes entre los sockets SO_REUSEPORT.
+static inline int shard_of_mac(const uint8_t *mac) {
+    uint32_t tail;
+    memcpy(&tail, mac + 2, 4);
+    return (int)(ntohl(tail) % (uint32_t)shard_count);
+}
+
+// Pool que guarda las asignaciones de una MAC en una subred
+static inline struct lease_pool *pool_for_mac(int subnet, const uint8_t *mac) {
+    return &lease_pools[subnet * shard_count + shard_of_mac(mac)];
+}
+
+// Hash de la identidad de un cliente: su client-id (opción 61) con
+// ALLOC_HASH_CLIENT_ID si lo envía, o su chaddr
+uint64_t client_hash(const uint8_t *mac, const struct dhcp_options *options) {
+    uint8_t len = 0;
+    const uint8_t *id = NULL;
+    if (config.alloc_policy == ALLOC_HASH_CLIENT_ID && options != NULL) {
+        id = dhcp_option_get(options, DHCP_OPT_CLIENT_ID, &len);
+    }
+    if (id == NULL || len == 0) {
+        return mac_hash(mac_key(mac));
+    }
+    uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a, mezclado después como una MAC
+    for (uint8_t i = 0; i < len; i++) {
+        hash = (hash ^ id[i]) * 0x100000001b3ull;
+    }
+    return mac_hash(hash);
+}
+
+// Dirección preferida de un hash dentro de un rango de 'size' direcciones
+// (desplazamiento desde su base), sin división
+static inline uint32_t preferred_offset(uint64_t hash, uint32_t size) {
+    return (uint32_t)(((hash >> 32) * size) >> 32);
+}
+
+// Encuentra una IP libre para el cliente según la política de asignación. Con
+// hash, la mayoría de los clientes recibe su dirección preferida al primer
+// intento y la misma tras un reinicio aunque no se haya guardado estado.
+uint32_t find_free_ip(struct lease_pool *pool, const uint8_t *mac, const struct dhcp_options *options) {
+    if (config.alloc_policy == ALLOC_FIRST_FIT) {
+        return ip_bitmap_find(&pool->bitmap);  // 0 si no hay IPs libres
+    }
+    int probes;
+    uint32_t off = preferred_offset(client_hash(mac, options), pool->bitmap.size);
+    uint32_t ip = ip_bitmap_find_near(&pool->bitmap, off, &probes);
+    if (ip != 0 && thread_stats != NULL) {
+        metrics_add(&thread_stats->alloc_probes[probes - 1], 1);
+    }
+    return ip;
+}
+
+// Busca si el cliente ya tiene una IP asignada. No toma el mutex del pool: se
+// llama dentro de una sección RCU, o con el mutex si no hay ranura RCU.
+uint32_t find_ip_by_mac(struct lease_pool *pool, uint8_t *mac) {
+    long i = mac_index_lookup(&pool->index, mac);
+    if (i < 0) {
+        return 0;  // El cliente no tiene IP asignada
+    }
+    uint32_t ip, seq;
+    int owned;
+    do {
+        seq = lease_read_begin(&pool->leases, i);
+        ip = pool->leases.ip[i];
+        owned = memcmp(pool->leases.mac[i], mac, 6) == 0 && pool->leases.expires[i] != LEASE_DECLINED;
+    } while (lease_read_retry(&pool->leases, i, seq));
+    return owned ? ip : 0;  // La entrada pudo liberarse o pasar a otra MAC tras la búsqueda
+}
+
+// Cambia el estado de la entrada i (un vencimiento, LEASE_OFFERED o
+// LEASE_DECLINED) y lleva la cuenta de ofertas y cuarentenas del pool. Se llama
+// con el mutex del pool y el seqlock de la entrada.
+static void lease_set_expires(struct lease_pool *pool, uint32_t i, uint32_t expires) {
+    uint32_t old = pool->leases.expires[i];
+    pool->offers += (expires == LEASE_OFFERED) - (old == LEASE_OFFERED);
+    pool->declined += (expires == LEASE_DECLINED) - (old == LEASE_DECLINED);
+    pool->leases.expires[i] = expires;
+}
+
+// Reserva una IP para el cliente como oferta pendiente. Las ofertas no van al
+// diario: el primer registro de una asignación es el de su ACK. Devuelve la
+// posición en la tabla o -1 si la tabla está llena y no puede crecer.
+int32_t assign_ip_to_client(struct lease_pool *pool, uint32_t ip, uint8_t *mac, uint32_t xid) {
+    struct lease_table *table = &pool->leases;
+    if (table->free_top == 0 && lease_table_grow(pool) < 0) {
+        return -1;  // No quedan entradas libres en la tabla
+    }
+    uint32_t i = table->free[--table->free_top];  // Tomar una entrada libre
+    // Un lector sin mutex puede venir aún de la asignación anterior de la entrada
+    lease_write_begin(table, i);
+    table->ip[i] = ip;
+    memcpy(table->mac[i], mac, 6);
+    table->expires[i] = LEASE_OFFERED;  // Sin lease hasta el ACK
+    table->xid[i] = xid;    // Guarda el xid para controlar duplicados
+    lease_write_end(table, i);
+    pool->offers++;
+    table->used++;
+    mac_index_insert(&pool->index, mac, i);
+    ip_bitmap_take(&pool->bitmap, ip);
+    return i;
+}
+
+// Libera la asignación en la posición i del pool y devuelve su IP al conjunto
+// libre. Se llama con el mutex del pool y el seqlock de la entrada.
+static void lease_clear(struct lease_pool *pool, int32_t i) {
+    struct lease_table *table = &pool->leases;
+    uint32_t expires = table->expires[i];
+    if (expires != LEASE_OFFERED && expires != LEASE_DECLINED) {
+        journal_append(pool, JOURNAL_EXPIRE, i);  // Ofertas y cuarentenas no están en el diario
+    }
+    pool->offers -= expires == LEASE_OFFERED;
+    pool->declined -= expires == LEASE_DECLINED;
+    timer_cancel(&pool->wheel, i);
+    if (expires != LEASE_DECLINED) {
+        mac_index_remove(&pool->index, table->mac[i]);  // Una cuarentena ya salió del índice
+    }
+    table->free[table->free_top++] = i;
+    table->used--;
+    ip_bitmap_put(&pool->bitmap, table->ip[i]);
+    table->ip[i] = 0;
+    table->expires[i] = 0;
+    table->deadline[i] = 0;
+    table->xid[i] = 0;
+}
+
+// Libera la asignación en la posición i del pool. Se llama con el mutex del pool.
+void release_lease(struct lease_pool *pool, int32_t i) {
+    lease_write_begin(&pool->leases, i);
+    lease_clear(pool, i);
+    lease_write_end(&pool->leases, i);
+}
+
+// Avanza la rueda 'ticks' segundos y libera las IPs cuyos arrendamientos,
+// ofertas o cuarentenas han vencido. Cada tick devuelve de una vez la lista de
+// todo lo que vence en ese segundo, así que el coste depende solo de esas
+// entradas. Un lease renovado sin mutex sigue en su ranura antigua: al llegar
+// a ella se reprograma para el plazo que dejó la renovación.
+void release_expired_ips(struct lease_pool *pool, uint64_t ticks) {
+    pool_lock(pool);  // Bloquear el acceso al pool
+    while (ticks-- > 0) {
+        int32_t i = timer_wheel_tick(&pool->wheel);
+        while (i >= 0) {
+            int32_t next = pool->timers[i].next;
+            lease_write_begin(&pool->leases, i);
+            uint32_t expires = pool->leases.expires[i];
+            uint32_t deadline = pool->leases.deadline[i];
+            if (expires != LEASE_OFFERED && expires != LEASE_DECLINED &&
+                (int32_t)(deadline - pool->wheel.now) > 0) {
+                lease_write_end(&pool->leases, i);
+                timer_schedule(&pool->wheel, i, deadline);
+                i = next;
+                continue;
+            }
+            if (expires == LEASE_OFFERED) {
+                LOG(LOG_DEBUG, "IP %I liberada (oferta a %M sin REQUEST).", htonl(pool->leases.ip[i]),
+                    pool->leases.mac[i]);
+                metrics_add(&pool->offers_expired, 1);  // Solo se escribe con el mutex tomado
+            } else if (expires == LEASE_DECLINED) {
+                LOG(LOG_DEBUG, "IP %I liberada (fin de la cuarentena).", htonl(pool->leases.ip[i]));
+            } else {
+                LOG(LOG_DEBUG, "IP %I liberada (lease expirado).", htonl(pool->leases.ip[i]));
+            }
+            lease_clear(pool, i);  // Liberar la IP
+            lease_write_end(&pool->leases, i);
+            i = next;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);  // Desbloquear el acceso al pool
+    rcu_reclaim();
+}
+
+// Avanza las ruedas de todos los pools de un fragmento (uno por subred)
+void release_expired_shard(int shard, uint64_t ticks) {
+    for (int s = 0; s < subnet_count; s++) {
+        release_expired_ips(&lease_pools[s * shard_count + shard], ticks);
+    }
+}
+
+// Aplica un registro recuperado al pool dueño de su MAC en la subred de su IP,
+// así la configuración de subredes y fragmentos puede cambiar entre arranques.
+// Se llama al arrancar, antes de abrir los diarios, así que no genera registros nuevos.
+static void journal_apply(const struct journal_record *record, time_t now) {
+    uint8_t mac[6];
+    memcpy(mac, record->mac, 6);
+    int subnet = subnet_for_address(record->ip);
+    if (subnet < 0) {
+        return;  // La subred ya no está configurada
+    }
+    struct lease_pool *pool = pool_for_mac(subnet, mac);
+    long i = mac_index_lookup(&pool->index, mac);
+
+    if (record->type == JOURNAL_EXPIRE) {
+        if (i >= 0) {
+            release_lease(pool, i);
+        }
+        return;
+    }
+    if (record->lease_start == 0) {
+        return;  // Oferta sin ACK de un diario antiguo: ya habría vencido
+    }
+    if (i >= 0 && pool->leases.ip[i] != record->ip) {
+        release_lease(pool, i);
+        i = -1;
+    }
+    if (i < 0) {
+        // La IP debe seguir en el rango de este pool y estar libre
+        if (!ip_bitmap_is_free(&pool->bitmap, record->ip)) {
+            return;
+        }
+        i = assign_ip_to_client(pool, record->ip, mac, record->xid);
+        if (i < 0) {
+            return;
+        }
+    }
+    pool->leases.xid[i] = record->xid;
+    int64_t expires = record->lease_start + record->lease_duration;
+    if (expires <= now) {
+        release_lease(pool, i);  // Venció mientras el servidor estaba parado
+        return;
+    }
+    lease_set_expires(pool, i, (uint32_t)expires);
+    timer_schedule(&pool->wheel, i, pool->wheel.now + (uint32_t)(expires - now) + 1);
+}
+
+// Proyecta un fichero en memoria para leerlo. Devuelve 0 si existe y no está vacío.
+static int map_file(const char *path, const uint8_t **data, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    *data = map;
+    *len = st.st_size;
+    return 0;
+}
+
+// Reaplica los registros válidos de un fichero; se detiene en el primer
+// registro cortado o corrupto (la cola de un diario tras una caída).
+static size_t apply_records(const uint8_t *data, size_t len, time_t now) {
+    size_t count = len / sizeof(struct journal_record);
+    for (size_t n = 0; n < count; n++) {
+        struct journal_record record;
+        memcpy(&record, data + n * sizeof(record), sizeof(record));
+        if (record.check != journal_checksum(&record)) {
+            return n;
+        }
+        journal_apply(&record, now);
+    }
+    return count;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Reconstruye los pools desde el directorio del diario: por cada fichero de
+// pool, la instantánea (proyectada con mmap) y después sus diarios con
+// generación igual o posterior. Devuelve la mayor generación encontrada.
+uint32_t journal_recover(const char *dir) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    time_t now = time(NULL);
+    uint32_t max_generation = 0;
+    size_t records = 0;
+    char path[4096];
+
+    for (int p = 0;; p++) {
+        // Generaciones de diario presentes para este fichero de pool
+        uint32_t generations[256];
+        int ngen = 0;
+        char prefix[32];
+        int prefix_len = snprintf(prefix, sizeof(prefix), "pool%d.journal.", p);
+        DIR *d = opendir(dir);
+        if (d == NULL) {
+            break;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL && ngen < 256) {
+            if (strncmp(entry->d_name, prefix, prefix_len) == 0) {
+                generations[ngen++] = (uint32_t)strtoul(entry->d_name + prefix_len, NULL, 10);
+            }
+        }
+        closedir(d);
+
+        const uint8_t *data;
+        size_t len;
+        uint32_t snapshot_generation = 0;
+        snprintf(path, sizeof(path), "%s/pool%d.snap", dir, p);
+        int have_snapshot = map_file(path, &data, &len) == 0;
+        if (!have_snapshot && ngen == 0) {
+            break;  // No hay más ficheros de pool
+        }
+        if (have_snapshot) {
+            const struct snapshot_header *header = (const struct snapshot_header *)data;
+            if (len >= sizeof(*header) && memcmp(header->magic, SNAPSHOT_MAGIC, 8) == 0 &&
+                header->version == SNAPSHOT_VERSION &&
+                len >= sizeof(*header) + header->count * sizeof(struct journal_record)) {
+                snapshot_generation = header->generation;
+                records += apply_records(data + sizeof(*header), header->count * sizeof(struct journal_record), now);
+            } else {
+                fprintf(stderr, "Instantánea %s inválida, se ignora\n", path);
+            }
+            munmap((void *)data, len);
+        }
+
+        qsort(generations, ngen, sizeof(uint32_t), compare_u32);
+        for (int g = 0; g < ngen; g++) {
+            if (generations[g] > max_generation) {
+                max_generation = generations[g];
+            }
+            if (generations[g] < snapshot_generation) {
+                continue;  // Ya incluido en la instantánea
+            }
+            snprintf(path, sizeof(path), "%s/pool%d.journal.%u", dir, p, generations[g]);
+            if (map_file(path, &data, &len) == 0) {
+                records += apply_records(data, len, now);
+                munmap((void *)data, len);
+            }
+        }
+        if (snapshot_generation > max_generation) {
+            max_generation = snapshot_generation;
+        }
+    }
+
+    size_t leases = 0;
+    for (int p = 0; p < pool_count; p++) {
+        leases += lease_pools[p].leases.used;
+    }
+    LOG(LOG_INFO, "Diario: %zu leases recuperados de %zu registros en %.1f ms.", leases, records, elapsed_ns(&start) / 1e6);
+    return max_generation;
+}
+
+static int open_journal_file(const char *dir, int p, uint32_t generation) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/pool%d.journal.%u", dir, p, generation);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Error al abrir el diario de leases");
+    }
+    return fd;
+}
+
+static void write_all(int fd, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error al escribir el diario de leases");
+            return;
+        }
+        bytes += n;
+        len -= n;
+    }
+}
+
+// Toma los registros pendientes del pool bajo el mutex del diario, dejando el
+// buffer de reserva como activo. Devuelve cuántos hay en '*records'.
+static size_t journal_take(struct lease_journal *journal, struct journal_record **records) {
+    struct journal_record *full = journal->records;
+    size_t full_capacity = journal->capacity;
+    size_t count = journal->count;
+    journal->records = journal->spare;
+    journal->capacity = journal->spare_capacity;
+    journal->count = 0;
+    journal->spare = full;
+    journal->spare_capacity = full_capacity;
+    *records = full;
+    return count;
+}
+
+// Commit en grupo: un write y un fdatasync para todo lo acumulado en la ventana
+void journal_flush(struct lease_pool *pool) {
+    struct lease_journal *journal = &pool->journal;
+    struct journal_record *records;
+    pthread_mutex_lock(&journal->io);
+    pthread_mutex_lock(&journal->lock);
+    if (journal->count == 0) {
+        pthread_mutex_unlock(&journal->lock);
+        pthread_mutex_unlock(&journal->io);
+        return;
+    }
+    size_t count = journal_take(journal, &records);
+    int fd = journal->fd;
+    pthread_mutex_unlock(&journal->lock);
+
+    write_all(fd, records, count * sizeof(struct journal_record));
+    fdatasync(fd);
+    pthread_mutex_unlock(&journal->io);
+    atomic_fetch_add_explicit(&journal->written, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&journal->syncs, 1, memory_order_relaxed);
+}
+
+// Escribe una instantánea compactada del pool y pasa su diario a una
+// generación nueva; los diarios anteriores se borran cuando la instantánea es
+// durable. La generación cambia antes de leer las entradas, y cada una se lee
+// con su seqlock, así que un cambio que escribió en el diario viejo ya se ve en
+// la instantánea y uno posterior está en el nuevo. Por eso la tabla se copia
+// por tramos de SNAPSHOT_CHUNK entradas, soltando el mutex del pool entre uno y
+// otro: lo que cambie en un tramo ya copiado se repite desde el diario nuevo.
+void snapshot_pool(struct lease_pool *pool, int p) {
+    struct lease_journal *journal = &pool->journal;
+    struct journal_record *pending;
+
+    // Con 'io' la rotación no se cruza con un commit en grupo: los registros
+    // pendientes quedan durables en el diario viejo antes de que termine la
+    // pasada que los esperaba, y en el mismo orden
+    pthread_mutex_lock(&journal->io);
+    pthread_mutex_lock(&journal->lock);
+    uint32_t generation = journal->generation + 1;
+    int new_fd = open_journal_file(journal_dir, p, generation);
+    if (new_fd < 0) {
+        // Sin diario nuevo se sigue con el actual
+        pthread_mutex_unlock(&journal->lock);
+        pthread_mutex_unlock(&journal->io);
+        return;
+    }
+    size_t pending_count = journal_take(journal, &pending);
+    int old_fd = journal->fd;
+    journal->fd = new_fd;
+    journal->generation = generation;
+    pthread_mutex_unlock(&journal->lock);
+    // Cerrar la generación anterior con lo que quedaba pendiente
+    if (old_fd >= 0) {
+        write_all(old_fd, pending, pending_count * sizeof(struct journal_record));
+        fdatasync(old_fd);
+        close(old_fd);
+        atomic_fetch_add_explicit(&journal->written, pending_count, memory_order_relaxed);
+        atomic_fetch_add_explicit(&journal->syncs, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&journal->io);
+
+    size_t count = 0, capacity = 0;
+    struct journal_record *live = NULL;
+    for (uint32_t from = 0;; from += SNAPSHOT_CHUNK) {
+        pthread_mutex_lock(&pool->mutex);
+        // Bajo el mutex: la tabla puede haber crecido desde el tramo anterior
+        uint32_t end = pool->leases.capacity;
+        if (from >= end) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        end = end - from > SNAPSHOT_CHUNK ? from + SNAPSHOT_CHUNK : end;
+        if (capacity - count < SNAPSHOT_CHUNK) {
+            capacity = capacity ? capacity * 2 : (size_t)pool->leases.used + SNAPSHOT_CHUNK;
+            struct journal_record *grown = realloc(live, capacity * sizeof(struct journal_record));
+            if (grown == NULL) {
+                pthread_mutex_unlock(&pool->mutex);
+                perror("Error al asignar la instantánea");
+                free(live);
+                return;
+            }
+            live = grown;
+        }
+        for (uint32_t i = lease_next_used(&pool->leases, from); i < end; i = lease_next_used(&pool->leases, i + 1)) {
+            uint32_t seq, live_lease;
+            do {
+                seq = lease_read_begin(&pool->leases, i);
+                uint32_t expires = pool->leases.expires[i];
+                live_lease = expires != LEASE_OFFERED && expires != LEASE_DECLINED;  // Solo leases con ACK
+                if (live_lease) {
+                    journal_fill(&live[count], JOURNAL_RENEW, pool, i);
+                }
+            } while (lease_read_retry(&pool->leases, i, seq));
+            count += live_lease;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    char path[4096], tmp[4096];
+    snprintf(path, sizeof(path), "%s/pool%d.snap", journal_dir, p);
+    snprintf(tmp, sizeof(tmp), "%s/pool%d.snap.tmp", journal_dir, p);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Error al crear la instantánea");
+        free(live);
+        return;
+    }
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.generation = generation;
+    header.count = count;
+    write_all(fd, &header, sizeof(header));
+    write_all(fd, live, count * sizeof(struct journal_record));
+    fdatasync(fd);
+    close(fd);
+    free(live);
+    if (rename(tmp, path) < 0) {
+        perror("Error al publicar la instantánea");
+        return;
+    }
+    int dir_fd = open(journal_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    // Borrar los diarios que la instantánea ya incluye
+    DIR *d = opendir(journal_dir);
+    if (d != NULL) {
+        char prefix[32];
+        int prefix_len = snprintf(prefix, sizeof(prefix), "pool%d.journal.", p);
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (strncmp(entry->d_name, prefix, prefix_len) == 0 &&
+                strtoul(entry->d_name + prefix_len, NULL, 10) < generation) {
+                snprintf(path, sizeof(path), "%s/%s", journal_dir, entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(d);
+    }
+}
+
+// Hilo de commit en grupo. Sin ACKs esperando, una
+// pasada cada JOURNAL_FLUSH_MS; con ellos, en cuanto termina la anterior, así
+// que los registros que llegan durante un fdatasync forman el grupo siguiente.
+void *journal_main(void *arg) {
+    (void)arg;
+    while (!atomic_load(&journal_commit.stopping)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += JOURNAL_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&journal_commit.lock);
+        while (journal_commit.wanted <= atomic_load(&journal_commit.finished) &&
+               !atomic_load(&journal_commit.stopping) &&
+               pthread_cond_timedwait(&journal_commit.wake, &journal_commit.lock, &deadline) != ETIMEDOUT) {
+        }
+        pthread_mutex_unlock(&journal_commit.lock);
+
+        uint64_t pass = atomic_fetch_add(&journal_commit.started, 1) + 1;
+        for (int p = 0; p < pool_count; p++) {
+            journal_flush(&lease_pools[p]);
+        }
+        pthread_mutex_lock(&journal_commit.lock);
+        atomic_store(&journal_commit.finished, pass);
+        pthread_cond_broadcast(&journal_commit.done);
+        pthread_mutex_unlock(&journal_commit.lock);
+    }
+    // Última pasada: lo añadido mientras se pedía parar
+    for (int p = 0; p < pool_count; p++) {
+        journal_flush(&lease_pools[p]);
+    }
+    return NULL;
+}
+
+// Hilo de instantáneas periódicas. Va aparte del de commit: escribir la tabla
+// entera lleva cientos de ms con un millón de leases, y mientras tanto los
+// ACK que esperan en journal_wait_durable() quedarían parados.
+void *snapshot_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&journal_commit.lock);
+    while (!atomic_load(&journal_commit.stopping)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += SNAPSHOT_INTERVAL;
+        while (!atomic_load(&journal_commit.stopping) &&
+               pthread_cond_timedwait(&journal_commit.snapshot_wake, &journal_commit.lock, &deadline) != ETIMEDOUT) {
+        }
+        if (atomic_load(&journal_commit.stopping)) {
+            break;
+        }
+        pthread_mutex_unlock(&journal_commit.lock);
+        for (int p = 0; p < pool_count; p++) {
+            snapshot_pool(&lease_pools[p], p);
+        }
+        pthread_mutex_lock(&journal_commit.lock);
+    }
+    pthread_mutex_unlock(&journal_commit.lock);
+    return NULL;
+}
+
+// Para los hilos de commit y de instantáneas tras vaciar todos los diarios
+// (solo lo usa el banco del diario)
+void journal_stop(void) {
+    pthread_mutex_lock(&journal_commit.lock);
+    atomic_store(&journal_commit.stopping, 1);
+    pthread_cond_signal(&journal_commit.wake);
+    pthread_cond_signal(&journal_commit.snapshot_wake);
+    pthread_mutex_unlock(&journal_commit.lock);
+    pthread_join(journal_commit.thread, NULL);
+    pthread_join(journal_commit.snapshot_thread, NULL);
+    atomic_store(&journal_commit.stopping, 0);
+}
+
+// Recupera el estado guardado, compacta en una generación nueva y arranca los
+// hilos de commit en grupo y de instantáneas
+int journal_start(const char *dir) {
+    journal_dir = dir;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("Error al crear el directorio del diario");
+        return -1;
+    }
+    uint32_t generation = journal_recover(dir);
+    for (int p = 0; p < pool_count; p++) {
+        lease_pools[p].journal.generation = generation;
+        snapshot_pool(&lease_pools[p], p);
+        if (lease_pools[p].journal.fd < 0) {
+            return -1;
+        }
+    }
+    // El temporizador de la ventana usa CLOCK_MONOTONIC, como el resto del servidor
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&journal_commit.wake, &attr);
+    pthread_cond_init(&journal_commit.snapshot_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&journal_commit.thread, NULL, journal_main, NULL) != 0 ||
+        pthread_create(&journal_commit.snapshot_thread, NULL, snapshot_main, NULL) != 0) {
+        perror("Error al crear el hilo del diario");
+        return -1;
+    }
+    return 0;
+}
+
+// Función para verificar si un `xid` ya fue procesado recientemente
+int is_duplicate_xid(struct lease_pool *pool, uint32_t xid, uint8_t *mac) {
+    long i = mac_index_lookup(&pool->index, mac);
+    if (i >= 0 && pool->leases.xid[i] == xid) {
+        return 1;  // Solicitud duplicada
+    }
+    return 0;  // No es un duplicado
+}
+
+// Copia la plantilla y parchea los campos propios del cliente
+static size_t patch_reply(struct dhcp_packet *packet, const struct dhcp_packet *template, size_t len,
+                          uint32_t yiaddr, uint8_t *mac, uint32_t xid) {
+    memcpy(packet, template, len);
+    packet->xid = htonl(xid);
+    packet->yiaddr = htonl(yiaddr);
+    memcpy(packet->chaddr, mac, 6);
+    return len;
+}
+
+// Construye un DHCP Offer. Devuelve la longitud a enviar.
+size_t construct_dhcp_offer(struct lease_pool *pool, struct dhcp_packet *packet, uint32_t offered_ip, uint8_t *mac, uint32_t xid) {
+    size_t len = patch_reply(packet, &pool->templates.lease, pool->templates.lease_len, offered_ip, mac, xid);
+    packet->options[pool->templates.type_offset] = DHCP_OFFER;
+    return len;
+}
+
+// Renueva sin el mutex del pool el lease de 'mac' en 'ip' si ya tenía ACK:
+// alarga el vencimiento y deja en 'deadline' el nuevo tick, sin tocar la rueda
+// (release_expired_ips lo reprograma cuando llega a su ranura antigua).
+// Devuelve 0 si hay que usar el camino con mutex: ofertas, entradas que otro
+// está modificando o que ya no son de esa MAC. Se llama dentro de una sección RCU.
+static int renew_lease(struct lease_pool *pool, uint8_t *mac, uint32_t ip) {
+    struct lease_table *table = &pool->leases;
+    long i = mac_index_lookup(&pool->index, mac);
+    if (i < 0 || !lease_try_write(table, i)) {
+        return 0;
+    }
+    uint32_t expires = table->expires[i];
+    int bound = table->ip[i] == ip && memcmp(table->mac[i], mac, 6) == 0 && expires != LEASE_OFFERED &&
+                expires != LEASE_DECLINED;
+    if (bound) {
+        table->expires[i] = (uint32_t)time(NULL) + pool->lease_time;
+        table->deadline[i] = __atomic_load_n(&pool->wheel.now, __ATOMIC_RELAXED) + pool->lease_time + 1;
+        journal_append(pool, JOURNAL_RENEW, i);
+    }
+    lease_write_end(table, i);
+    return bound;
+}
+
+// Construye un DHCP NAK. Devuelve la longitud a enviar.
+size_t construct_dhcp_nak(struct lease_pool *pool, struct dhcp_packet *packet, uint8_t *mac, uint32_t xid) {
+    return patch_reply(packet, &pool->templates.nak, pool->templates.nak_len, 0, mac, xid);
+}
+
+// Construye un DHCP ACK y renueva el lease. Devuelve la longitud a enviar; si
+// el lease dejó de existir tras la búsqueda sin mutex (oferta vencida, RELEASE
+// o DECLINE entre medias) construye un NAK: la dirección ya puede ser de otro.
+size_t construct_dhcp_ack(struct lease_pool *pool, struct dhcp_packet *packet, uint32_t assigned_ip, uint8_t *mac, uint32_t xid) {
+    size_t len = patch_reply(packet, &pool->templates.lease, pool->templates.lease_len, assigned_ip, mac, xid);
+    packet->options[pool->templates.type_offset] = DHCP_ACK;
+
+    // Una renovación no cambia la estructura del pool: no compite por su mutex
+    if (renew_without_lock && rcu_read_lock()) {
+        int renewed = renew_lease(pool, mac, assigned_ip);
+        rcu_read_unlock();
+        if (renewed) {
+            count_event(CNT_RENEWS_LOCKFREE);
+            return len;
+        }
+    }
+
+    // Primer ACK de una oferta (o entrada ocupada): actualizar el lease con el mutex
+    pool_lock(pool);  // Bloquear el acceso al pool
+    long i = mac_index_lookup(&pool->index, mac);
+    int bound = i >= 0 && pool->leases.ip[i] == assigned_ip;
+    if (bound) {
+        lease_write_begin(&pool->leases, i);
+        lease_set_expires(pool, i, (uint32_t)time(NULL) + pool->lease_time);  // El lease empieza en el ACK
+        // Reprogramar el vencimiento en la rueda (O(1))
+        timer_schedule(&pool->wheel, i, pool->wheel.now + pool->lease_time + 1);
+        journal_append(pool, JOURNAL_RENEW, i);
+        lease_write_end(&pool->leases, i);
+    }
+    pthread_mutex_unlock(&pool->mutex);  // Desbloquear el acceso al pool
+    if (!bound) {
+        LOG(LOG_DEBUG, "El lease de %M para %I desapareció antes del ACK; se responde NAK.", mac, htonl(assigned_ip));
+        return construct_dhcp_nak(pool, packet, mac, xid);
+    }
+    return len;
+}
+
+// Subred de una solicitud: la de giaddr si viene de un relay, si no la del
+// interfaz por el que llegó ('local_addr', orden de red) y, si ese interfaz no
+// tiene subred configurada, la primera. Devuelve -1 si el giaddr no es de ninguna.
+static int subnet_for_request(const struct dhcp_packet *dhcp_request, uint32_t local_addr) {
+    if (dhcp_request->giaddr != 0) {
+        return subnet_for_address(ntohl(dhcp_request->giaddr));
+    }
+    int subnet = local_addr != 0 ? subnet_for_address(ntohl(local_addr)) : -1;
+    return subnet >= 0 ? subnet : 0;
+}
+
+// DHCPRELEASE y DHCPDECLINE: el cliente deja su dirección (ciaddr en RELEASE,
+// la opción 50 en DECLINE). Con RELEASE vuelve al conjunto libre en el acto.
+// Con DECLINE la dirección ya está en uso en la red: el cliente pierde la
+// asignación al momento y puede pedir otra, pero la IP pasa DECLINE_PROBATION
+// segundos en cuarentena antes de volver a ofrecerse.
+static void release_binding(const struct dhcp_packet *dhcp_request, const struct dhcp_options *options,
+                            uint8_t message_type) {
+    const char *name = message_type == DHCP_RELEASE ? "RELEASE" : "DECLINE";
+    uint32_t ip = ntohl(dhcp_request->ciaddr), server, requested;
+    if (dhcp_option_get32(options, DHCP_OPT_SERVER_ID, &server) && ntohl(server) != server_id) {
+        return;  // Dirigido a otro servidor
+    }
+    if (message_type == DHCP_DECLINE) {
+        ip = dhcp_option_get32(options, DHCP_OPT_REQUESTED_IP, &requested) ? ntohl(requested) : 0;
+    }
+    if (ip == 0) {
+        LOG(LOG_DEBUG, "%s de %M sin dirección; se ignora.", name, dhcp_request->chaddr);
+        return;
+    }
+    // Estos mensajes pueden llegar directamente aunque el cliente obtuviera la
+    // dirección por un relay: la subred sale de la propia dirección
+    int subnet = subnet_for_address(ip);
+    if (subnet < 0) {
+        return;
+    }
+    struct lease_pool *pool = pool_for_mac(subnet, dhcp_request->chaddr);
+    pool_lock(pool);
+    long i = mac_index_lookup(&pool->index, dhcp_request->chaddr);
+    if (i < 0 || pool->leases.ip[i] != ip) {
+        pthread_mutex_unlock(&pool->mutex);
+        LOG(LOG_DEBUG, "%s de %M para %I, que no es suya; se ignora.", name, dhcp_request->chaddr, htonl(ip));
+        return;
+    }
+    if (message_type == DHCP_RELEASE) {
+        LOG(LOG_DEBUG, "IP %I liberada por %M (RELEASE).", htonl(ip), dhcp_request->chaddr);
+        release_lease(pool, i);
+    } else {
+        LOG(LOG_WARN, "IP %I rechazada por %M (DECLINE): en cuarentena %d s.", htonl(ip), dhcp_request->chaddr,
+            DECLINE_PROBATION);
+        lease_write_begin(&pool->leases, i);
+        if (pool->leases.expires[i] != LEASE_OFFERED) {
+            journal_append(pool, JOURNAL_EXPIRE, i);  // La asignación termina aquí
+        }
+        mac_index_remove(&pool->index, dhcp_request->chaddr);
+        lease_set_expires(pool, i, LEASE_DECLINED);
+        lease_write_end(&pool->leases, i);
+        timer_schedule(&pool->wheel, i, pool->wheel.now + DECLINE_PROBATION + 1);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Construye en 'reply' la respuesta a una solicitud DHCP de 'len' bytes.
+// Devuelve el número de bytes a enviar, o 0 si la solicitud no lleva respuesta.
+static size_t build_dhcp_reply(struct dhcp_packet *dhcp_request, size_t len, uint32_t local_addr,
+                               struct dhcp_packet *reply) {
+    struct dhcp_options options;
+    if (dhcp_options_parse_packet(&options, dhcp_request, len) == DHCP_OPTIONS_BAD_HEADER) {
+        count_event(CNT_INVALID);
+        return 0;  // No es un paquete DHCP
+    }
+    uint8_t message_type = dhcp_message_type(&options);
+    count_event(message_type == DHCP_DISCOVER ? CNT_DISCOVER : message_type == DHCP_REQUEST ? CNT_REQUEST
+                : message_type == DHCP_RELEASE ? CNT_RELEASE : message_type == DHCP_DECLINE ? CNT_DECLINE : CNT_OTHER);
+    if (message_type == DHCP_RELEASE || message_type == DHCP_DECLINE) {
+        release_binding(dhcp_request, &options, message_type);
+        return 0;  // No llevan respuesta
+    }
+
+    uint8_t client_mac[6];
+    memcpy(client_mac, dhcp_request->chaddr, 6);
+    uint32_t xid = ntohl(dhcp_request->xid);
+    uint32_t offered_ip = 0;
+    int subnet = subnet_for_request(dhcp_request, local_addr);
+    if (subnet < 0) {
+        LOG(LOG_DEBUG, "Solicitud de %M desde el relay %I, que no pertenece a ninguna subred.", client_mac,
+            dhcp_request->giaddr);
+        count_event(CNT_NO_SUBNET);
+        return 0;
+    }
+    struct lease_pool *pool = pool_for_mac(subnet, client_mac);
+
+    // Manejo de DHCP Discover
+    if (message_type == DHCP_DISCOVER) {
+        LOG(LOG_DEBUG, "DHCP Discover recibido del cliente %M.", client_mac);
+
+        pool_lock(pool);  // Bloquear el acceso al pool
+
+        long i = mac_index_lookup(&pool->index, client_mac);  // Verificar si ya tiene IP
+
+        if (i >= 0) {
+            LOG(LOG_DEBUG, "Cliente con MAC %M ya tiene una IP asignada.", client_mac);
+            // No necesitamos asignar una nueva IP, usamos la existente
+            offered_ip = pool->leases.ip[i];
+            if (pool->leases.expires[i] == LEASE_OFFERED) {
+                // Oferta aún sin reclamar: el nuevo DISCOVER alarga su reserva
+                timer_schedule(&pool->wheel, i, pool->wheel.now + config.offer_ttl + 1);
+            }
+        } else {
+            offered_ip = find_free_ip(pool, client_mac, &options);
+            if (offered_ip == 0) {
+                LOG(LOG_DEBUG, "No hay más direcciones IP disponibles para %M.", client_mac);
+                count_event(CNT_EXHAUSTED);
+                pthread_mutex_unlock(&pool->mutex);
+                // Responder con DHCP NAK al cliente
+                return construct_dhcp_nak(pool, reply, client_mac, xid);
+            }
+            i = assign_ip_to_client(pool, offered_ip, client_mac, xid);
+            if (i < 0) {
+                // Sin entrada en la tabla no se puede ofrecer: el REQUEST no encontraría el lease
+                LOG(LOG_DEBUG, "Tabla de leases llena; no se puede ofrecer una IP a %M.", client_mac);
+                count_event(CNT_EXHAUSTED);
+                pthread_mutex_unlock(&pool->mutex);
+                return construct_dhcp_nak(pool, reply, client_mac, xid);
+            }
+            // La reserva vuelve al conjunto libre si el REQUEST no llega a tiempo
+            timer_schedule(&pool->wheel, i, pool->wheel.now + config.offer_ttl + 1);
+        }
+
+        pthread_mutex_unlock(&pool->mutex);  // Desbloquear el acceso al pool
+
+        // Construir el DHCPOFFER con la IP asignada o existente
+        return construct_dhcp_offer(pool, reply, offered_ip, client_mac, xid);
+    }
+
+    // Manejo de DHCP Request
+    else if (message_type == DHCP_REQUEST) {
+        LOG(LOG_DEBUG, "DHCP Request recibido del cliente %M.", client_mac);
+
+        // Con la opción 54 de otro servidor el cliente ha elegido su oferta y
+        // rechaza la nuestra (RFC 2131 §4.3.2): la reserva vuelve al conjunto libre
+        uint32_t server;
+        if (dhcp_option_get32(&options, DHCP_OPT_SERVER_ID, &server) && ntohl(server) != server_id) {
+            pool_lock(pool);
+            long i = mac_index_lookup(&pool->index, client_mac);
+            if (i >= 0 && pool->leases.expires[i] == LEASE_OFFERED) {
+                LOG(LOG_DEBUG, "%M eligió el servidor %I; se libera su oferta de %I.", client_mac, server,
+                    htonl(pool->leases.ip[i]));
+                release_lease(pool, i);
+            }
+            pthread_mutex_unlock(&pool->mutex);
+            return 0;
+        }
+
+        // Verificar si el cliente tiene una IP asignada. La búsqueda no toma
+        // el mutex del pool salvo que el hilo no tenga ranura RCU.
+        uint32_t assigned_ip;
+        if (renew_without_lock && rcu_read_lock()) {
+            assigned_ip = find_ip_by_mac(pool, client_mac);
+            rcu_read_unlock();
+        } else {
+            pool_lock(pool);  // Bloquear el acceso al pool
+            assigned_ip = find_ip_by_mac(pool, client_mac);
+            pthread_mutex_unlock(&pool->mutex);  // Desbloquear el acceso al pool
+        }
+        if (assigned_ip == 0) {
+            LOG(LOG_DEBUG, "El cliente %M no tiene una IP asignada previamente.", client_mac);
+            return 0;
+        }
+
+        // Construir el DHCPACK para el cliente
+        return construct_dhcp_ack(pool, reply, assigned_ip, client_mac, xid);
+    }
+
+    return 0;
+}
+
+// Procesa una solicitud DHCP de 'len' bytes y construye la respuesta en 'reply'.
+// Devuelve el número de bytes a enviar, o 0 si la solicitud no lleva respuesta.
+size_t process_dhcp_request(struct dhcp_packet *dhcp_request, size_t len, uint32_t local_addr,
+                            struct dhcp_packet *reply) {
+    size_t reply_len = build_dhcp_reply(dhcp_request, len, local_addr, reply);
+    if (reply_len == 0) {
+        count_event(CNT_UNANSWERED);
+    } else {
+        reply->giaddr = dhcp_request->giaddr;  // El relay lo usa para elegir el interfaz del cliente
+        uint8_t type = reply->options[2];
+        count_event(type == DHCP_OFFER ? CNT_OFFER : type == DHCP_ACK ? CNT_ACK : CNT_NAK);
+    }
+    return reply_len;
+}
+
+// Informa de una respuesta ya enviada
+void print_reply_sent(const struct dhcp_packet *reply) {
+    switch (reply->options[2]) {
+        case DHCP_OFFER:
+            LOG(LOG_DEBUG, "DHCP Offer enviado a cliente %M: IP ofrecida = %I", reply->chaddr, reply->yiaddr);
+            break;
+        case DHCP_ACK:
+            LOG(LOG_DEBUG, "DHCP ACK enviado a cliente %M: IP asignada = %I", reply->chaddr, reply->yiaddr);
+            break;
+        case DHCP_NAK:
+            LOG(LOG_DEBUG, "DHCP NAK enviado a cliente %M.", reply->chaddr);
+            break;
+    }
+}
+
+// Función que maneja cada solicitud del cliente en un hilo trabajador; la
+// respuesta se construye en el propio buffer de la solicitud
+void handle_client_request(struct packet_buffer *buffer) {
+    struct client_request *request = &buffer->request;
+    size_t reply_len = process_dhcp_request(&request->dhcp_request, request->recv_len, request->local_addr,
+                                            &buffer->reply);
+    if (reply_len == 0) {
+        return;
+    }
+    journal_wait_durable();
+    metrics_add(&thread_stats->syscalls, 1);
+    if (sendto(request->sock, &buffer->reply, reply_len, 0, (struct sockaddr *)&request->client_addr,
+               request->client_addr_len) < 0) {
+        perror("Error al enviar respuesta DHCP");
+    } else {
+        print_reply_sent(&buffer->reply);
+    }
+}
+
+static inline uint64_t timespec_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+// Reserva un sketch de 'rate' mensajes por segundo con ráfagas de 'burst'
+int rate_sketch_init(struct rate_sketch *sketch, int bits, double rate, double burst) {
+    memset(sketch, 0, sizeof(*sketch));
+    if (rate <= 0) {
+        return 0;  // Sin límite: no se reserva nada
+    }
+    sketch->tat = calloc((size_t)RATE_SKETCH_ROWS << bits, sizeof(uint64_t));
+    if (sketch->tat == NULL) {
+        return -1;
+    }
+    sketch->bits = bits;
+    sketch->interval_ns = (uint64_t)(1e9 / rate);
+    sketch->burst_ns = (uint64_t)((burst < 1 ? 1 : burst) * sketch->interval_ns);
+    return 0;
+}
+
+// Estima la hora teórica de llegada de 'key' (nunca anterior a 'now') y deja en
+// 'cells' la celda de cada fila. Cada fila usa un multiplicador impar distinto.
+static inline uint64_t rate_sketch_estimate(const struct rate_sketch *sketch, uint64_t key, uint64_t now,
+                                            size_t cells[RATE_SKETCH_ROWS]) {
+    static const uint64_t seeds[RATE_SKETCH_ROWS] = {
+        0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull,
+    };
+    uint64_t estimate = UINT64_MAX;
+    for (int r = 0; r < RATE_SKETCH_ROWS; r++) {
+        cells[r] = ((size_t)r << sketch->bits) + (size_t)((key * seeds[r]) >> (64 - sketch->bits));
+        uint64_t tat = sketch->tat[cells[r]];
+        if (tat < estimate) {
+            estimate = tat;
+        }
+    }
+    return estimate > now ? estimate : now;
+}
+
+static inline int rate_sketch_allows(const struct rate_sketch *sketch, uint64_t estimate, uint64_t now) {
+    return estimate + sketch->interval_ns - now <= sketch->burst_ns;
+}
+
+// Cobra un mensaje a la clave estimada en 'estimate'. Actualización
+// conservadora: ninguna celda sube por encima de lo que necesita esta clave,
+// así las claves que comparten celda se penalizan lo menos posible.
+static inline void rate_sketch_charge(struct rate_sketch *sketch, const size_t cells[RATE_SKETCH_ROWS],
+                                      uint64_t estimate) {
+    uint64_t tat = estimate + sketch->interval_ns;
+    for (int r = 0; r < RATE_SKETCH_ROWS; r++) {
+        if (sketch->tat[cells[r]] < tat) {
+            sketch->tat[cells[r]] = tat;
+        }
+    }
+}
+
+// Decide si un datagrama recibido en 'now' (ns) pasa al manejador. Cada MAC
+// tiene su límite para cualquier mensaje; además los DISCOVER, que son los que
+// reservan direcciones, comparten un límite por giaddr. Un mensaje solo se cobra
+// si pasa los dos, así que lo descartado no consume el límite de nadie. Los
+// paquetes demasiado cortos pasan y el manejador los cuenta como inválidos.
+static int admit_request(struct admission *admission, const struct dhcp_packet *packet, ssize_t len, uint64_t now) {
+    if (len < (ssize_t)(offsetof(struct dhcp_packet, chaddr) + 6)) {
+        return 1;
+    }
+    size_t mac_cells[RATE_SKETCH_ROWS], relay_cells[RATE_SKETCH_ROWS];
+    uint64_t mac_estimate = 0, relay_estimate = 0;
+    if (admission->mac.interval_ns != 0) {
+        mac_estimate = rate_sketch_estimate(&admission->mac, mac_key(packet->chaddr), now, mac_cells);
+        if (!rate_sketch_allows(&admission->mac, mac_estimate, now)) {
+            metrics_add(&admission->dropped_mac, 1);
+            LOG(LOG_DEBUG, "Mensaje de %M descartado: supera el límite por MAC.", packet->chaddr);
+            return 0;
+        }
+    }
+    int relay_limited = 0;
+    if (admission->relay.interval_ns != 0) {
+        struct dhcp_options options;
+        if (dhcp_options_parse_packet(&options, packet, len) != DHCP_OPTIONS_BAD_HEADER &&
+            dhcp_message_type(&options) == DHCP_DISCOVER) {
+            relay_limited = 1;
+            relay_estimate = rate_sketch_estimate(&admission->relay, packet->giaddr, now, relay_cells);
+            if (!rate_sketch_allows(&admission->relay, relay_estimate, now)) {
+                metrics_add(&admission->dropped_relay, 1);
+                LOG(LOG_DEBUG, "DISCOVER de %M descartado: supera el límite del relay %I.", packet->chaddr,
+                    packet->giaddr);
+                return 0;
+            }
+        }
+    }
+    if (admission->mac.interval_ns != 0) {
+        rate_sketch_charge(&admission->mac, mac_cells, mac_estimate);
+    }
+    if (relay_limited) {
+        rate_sketch_charge(&admission->relay, relay_cells, relay_estimate);
+    }
+    return 1;
+}
+
+// Dirección local (orden de red) por la que llegó un datagrama, según
+// IP_PKTINFO; 0 si no consta
+static uint32_t packet_local_addr(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            return info.ipi_spec_dst.s_addr;
+        }
+    }
+    return 0;
+}
+
+// Anillo preasignado de buffers para el modo por lotes (recvmmsg/sendmmsg)
+struct batch_ring {
+    int size;
+    struct dhcp_packet *rx;
+    struct dhcp_packet *tx;
+    struct sockaddr_in *addrs;
+    uint8_t *control;  // Datos auxiliares IP_PKTINFO de cada datagrama recibido
+    struct iovec *rx_iov;
+    struct iovec *tx_iov;
+    struct mmsghdr *rx_msgs;
+    struct mmsghdr *tx_msgs;
+};
+
+int batch_ring_init(struct batch_ring *ring, int size) {
+    ring->size = size;
+    ring->rx = calloc(size, sizeof(struct dhcp_packet));
+    ring->tx = calloc(size, sizeof(struct dhcp_packet));
+    ring->addrs = calloc(size, sizeof(struct sockaddr_in));
+    ring->control = calloc(size, PKTINFO_CONTROL_LEN);
+    ring->rx_iov = calloc(size, sizeof(struct iovec));
+    ring->tx_iov = calloc(size, sizeof(struct iovec));
+    ring->rx_msgs = calloc(size, sizeof(struct mmsghdr));
+    ring->tx_msgs = calloc(size, sizeof(struct mmsghdr));
+    if (!ring->rx || !ring->tx || !ring->addrs || !ring->control || !ring->rx_iov || !ring->tx_iov || !ring->rx_msgs || !ring->tx_msgs) {
+        return -1;
+    }
+    for (int i = 0; i < size; i++) {
+        ring->rx_iov[i].iov_base = &ring->rx[i];
+        ring->rx_iov[i].iov_len = sizeof(struct dhcp_packet);
+        ring->rx_msgs[i].msg_hdr.msg_iov = &ring->rx_iov[i];
+        ring->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        ring->rx_msgs[i].msg_hdr.msg_name = &ring->addrs[i];
+        ring->rx_msgs[i].msg_hdr.msg_control = ring->control + (size_t)i * PKTINFO_CONTROL_LEN;
+        ring->tx_iov[i].iov_base = &ring->tx[i];
+        ring->tx_msgs[i].msg_hdr.msg_iov = &ring->tx_iov[i];
+        ring->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        ring->tx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    return 0;
+}
+
+// Vacía el socket por lotes: recibe hasta ring->size datagramas por llamada,
+// descarta los que superan su límite de admisión, procesa el resto en este
+// hilo y envía todas las respuestas con un solo sendmmsg.
+void process_batches(int sock, struct batch_ring *ring, struct worker_stats *stats, struct admission *admission) {
+    int received;
+    do {
+        for (int i = 0; i < ring->size; i++) {
+            ring->rx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            ring->rx_msgs[i].msg_hdr.msg_controllen = PKTINFO_CONTROL_LEN;
+        }
+        received = recvmmsg(sock, ring->rx_msgs, ring->size, MSG_DONTWAIT, NULL);
+        metrics_add(&stats->syscalls, 1);
+        if (received <= 0) {
+            if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Error al recibir lote");
+            }
+            return;
+        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        metrics_add(&stats->batches, 1);
+        metrics_add(&stats->batched, received);
+
+        uint64_t now = timespec_ns(&start);
+        int replies = 0;
+        for (int i = 0; i < received; i++) {
+            if (!admit_request(admission, &ring->rx[i], ring->rx_msgs[i].msg_len, now)) {
+                continue;  // Supera su límite: se descarta sin llegar al manejador
+            }
+            size_t len = process_dhcp_request(&ring->rx[i], ring->rx_msgs[i].msg_len,
+                                              packet_local_addr(&ring->rx_msgs[i].msg_hdr), &ring->tx[replies]);
+            if (len == 0) {
+                continue;
+            }
+            ring->tx_iov[replies].iov_len = len;
+            ring->tx_msgs[replies].msg_hdr.msg_name = &ring->addrs[i];
+            replies++;
+        }
+
+        journal_wait_durable();  // Un solo commit en grupo para todos los ACK del lote
+        int sent = 0;
+        while (sent < replies) {
+            int n = sendmmsg(sock, ring->tx_msgs + sent, replies - sent, 0);
+            metrics_add(&stats->syscalls, 1);
+            if (n < 0) {
+                perror("Error al enviar lote de respuestas");
+                break;
+            }
+            sent += n;
+        }
+        for (int i = 0; i < sent && log_enabled(LOG_DEBUG); i++) {
+            print_reply_sent(&ring->tx[i]);
+        }
+
+        // La latencia por paquete se aproxima con la del lote completo
+        uint64_t ns = elapsed_ns(&start);
+        metrics_add(&stats->handled, received);
+        metrics_add(&stats->latency[latency_bucket(ns)], received);
+    } while (received == ring->size);
+}
+
+// Bucle de cada hilo trabajador: toma solicitudes de la cola hasta que el proceso termina
+void *worker_main(void *arg) {
+    int id = (int)(intptr_t)arg;
+    struct worker_stats *stats = &worker_stats[id];
+    thread_stats = stats;
+
+    // Fijar el trabajador a un núcleo para conservar la caché caliente
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(id % ncpus, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while (1) {
+        if (sem_wait(&request_queue.items) < 0) {
+            continue;  // Interrumpido por una señal
+        }
+        size_t pos;
+        struct queue_slot *slot;
+        while ((slot = queue_take(&request_queue, &pos)) == NULL) {
+            sched_yield();  // El productor aún no ha publicado la ranura
+        }
+        // La ranura queda libre en cuanto se lee el índice; el buffer es del trabajador hasta devolverlo
+        uint32_t handle = slot->buffer;
+        queue_release(&request_queue, slot, pos);
+        if (handle == SLAB_NONE) {
+            continue;
+        }
+        struct packet_buffer *buffer = &packet_slab.buffers[handle];
+        if (buffer->request.recv_len <= 0) {
+            slab_put(&packet_slab, handle);
+            continue;
+        }
+        handle_client_request(buffer);
+        uint64_t ns = elapsed_ns(&buffer->request.recv_time);
+        slab_put(&packet_slab, handle);
+
+        metrics_add(&stats->handled, 1);
+        metrics_add(&stats->latency[latency_bucket(ns)], 1);
+    }
+    return NULL;
+}
+
+// Informa de la memoria de las tablas de leases y de lo que cuesta cada lease en uso
+void report_lease_memory(void) {
+    size_t memory = 0, used = 0, reserved = 0;
+    for (int p = 0; p < pool_count; p++) {
+        memory += pool_memory(&lease_pools[p]);
+        used += __atomic_load_n(&lease_pools[p].leases.used, __ATOMIC_RELAXED);
+        reserved += __atomic_load_n(&lease_pools[p].leases.capacity, __ATOMIC_RELAXED);
+    }
+    LOG(LOG_INFO, "[stats] leases: %zu en uso, %zu entradas reservadas, %.1f MB, %.1f bytes por lease en uso",
+        used, reserved, memory / 1048576.0, used > 0 ? (double)memory / used : 0.0);
+}
+
+// Imprime paquetes por segundo y latencia p99 desde el último reporte
+void report_stats(double seconds) {
+    static unsigned long last_handled, last_dropped, last_syscalls;
+    static unsigned long last_latency[LAT_BUCKETS];
+    unsigned long handled = 0, window[LAT_BUCKETS] = {0}, window_total = 0;
+    unsigned long syscalls = metrics_read(&receiver_syscalls);
+
+    for (int w = 0; w < stats_slots; w++) {
+        handled += atomic_load_explicit(&worker_stats[w].handled, memory_order_relaxed);
+        syscalls += metrics_read(&worker_stats[w].syscalls);
+        for (int b = 0; b < LAT_BUCKETS; b++) {
+            window[b] += atomic_load_explicit(&worker_stats[w].latency[b], memory_order_relaxed);
+        }
+    }
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        unsigned long total = window[b];
+        window[b] -= last_latency[b];
+        last_latency[b] = total;
+        window_total += window[b];
+    }
+
+    uint64_t p99 = 0;
+    unsigned long seen = 0, target = window_total - window_total / 100;
+    for (int b = 0; b < LAT_BUCKETS && window_total > 0; b++) {
+        seen += window[b];
+        if (seen >= target) {
+            p99 = latency_bucket_value(b);
+            break;
+        }
+    }
+
+    static unsigned long last_limited;
+    unsigned long dropped = atomic_load_explicit(&request_queue.dropped, memory_order_relaxed), limited = 0;
+    for (int a = 0; a < admission_count; a++) {
+        limited += metrics_read(&admissions[a].dropped_mac) + metrics_read(&admissions[a].dropped_relay);
+    }
+    LOG(LOG_INFO, "[stats] %.0f paquetes/s, p99 %.1f us, descartados %lu, limitados %lu, %.2f llamadas/paquete",
+           (handled - last_handled) / seconds, p99 / 1000.0, dropped - last_dropped, limited - last_limited,
+           handled > last_handled ? (double)(syscalls - last_syscalls) / (handled - last_handled) : 0.0);
+    last_handled = handled;
+    last_syscalls = syscalls;
+    last_dropped = dropped;
+    last_limited = limited;
+    report_lease_memory();
+
+    static unsigned long last_offers_expired;
+    unsigned long offers = 0, declined = 0, offers_expired = 0;
+    for (int p = 0; p < pool_count; p++) {
+        offers += __atomic_load_n(&lease_pools[p].offers, __ATOMIC_RELAXED);
+        declined += __atomic_load_n(&lease_pools[p].declined, __ATOMIC_RELAXED);
+        offers_expired += metrics_read(&lease_pools[p].offers_expired);
+    }
+    LOG(LOG_INFO, "[stats] ofertas: %lu pendientes, %lu vencidas sin REQUEST, %lu IPs en cuarentena", offers,
+        offers_expired - last_offers_expired, declined);
+    last_offers_expired = offers_expired;
+
+    // Un aviso por reporte en lugar de uno por DISCOVER: con el pool agotado
+    // una inundación de DISCOVER llenaría los anillos del registro
+    static unsigned long last_exhausted;
+    unsigned long exhausted = 0;
+    for (int w = 0; w < stats_slots; w++) {
+        exhausted += metrics_read(&worker_stats[w].counters[CNT_EXHAUSTED]);
+    }
+    if (exhausted > last_exhausted) {
+        LOG(LOG_WARN, "[stats] %lu DISCOVER sin dirección libre que ofrecer (pool agotado o tabla llena)",
+            exhausted - last_exhausted);
+    }
+    last_exhausted = exhausted;
+
+    if (journal_dir != NULL) {
+        static unsigned long last_written, last_syncs;
+        unsigned long written = 0, syncs = 0;
+        for (int p = 0; p < pool_count; p++) {
+            written += atomic_load_explicit(&lease_pools[p].journal.written, memory_order_relaxed);
+            syncs += atomic_load_explicit(&lease_pools[p].journal.syncs, memory_order_relaxed);
+        }
+        LOG(LOG_INFO, "[stats] diario: %.0f registros/s, %.0f fdatasync/s",
+               (written - last_written) / seconds, (syncs - last_syncs) / seconds);
+        last_written = written;
+        last_syncs = syncs;
+    }
+
+    if (config.batch_size > 0) {
+        static unsigned long last_batches, last_packets;
+        unsigned long batches = 0, packets = 0;
+        for (int w = 0; w < stats_slots; w++) {
+            batches += atomic_load_explicit(&worker_stats[w].batches, memory_order_relaxed);
+            packets += atomic_load_explicit(&worker_stats[w].batched, memory_order_relaxed);
+        }
+        if (batches > last_batches) {
+            LOG(LOG_INFO, "[stats] lote medio %.1f de %d datagramas (%lu lotes)",
+                   (double)(packets - last_packets) / (batches - last_batches), config.batch_size, batches - last_batches);
+        }
+        last_batches = batches;
+        last_packets = packets;
+    }
+}
+
+// Escribe todas las métricas en formato de texto de Prometheus. Suma los
+// contadores de cada hilo en el momento de la consulta; el estado de los
+// pools se lee sin tomar sus mutex (valores aproximados, nunca bloquea).
+void write_server_metrics(FILE *out) {
+    static const struct { enum server_counter counter; const char *label; } received[] = {
+        { CNT_DISCOVER, "type=\"discover\"" }, { CNT_REQUEST, "type=\"request\"" },
+        { CNT_RELEASE, "type=\"release\"" }, { CNT_DECLINE, "type=\"decline\"" },
+        { CNT_OTHER, "type=\"other\"" }, { CNT_INVALID, "type=\"invalid\"" },
+    };
+    static const struct { enum server_counter counter; const char *label; } replies[] = {
+        { CNT_OFFER, "type=\"offer\"" }, { CNT_ACK, "type=\"ack\"" }, { CNT_NAK, "type=\"nak\"" },
+    };
+    uint64_t counters[CNT_COUNT] = {0}, handled = 0, syscalls = metrics_read(&receiver_syscalls);
+    uint64_t lock_wait[METRICS_HIST_BUCKETS] = {0}, lock_wait_sum = 0;
+    uint64_t latency[METRICS_HIST_BUCKETS] = {0}, latency_sum = 0;
+    uint64_t alloc_probes[HASH_MAX_PROBES + 1] = {0};
+    for (int w = 0; w < stats_slots; w++) {
+        struct worker_stats *stats = &worker_stats[w];
+        for (int p = 0; p <= HASH_MAX_PROBES; p++) {
+            alloc_probes[p] += metrics_read(&stats->alloc_probes[p]);
+        }
+        for (int i = 0; i < CNT_COUNT; i++) {
+            counters[i] += metrics_read(&stats->counters[i]);
+        }
+        handled += metrics_read(&stats->handled);
+        syscalls += metrics_read(&stats->syscalls);
+        metrics_merge(&stats->lock_wait, lock_wait, &lock_wait_sum);
+        // El histograma log-lineal del trabajador se agrupa en potencias de 2
+        for (int b = 0; b < LAT_BUCKETS; b++) {
+            uint64_t n = metrics_read(&stats->latency[b]);
+            if (n > 0) {
+                uint64_t value = latency_bucket_value(b);
+                latency[metrics_bucket(value)] += n;
+                latency_sum += n * value;
+            }
+        }
+    }
+
+    metrics_write_header(out, "dhcp_messages_received_total", "counter", "DHCP messages received, by message type.");
+    for (size_t i = 0; i < sizeof(received) / sizeof(received[0]); i++) {
+        metrics_write_value(out, "dhcp_messages_received_total", received[i].label, counters[received[i].counter]);
+    }
+    metrics_write_header(out, "dhcp_replies_total", "counter", "DHCP replies built, by message type.");
+    for (size_t i = 0; i < sizeof(replies) / sizeof(replies[0]); i++) {
+        metrics_write_value(out, "dhcp_replies_total", replies[i].label, counters[replies[i].counter]);
+    }
+    metrics_write_header(out, "dhcp_requests_unanswered_total", "counter", "Requests that produced no reply.");
+    metrics_write_value(out, "dhcp_requests_unanswered_total", NULL, counters[CNT_UNANSWERED]);
+    metrics_write_header(out, "dhcp_pool_exhausted_total", "counter", "DISCOVERs that found no free address.");
+    metrics_write_value(out, "dhcp_pool_exhausted_total", NULL, counters[CNT_EXHAUSTED]);
+    metrics_write_header(out, "dhcp_requests_no_subnet_total", "counter", "Relayed requests whose giaddr matches no subnet.");
+    metrics_write_value(out, "dhcp_requests_no_subnet_total", NULL, counters[CNT_NO_SUBNET]);
+    uint64_t limited_mac = 0, limited_relay = 0;
+    for (int a = 0; a < admission_count; a++) {
+        limited_mac += metrics_read(&admissions[a].dropped_mac);
+        limited_relay += metrics_read(&admissions[a].dropped_relay);
+    }
+    metrics_write_header(out, "dhcp_requests_rate_limited_total", "counter",
+                         "Packets dropped on receive by admission control, by limit exceeded.");
+    metrics_write_value(out, "dhcp_requests_rate_limited_total", "limit=\"mac\"", limited_mac);
+    metrics_write_value(out, "dhcp_requests_rate_limited_total", "limit=\"relay\"", limited_relay);
+    metrics_write_header(out, "dhcp_packets_handled_total", "counter", "Packets handled by workers or shards.");
+    metrics_write_value(out, "dhcp_packets_handled_total", NULL, handled);
+    metrics_write_header(out, "dhcp_io_syscalls_total", "counter",
+                         "Network I/O system calls on the packet path (waits, receives, sends, io_uring_enter).");
+    metrics_write_value(out, "dhcp_io_syscalls_total", NULL, syscalls);
+    metrics_write_header(out, "dhcp_request_duration_seconds", "histogram",
+                         "Time from receive to reply sent (per batch in batched modes).");
+    metrics_write_histogram(out, "dhcp_request_duration_seconds", NULL, latency, latency_sum);
+
+    metrics_write_header(out, "dhcp_renewals_lockfree_total", "counter", "Renewals acknowledged without taking the pool mutex.");
+    metrics_write_value(out, "dhcp_renewals_lockfree_total", NULL, counters[CNT_RENEWS_LOCKFREE]);
+    metrics_write_header(out, "dhcp_pool_lock_acquisitions_total", "counter", "Pool mutex acquisitions on the request path.");
+    metrics_write_value(out, "dhcp_pool_lock_acquisitions_total", NULL, counters[CNT_LOCKS]);
+    metrics_write_header(out, "dhcp_pool_lock_contended_total", "counter", "Pool mutex acquisitions that had to wait.");
+    metrics_write_value(out, "dhcp_pool_lock_contended_total", NULL, counters[CNT_LOCKS_CONTENDED]);
+    metrics_write_header(out, "dhcp_pool_lock_wait_seconds", "histogram", "Time spent waiting for a contended pool mutex.");
+    metrics_write_histogram(out, "dhcp_pool_lock_wait_seconds", NULL, lock_wait, lock_wait_sum);
+    if (config.alloc_policy != ALLOC_FIRST_FIT) {
+        metrics_write_header(out, "dhcp_alloc_probes_total", "counter",
+                             "Hashed address allocations, by bitmap words probed (scan: fell back to a range scan).");
+        for (int p = 0; p <= HASH_MAX_PROBES; p++) {
+            char label[32];
+            if (p < HASH_MAX_PROBES) {
+                snprintf(label, sizeof(label), "probes=\"%d\"", p + 1);
+            } else {
+                snprintf(label, sizeof(label), "probes=\"scan\"");
+            }
+            metrics_write_value(out, "dhcp_alloc_probes_total", label, alloc_probes[p]);
+        }
+    }
+
+    if (config.shards == 0 && config.batch_size == 0 && raw_port_count == 0) {
+        size_t depth = atomic_load_explicit(&request_queue.enqueue_pos, memory_order_relaxed) -
+                       atomic_load_explicit(&request_queue.dequeue_pos, memory_order_relaxed);
+        metrics_write_header(out, "dhcp_queue_depth", "gauge", "Requests waiting in the worker queue.");
+        metrics_write_value(out, "dhcp_queue_depth", NULL, depth);
+        metrics_write_header(out, "dhcp_queue_capacity", "gauge", "Slots in the worker queue.");
+        metrics_write_value(out, "dhcp_queue_capacity", NULL, config.queue_size);
+        metrics_write_header(out, "dhcp_queue_dropped_total", "counter", "Packets dropped because the queue was full.");
+        metrics_write_value(out, "dhcp_queue_dropped_total", NULL,
+                            atomic_load_explicit(&request_queue.dropped, memory_order_relaxed));
+    }
+
+    static const char *pool_names[] = { "dhcp_pool_capacity", "dhcp_pool_leases", "dhcp_pool_free_addresses",
+                                        "dhcp_pool_pending_offers", "dhcp_pool_declined_addresses" };
+    static const char *pool_help[] = { "Leases the pool may hold.", "Lease entries in use (including offers and quarantined addresses).",
+                                       "Addresses of the pool range not assigned to anyone.",
+                                       "Addresses offered and waiting for a REQUEST.",
+                                       "Addresses quarantined after a DECLINE." };
+    for (int m = 0; m < 5; m++) {
+        metrics_write_header(out, pool_names[m], "gauge", pool_help[m]);
+        for (int p = 0; p < pool_count; p++) {
+            struct lease_pool *pool = &lease_pools[p];
+            char label[64];
+            snprintf(label, sizeof(label), "pool=\"%d\",subnet=\"%s\"", p, subnets[pool->subnet].name);
+            uint32_t value = m == 0 ? pool->leases.max_capacity
+                           : m == 1 ? __atomic_load_n(&pool->leases.used, __ATOMIC_RELAXED)
+                           : m == 2 ? __atomic_load_n(&pool->bitmap.free_count, __ATOMIC_RELAXED)
+                           : m == 3 ? __atomic_load_n(&pool->offers, __ATOMIC_RELAXED)
+                                    : __atomic_load_n(&pool->declined, __ATOMIC_RELAXED);
+            metrics_write_value(out, pool_names[m], label, value);
+        }
+    }
+
+    uint64_t offers_expired = 0;
+    for (int p = 0; p < pool_count; p++) {
+        offers_expired += metrics_read(&lease_pools[p].offers_expired);
+    }
+    metrics_write_header(out, "dhcp_offers_expired_total", "counter", "Offers returned to the free set without a REQUEST.");
+    metrics_write_value(out, "dhcp_offers_expired_total", NULL, offers_expired);
+
+    metrics_write_header(out, "dhcp_pool_memory_bytes", "gauge", "Bytes reserved by the lease table, MAC index, timers and bitmap.");
+    for (int p = 0; p < pool_count; p++) {
+        char label[64];
+        snprintf(label, sizeof(label), "pool=\"%d\",subnet=\"%s\"", p, subnets[lease_pools[p].subnet].name);
+        metrics_write_value(out, "dhcp_pool_memory_bytes", label, pool_memory(&lease_pools[p]));
+    }
+
+    if (journal_dir != NULL) {
+        unsigned long written = 0, syncs = 0;
+        for (int p = 0; p < pool_count; p++) {
+            written += atomic_load_explicit(&lease_pools[p].journal.written, memory_order_relaxed);
+            syncs += atomic_load_explicit(&lease_pools[p].journal.syncs, memory_order_relaxed);
+        }
+        metrics_write_header(out, "dhcp_journal_records_total", "counter", "Lease journal records made durable.");
+        metrics_write_value(out, "dhcp_journal_records_total", NULL, written);
+        metrics_write_header(out, "dhcp_journal_syncs_total", "counter", "fdatasync calls of the lease journal.");
+        metrics_write_value(out, "dhcp_journal_syncs_total", NULL, syncs);
+    }
+}
+
+// Abre un socket UDP en el puerto 67, opcionalmente con SO_REUSEPORT
+int open_server_socket(int reuseport) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("Error al crear socket");
+        exit(1);
+    }
+    int one = 1;
+    if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("Error al activar SO_REUSEPORT");
+        exit(1);
+    }
+    // Saber por qué interfaz llega cada paquete, para elegir la subred de los clientes locales
+    if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one)) < 0) {
+        perror("Error al activar IP_PKTINFO");
+    }
+    if (config.rcvbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &config.rcvbuf, sizeof(config.rcvbuf)) < 0) {
+        perror("Error al configurar SO_RCVBUF");
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Error al enlazar socket");
+        exit(1);
+    }
+    return sock;
+}
+
+// Operaciones del bucle de io_uring, en los 32 bits altos de user_data
+enum uring_op { URING_RECV = 1, URING_SEND, URING_TIMER, URING_METRICS };
+
+// Respuesta enviada con io_uring: debe vivir hasta el completado de su sendmsg
+struct uring_reply {
+    struct dhcp_packet packet;
+    struct sockaddr_in addr;
+    struct iovec iov;
+    struct msghdr msg;
+};
+
+// Bucle de E/S con io_uring de un hilo receptor: el principal (que además
+// informa y sirve métricas si 'reporter') o un fragmento. Los datagramas llegan
+// a los buffers provistos sin una llamada por paquete, se procesan dentro del
+// propio buffer y las respuestas se encolan como sendmsg; cada vuelta es un
+// solo io_uring_enter que envía lo pendiente y espera nuevos completados. El
+// temporizador y el socket de métricas se vigilan con poll en el mismo anillo.
+// Solo vuelve, con -1, si el kernel no admite io_uring o el recvmsg multishot
+// antes de atender ningún paquete; el llamante sigue entonces con su bucle clásico.
+int uring_serve(int sock, int shard, int timer_fd, int metrics_fd, int reporter) {
+    struct worker_stats *stats = &worker_stats[shard];
+    struct admission *admission = &admissions[shard];
+    struct uring ring;
+    if (uring_init(&ring, URING_ENTRIES, URING_BUFFERS * 4) < 0) {
+        return -1;
+    }
+    struct msghdr recv_msg = { .msg_namelen = sizeof(struct sockaddr_in), .msg_controllen = PKTINFO_CONTROL_LEN };
+    size_t buffer_size = URING_PAYLOAD_OFFSET(sizeof(struct sockaddr_in), PKTINFO_CONTROL_LEN) + sizeof(struct dhcp_packet);
+    struct uring_reply *replies = aligned_alloc(64, URING_BUFFERS * sizeof(struct uring_reply));
+    uint32_t *free_replies = malloc(URING_BUFFERS * sizeof(uint32_t));
+    if (replies == NULL || free_replies == NULL || uring_buffers_init(&ring, URING_BUFFERS, buffer_size, 0) < 0) {
+        int saved = errno;
+        free(replies);
+        free(free_replies);
+        uring_close(&ring);
+        errno = saved;
+        return -1;
+    }
+    uint32_t free_count = URING_BUFFERS;
+    for (uint32_t i = 0; i < URING_BUFFERS; i++) {
+        free_replies[i] = i;
+        replies[i].iov.iov_base = &replies[i].packet;
+        memset(&replies[i].msg, 0, sizeof(replies[i].msg));
+        replies[i].msg.msg_name = &replies[i].addr;
+        replies[i].msg.msg_namelen = sizeof(struct sockaddr_in);
+        replies[i].msg.msg_iov = &replies[i].iov;
+        replies[i].msg.msg_iovlen = 1;
+    }
+
+    int recv_armed = 0, timer_armed = 0, metrics_armed = metrics_fd < 0;
+    unsigned sends = 0;  // sendmsg encolados desde la última entrada al kernel
+    uint64_t served = 0;
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    while (1) {
+        // Rearmar lo que el kernel haya dado por terminado (p. ej. recvmsg sin buffers libres)
+        struct io_uring_sqe *sqe;
+        if (!recv_armed && (sqe = uring_get_sqe(&ring)) != NULL) {
+            uring_prep_recvmsg_multishot(sqe, &ring, sock, &recv_msg, URING_DATA(URING_RECV, 0));
+            recv_armed = 1;
+        }
+        if (!timer_armed && (sqe = uring_get_sqe(&ring)) != NULL) {
+            uring_prep_poll_multishot(sqe, timer_fd, URING_DATA(URING_TIMER, 0));
+            timer_armed = 1;
+        }
+        if (!metrics_armed && (sqe = uring_get_sqe(&ring)) != NULL) {
+            uring_prep_poll_multishot(sqe, metrics_fd, URING_DATA(URING_METRICS, 0));
+            metrics_armed = 1;
+        }
+        // Los envíos de UDP se completan durante la propia llamada: esperar
+        // también a sus completados evita una vuelta extra solo para recogerlos
+        journal_wait_durable();
+        metrics_add(&stats->syscalls, 1);
+        int submitted = uring_submit(&ring, sends + 1);
+        sends = 0;
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("Error en io_uring_enter");
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t now = timespec_ns(&start);
+        int received = 0;
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek(&ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            int bid = uring_cqe_buffer(cqe);
+            uring_cqe_seen(&ring);
+
+            if (URING_TAG(data) == URING_SEND) {
+                struct uring_reply *reply = &replies[URING_INDEX(data)];
+                if (res < 0) {
+                    errno = -res;
+                    perror("Error al enviar respuesta DHCP");
+                } else if (log_enabled(LOG_DEBUG)) {
+                    print_reply_sent(&reply->packet);
+                }
+                free_replies[free_count++] = URING_INDEX(data);
+            } else if (URING_TAG(data) == URING_TIMER) {
+                timer_armed = more;
+                uint64_t ticks;
+                if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+                    release_expired_shard(shard, ticks);
+                }
+                uint64_t since_report = elapsed_ns(&last_report);
+                if (reporter && since_report >= STATS_INTERVAL * 1000000000ull) {
+                    report_stats(since_report / 1e9);
+                    clock_gettime(CLOCK_MONOTONIC, &last_report);
+                }
+            } else if (URING_TAG(data) == URING_METRICS) {
+                metrics_armed = more;
+                metrics_serve(metrics_fd, write_server_metrics);
+            } else if (URING_TAG(data) == URING_RECV) {
+                recv_armed = more;
+                if (bid < 0) {
+                    if (res == -EINVAL && served == 0) {
+                        // Kernel sin recvmsg multishot: volver al camino clásico
+                        free(replies);
+                        free(free_replies);
+                        uring_close(&ring);
+                        errno = EINVAL;
+                        return -1;
+                    }
+                    if (res < 0 && res != -ENOBUFS) {
+                        errno = -res;
+                        perror("Error al recibir con io_uring");
+                    }
+                    continue;
+                }
+                served++;
+                received++;
+                struct io_uring_recvmsg_out *out;
+                uint8_t *payload;
+                ssize_t len = uring_recvmsg_parse(uring_buffer(&ring, bid), res, &recv_msg,
+                                                  sizeof(struct dhcp_packet), &out, &payload);
+                struct dhcp_packet *request = (struct dhcp_packet *)payload;
+                if (len < 0 || !admit_request(admission, request, len, now)) {
+                    uring_buffer_recycle(&ring, bid);
+                    continue;
+                }
+                // Con todas las respuestas en vuelo, esta se envía directamente
+                struct dhcp_packet spill;
+                struct dhcp_packet *reply = free_count > 0 ? &replies[free_replies[free_count - 1]].packet : &spill;
+                struct msghdr control = { .msg_control = (uint8_t *)(out + 1) + recv_msg.msg_namelen,
+                                          .msg_controllen = out->controllen };
+                size_t reply_len = process_dhcp_request(request, len, packet_local_addr(&control), reply);
+                struct sockaddr_in *source = (struct sockaddr_in *)(out + 1);
+                if (reply_len > 0 && reply == &spill) {
+                    journal_wait_durable();
+                    metrics_add(&stats->syscalls, 1);
+                    if (sendto(sock, reply, reply_len, 0, (struct sockaddr *)source, sizeof(*source)) < 0) {
+                        perror("Error al enviar respuesta DHCP");
+                    }
+                } else if (reply_len > 0) {
+                    uint32_t r = free_replies[--free_count];
+                    replies[r].addr = *source;
+                    replies[r].iov.iov_len = reply_len;
+                    while ((sqe = uring_get_sqe(&ring)) == NULL) {
+                        journal_wait_durable();
+                        metrics_add(&stats->syscalls, 1);
+                        uring_submit(&ring, 0);  // Anillo de envío lleno: publicar lo encolado
+                        sends = 0;
+                    }
+                    uring_prep_sendmsg(sqe, sock, &replies[r].msg, URING_DATA(URING_SEND, r));
+                    sends++;
+                }
+                uring_buffer_recycle(&ring, bid);
+            }
+        }
+
+        if (received > 0) {
+            // Como en el modo por lotes, la latencia por paquete es la de la vuelta completa
+            uint64_t ns = elapsed_ns(&start);
+            metrics_add(&stats->batches, 1);
+            metrics_add(&stats->batched, received);
+            metrics_add(&stats->handled, received);
+            metrics_add(&stats->latency[latency_bucket(ns)], received);
+        }
+    }
+    return 0;
+}
+
+// Un interfaz en modo captura (-i): socket AF_PACKET con un anillo de
+// recepción TPACKET_V3 (bloques de tramas que el kernel llena y entrega
+// enteros) y un anillo de envío, ambos en una sola proyección compartida
+struct raw_port {
+    char name[IFNAMSIZ];
+    int fd;
+    int ifindex;
+    uint8_t mac[6];
+    uint32_t addr;       // IPv4 del interfaz (orden de red): origen de las respuestas y subred de sus clientes
+    uint8_t *ring;       // Anillo de recepción seguido del de envío
+    size_t ring_len;
+    uint32_t rx_block;   // Siguiente bloque a leer
+    uint32_t tx_frame;   // Siguiente ranura de envío
+    uint32_t tx_queued;  // Tramas marcadas para enviar desde el último aviso al kernel
+};
+
+struct raw_port raw_ports[RAW_MAX_INTERFACES];
+
+// Abre el interfaz 'name' en modo captura. El socket nace sin protocolo (no
+// recibe nada) y solo se liga a ETH_P_IP con el filtro y los anillos ya
+// puestos, así que nunca llega una trama sin filtrar.
+int raw_port_open(struct raw_port *port, const char *name) {
+    memset(port, 0, sizeof(*port));
+    snprintf(port->name, sizeof(port->name), "%s", name);
+    port->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (port->fd < 0) {
+        perror("Error al crear el socket de captura");
+        return -1;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+    if (ioctl(port->fd, SIOCGIFINDEX, &ifr) < 0) {
+        fprintf(stderr, "Interfaz desconocido: %s\n", name);
+        return -1;
+    }
+    port->ifindex = ifr.ifr_ifindex;
+    if (ioctl(port->fd, SIOCGIFHWADDR, &ifr) < 0) {
+        perror("Error al leer la MAC del interfaz");
+        return -1;
+    }
+    memcpy(port->mac, ifr.ifr_hwaddr.sa_data, 6);
+    ifr.ifr_addr.sa_family = AF_INET;
+    if (ioctl(port->fd, SIOCGIFADDR, &ifr) < 0) {
+        fprintf(stderr, "El interfaz %s no tiene dirección IPv4\n", name);
+        return -1;
+    }
+    port->addr = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+
+    int version = TPACKET_V3, one = 1;
+    if (setsockopt(port->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+        setsockopt(port->fd, SOL_PACKET, PACKET_TX_HAS_OFF, &one, sizeof(one)) < 0) {
+        perror("Error al configurar TPACKET_V3");
+        return -1;
+    }
+    // Las respuestas no pasan por la disciplina de colas (si el kernel lo permite)
+    setsockopt(port->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    if (raw_attach_udp_filter(port->fd, RAW_ETH_LEN, SERVER_PORT) < 0) {
+        perror("Error al fijar el filtro BPF");
+        return -1;
+    }
+    struct tpacket_req3 rx = { RAW_BLOCK_SIZE, RAW_RX_BLOCKS, RAW_FRAME_SIZE,
+                               RAW_RX_BLOCKS * (RAW_BLOCK_SIZE / RAW_FRAME_SIZE), RAW_BLOCK_TIMEOUT_MS, 0, 0 };
+    struct tpacket_req3 tx = { RAW_BLOCK_SIZE, RAW_TX_BLOCKS, RAW_FRAME_SIZE, RAW_TX_FRAMES, 0, 0, 0 };
+    if (setsockopt(port->fd, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx)) < 0 ||
+        setsockopt(port->fd, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx)) < 0) {
+        perror("Error al crear los anillos de captura");
+        return -1;
+    }
+    port->ring_len = (size_t)(RAW_RX_BLOCKS + RAW_TX_BLOCKS) * RAW_BLOCK_SIZE;
+    port->ring = mmap(NULL, port->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, port->fd, 0);
+    if (port->ring == MAP_FAILED) {
+        perror("Error al proyectar los anillos de captura");
+        return -1;
+    }
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = port->ifindex;
+    if (bind(port->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Error al enlazar el socket de captura");
+        return -1;
+    }
+    return 0;
+}
+
+// Avisa al kernel de que envíe las tramas marcadas en el anillo de envío
+static void raw_flush(struct raw_port *port, struct worker_stats *stats) {
+    if (port->tx_queued == 0) {
+        return;
+    }
+    journal_wait_durable();
+    metrics_add(&stats->syscalls, 1);
+    if (send(port->fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        perror("Error al enviar el anillo de respuestas");
+    }
+    port->tx_queued = 0;
+}
+
+// Siguiente ranura libre del anillo de envío, o NULL si todas siguen pendientes
+static struct tpacket3_hdr *raw_tx_slot(struct raw_port *port, struct worker_stats *stats) {
+    struct tpacket3_hdr *slot = (struct tpacket3_hdr *)(port->ring + (size_t)RAW_RX_BLOCKS * RAW_BLOCK_SIZE +
+                                                        (size_t)port->tx_frame * RAW_FRAME_SIZE);
+    uint32_t status = __atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE);
+    if (status == TP_STATUS_SEND_REQUEST || status == TP_STATUS_SENDING) {
+        raw_flush(port, stats);  // Anillo lleno: que el kernel vacíe lo que tiene
+        status = __atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE);
+        if (status == TP_STATUS_SEND_REQUEST || status == TP_STATUS_SENDING) {
+            return NULL;
+        }
+    }
+    return slot;  // TP_STATUS_AVAILABLE, o TP_STATUS_WRONG_FORMAT de un envío rechazado
+}
+
+// Atiende una trama recibida en 'port', leída en su sitio. Si la petición
+// viene de 0.0.0.0 (un cliente sin dirección) la respuesta se construye
+// directamente en una ranura del anillo de envío, como broadcast o dirigida a
+// la MAC del cliente según el bit de broadcast; si viene de una dirección IP
+// (un relay o una renovación) se responde por el socket UDP, como en modo socket.
+static void raw_handle_frame(struct raw_port *port, struct tpacket3_hdr *frame, int udp_sock,
+                             struct worker_stats *stats, uint64_t now) {
+    const struct sockaddr_ll *link = (const struct sockaddr_ll *)((uint8_t *)frame +
+                                                                  TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    struct raw_datagram datagram;
+    if (link->sll_pkttype == PACKET_OUTGOING || link->sll_pkttype == PACKET_OTHERHOST || frame->tp_net < frame->tp_mac ||
+        raw_parse_ipv4_udp((uint8_t *)frame + frame->tp_net, frame->tp_snaplen - (frame->tp_net - frame->tp_mac),
+                           &datagram) < 0 || datagram.dst_port != htons(SERVER_PORT)) {
+        return;
+    }
+    struct dhcp_packet *request = (struct dhcp_packet *)datagram.payload;
+    size_t len = datagram.len < sizeof(struct dhcp_packet) ? datagram.len : sizeof(struct dhcp_packet);
+    if (!admit_request(&admissions[0], request, len, now)) {
+        return;
+    }
+
+    if (datagram.src != 0) {
+        struct dhcp_packet reply;
+        size_t reply_len = process_dhcp_request(request, len, port->addr, &reply);
+        struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = datagram.src_port,
+                                  .sin_addr.s_addr = datagram.src };
+        if (reply_len > 0) {
+            journal_wait_durable();
+            metrics_add(&stats->syscalls, 1);
+            if (sendto(udp_sock, &reply, reply_len, 0, (struct sockaddr *)&to, sizeof(to)) < 0) {
+                perror("Error al enviar respuesta DHCP");
+            } else {
+                print_reply_sent(&reply);
+            }
+        }
+        return;
+    }
+
+    struct tpacket3_hdr *slot = raw_tx_slot(port, stats);
+    if (slot == NULL) {
+        return;  // Anillo de envío lleno: el cliente retransmitirá
+    }
+    uint8_t *out = (uint8_t *)slot + RAW_TX_DATA_OFFSET;
+    struct dhcp_packet *reply = (struct dhcp_packet *)(out + RAW_ETH_LEN + RAW_HEADERS_LEN);
+    size_t reply_len = process_dhcp_request(request, len, port->addr, reply);
+    if (reply_len == 0) {
+        return;  // La ranura sigue libre
+    }
+    // Un NAK (sin yiaddr) siempre va como broadcast (RFC 2131, 4.1)
+    static const uint8_t broadcast_mac[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    int broadcast = (request->flags & htons(RAW_BROADCAST_FLAG)) != 0 || reply->yiaddr == 0;
+    memcpy(out, broadcast ? broadcast_mac : request->chaddr, 6);
+    memcpy(out + 6, port->mac, 6);
+    out[12] = RAW_ETHERTYPE_IP >> 8;
+    out[13] = RAW_ETHERTYPE_IP & 0xFF;
+    raw_build_ipv4_udp(out + RAW_ETH_LEN, port->addr, broadcast ? INADDR_BROADCAST : reply->yiaddr, SERVER_PORT,
+                       CLIENT_PORT, reply_len);
+    slot->tp_len = RAW_ETH_LEN + RAW_HEADERS_LEN + reply_len;
+    slot->tp_mac = RAW_TX_DATA_OFFSET;
+    slot->tp_next_offset = 0;
+    __atomic_store_n(&slot->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    port->tx_frame = (port->tx_frame + 1) % RAW_TX_FRAMES;
+    port->tx_queued++;
+    print_reply_sent(reply);
+}
+
+// Procesa los bloques que el kernel ya ha entregado en el anillo de recepción
+// de 'port' y los devuelve. Devuelve el número de tramas atendidas.
+static int raw_receive(struct raw_port *port, int udp_sock, struct worker_stats *stats, uint64_t now) {
+    int handled = 0;
+    while (1) {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *)(port->ring +
+                                                                         (size_t)port->rx_block * RAW_BLOCK_SIZE);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            return handled;
+        }
+        uint32_t count = block->hdr.bh1.num_pkts;
+        struct tpacket3_hdr *frame = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+        for (uint32_t i = 0; i < count; i++) {
+            raw_handle_frame(port, frame, udp_sock, stats, now);
+            frame = (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+        }
+        handled += count;
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        port->rx_block = (port->rx_block + 1) % RAW_RX_BLOCKS;
+    }
+}
+
+// Bucle del modo captura en el hilo principal: un poll() sobre los sockets de
+// todos los interfaces, el temporizador y las métricas. Cada vuelta vacía los
+// bloques listos de cada anillo y avisa una vez a cada interfaz con respuestas
+// pendientes en su anillo de envío. El socket UDP solo se usa para enviar.
+void raw_serve(int udp_sock, int timer_fd, int metrics_fd) {
+    struct worker_stats *stats = &worker_stats[0];
+    struct pollfd fds[RAW_MAX_INTERFACES + 2];
+    for (int i = 0; i < raw_port_count; i++) {
+        fds[i] = (struct pollfd){ raw_ports[i].fd, POLLIN, 0 };
+    }
+    fds[raw_port_count] = (struct pollfd){ timer_fd, POLLIN, 0 };
+    fds[raw_port_count + 1] = (struct pollfd){ metrics_fd, POLLIN, 0 };  // Con fd -1, poll() lo ignora
+
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    while (1) {
+        metrics_add(&stats->syscalls, 1);
+        if (poll(fds, raw_port_count + 2, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll error");
+            }
+            continue;
+        }
+        if (fds[raw_port_count].revents & POLLIN) {
+            uint64_t ticks;
+            if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+                release_expired_shard(0, ticks);
+            }
+            uint64_t since_report = elapsed_ns(&last_report);
+            if (since_report >= STATS_INTERVAL * 1000000000ull) {
+                report_stats(since_report / 1e9);
+                clock_gettime(CLOCK_MONOTONIC, &last_report);
+            }
+        }
+        if (fds[raw_port_count + 1].revents & POLLIN) {
+            metrics_serve(metrics_fd, write_server_metrics);
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int received = 0;
+        for (int i = 0; i < raw_port_count; i++) {
+            if (fds[i].revents != 0) {
+                received += raw_receive(&raw_ports[i], udp_sock, stats, timespec_ns(&start));
+            }
+        }
+        for (int i = 0; i < raw_port_count; i++) {
+            raw_flush(&raw_ports[i], stats);
+        }
+        if (received > 0) {
+            // Como en el modo por lotes, la latencia por paquete es la de la vuelta completa
+            uint64_t ns = elapsed_ns(&start);
+            metrics_add(&stats->batches, 1);
+            metrics_add(&stats->batched, received);
+            metrics_add(&stats->handled, received);
+            metrics_add(&stats->latency[latency_bucket(ns)], received);
+        }
+    }
+}
+
+// Filtro BPF clásico para el grupo SO_REUSEPORT: entrega cada paquete al socket
+// del fragmento dueño de su MAC (bytes 2..5 de chaddr módulo el número de
+// fragmentos), igual que shard_of_mac(). Los datos empiezan tras la cabecera UDP.
+int attach_shard_filter(int sock, int shards) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct dhcp_packet, chaddr) + 2),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)shards),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+struct shard {
+    int id;
+    int sock;
+    struct batch_ring ring;
+};
+
+// Bucle de eventos de un fragmento: su propio socket, su rueda de leases y sus
+// estadísticas. Los paquetes de MACs de otro fragmento solo toman el mutex de ese pool.
+void *shard_main(void *arg) {
+    struct shard *shard = arg;
+    thread_stats = &worker_stats[shard->id];
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->id % ncpus, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        perror("Error al crear timerfd");
+        return NULL;
+    }
+    struct itimerspec tick = { { 1, 0 }, { 1, 0 } };
+    timerfd_settime(timer_fd, 0, &tick, NULL);
+    if (config.uring && uring_serve(shard->sock, shard->id, timer_fd, -1, 0) < 0) {
+        perror("Aviso: io_uring no disponible en el fragmento, se usa recvmmsg");
+    }
+    int maxfd = shard->sock > timer_fd ? shard->sock : timer_fd;
+
+    while (1) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(shard->sock, &read_fds);
+        FD_SET(timer_fd, &read_fds);
+
+        metrics_add(&worker_stats[shard->id].syscalls, 1);
+        if (select(maxfd + 1, &read_fds, NULL, NULL, NULL) < 0) {
+            if (errno != EINTR) {
+                perror("select error");
+            }
+            continue;
+        }
+        if (FD_ISSET(timer_fd, &read_fds)) {
+            uint64_t ticks;
+            if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+                release_expired_shard(shard->id, ticks);
+            }
+        }
+        if (FD_ISSET(shard->sock, &read_fds)) {
+            process_batches(shard->sock, &shard->ring, &worker_stats[shard->id], &admissions[shard->id]);
+        }
+    }
+    return NULL;
+}
+
+// Reproduce una traza (pcap o sintética) contra el núcleo del protocolo en el
+// hilo principal, sin sockets: los paquetes dirigidos al puerto del servidor
+// pasan por el control de admisión y process_dhcp_request(), y el tiempo de la
+// traza hace avanzar las ruedas de leases. Informa de paquetes por segundo,
+// reservas de memoria por paquete y un resumen de las respuestas que sirve de
+// prueba de regresión: la misma traza y configuración dan siempre el mismo.
+// Con 'check_heap' la traza se reproduce dos veces, la segunda desplazada en el
+// tiempo: la primera hace crecer las tablas y la segunda (mismos clientes
+// renovando) es el régimen estable, que no debe reservar nada; si lo hace,
+// devuelve 2.
+int run_replay(const char *spec, int check_heap) {
+    struct replay_trace trace;
+    if (replay_open(&trace, spec, SERVER_PORT) < 0) {
+        replay_close(&trace);
+        return 1;
+    }
+    struct worker_stats *stats = &worker_stats[0];
+    thread_stats = stats;  // El hilo principal hace de único trabajador
+    struct dhcp_packet request, reply;
+    uint64_t hash = REPLAY_HASH_INIT, processed = 0, skipped = 0, answered = 0, next_tick = 1000000000ull;
+
+    LOG(LOG_INFO, "Reproduciendo %zu paquetes de %s.", trace.count, spec);
+    int passes = check_heap ? 2 : 1;
+    uint64_t span = trace.count > 0 ? trace.packets[trace.count - 1].time_ns + 1000000000ull : 0;
+    if (check_heap) {
+        // La segunda pasada empieza cuando ya han vencido todos los leases,
+        // ofertas y cuarentenas de la primera: sus clientes vuelven como nuevos
+        // y recorren find_free_ip, assign_ip_to_client y el alta y la baja en
+        // el índice MAC, no solo las renovaciones
+        uint32_t longest = config.offer_ttl > DECLINE_PROBATION ? config.offer_ttl : DECLINE_PROBATION;
+        for (int s = 0; s < subnet_count; s++) {
+            longest = subnets[s].lease_time > longest ? subnets[s].lease_time : longest;
+        }
+        span += (longest + 2) * 1000000000ull;
+    }
+    int64_t allocations = replay_allocation_count();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t k = 0; k < trace.count * passes; k++) {
+        const struct replay_packet *packet = &trace.packets[k % trace.count];
+        uint64_t time_ns = packet->time_ns + k / trace.count * span;
+        if (k == trace.count && check_heap) {
+            allocations = replay_allocation_count();  // Empieza el régimen estable
+        }
+        // Un tick de la rueda por cada segundo de traza transcurrido
+        for (; time_ns >= next_tick; next_tick += 1000000000ull) {
+            for (int s = 0; s < shard_count; s++) {
+                release_expired_shard(s, 1);
+            }
+        }
+        if (packet->dst_port != htons(SERVER_PORT) || packet->len == 0 || packet->data[0] != 1) {
+            skipped++;  // Respuestas y tráfico de otros puertos
+            continue;
+        }
+        size_t len = packet->len < sizeof(request) ? packet->len : sizeof(request);
+        memcpy(&request, packet->data, len);  // Como si llegara al buffer de recepción
+        processed++;
+        struct admission *admission = &admissions[config.shards > 0 ? shard_of_mac(request.chaddr) : 0];
+        if (!admit_request(admission, &request, len, time_ns)) {
+            continue;
+        }
+        size_t reply_len = process_dhcp_request(&request, len, packet->dst_addr, &reply);
+        if (reply_len > 0) {
+            hash = replay_hash(hash, &reply, reply_len);
+            answered++;
+        }
+    }
+    uint64_t ns = elapsed_ns(&start);
+    if (allocations >= 0) {
+        allocations = replay_allocation_count() - allocations;
+    }
+    metrics_add(&stats->handled, processed);
+    uint64_t dropped = 0;
+    for (int a = 0; a < admission_count; a++) {
+        dropped += metrics_read(&admissions[a].dropped_mac) + metrics_read(&admissions[a].dropped_relay);
+    }
+
+    // El informe va directo a stdout, después de lo que quede en el registro
+    log_flush();
+    printf("Reproducción de %s: %zu paquetes, %lu procesados, %lu ignorados, %lu descartados por admisión\n", spec,
+           trace.count, (unsigned long)processed, (unsigned long)skipped, (unsigned long)dropped);
+    printf("Rendimiento: %.0f paquetes/s (%.1f ns por paquete)\n", processed > 0 ? processed / (ns / 1e9) : 0.0,
+           processed > 0 ? (double)ns / processed : 0.0);
+    if (allocations >= 0 && check_heap) {
+        printf("Memoria en régimen estable (segunda pasada): %ld reservas\n", (long)allocations);
+    } else if (allocations >= 0) {
+        printf("Memoria: %ld reservas, %.4f por paquete\n", (long)allocations,
+               processed > 0 ? (double)allocations / processed : 0.0);
+    } else {
+        printf("Memoria: reservas no contadas (compilado con AddressSanitizer)\n");
+    }
+    printf("Respuestas: %lu (%lu OFFER, %lu ACK, %lu NAK); resumen %016lx\n", (unsigned long)answered,
+           (unsigned long)metrics_read(&stats->counters[CNT_OFFER]),
+           (unsigned long)metrics_read(&stats->counters[CNT_ACK]),
+           (unsigned long)metrics_read(&stats->counters[CNT_NAK]), (unsigned long)hash);
+    replay_close(&trace);
+    if (check_heap && allocations != 0) {
+        fflush(stdout);
+        fprintf(stderr, "Error: el camino de DISCOVER/REQUEST reservó memoria en régimen estable\n");
+        return 2;
+    }
+    return 0;
+}
+
+// Banco de contención (-T): hilos lectores renuevan leases ya concedidos
+// mientras un hilo de fondo asigna y libera direcciones sin parar (DISCOVER,
+// REQUEST y RELEASE de MACs nuevas) y avanza la rueda una vez por segundo.
+struct bench_thread {
+    pthread_t thread;
+    struct worker_stats stats;
+    uint32_t seed;
+    int background;        // 1 para el hilo de fondo
+    uint64_t operations;   // Renovaciones, o ciclos completos en el hilo de fondo
+} __attribute__((aligned(64)));
+
+_Atomic int bench_stop;
+uint32_t bench_clients;      // Los lectores renuevan los clientes [0, bench_clients)
+uint32_t bench_next_client;  // Siguiente cliente nuevo del hilo de fondo
+
+void *bench_main(void *arg) {
+    struct bench_thread *bench = arg;
+    struct dhcp_packet request, reply;
+    struct timespec last_tick;
+    thread_stats = &bench->stats;
+    clock_gettime(CLOCK_MONOTONIC, &last_tick);
+    while (!atomic_load_explicit(&bench_stop, memory_order_relaxed)) {
+        if (!bench->background) {
+            bench->seed = bench->seed * 1103515245u + 12345u;
+            uint32_t client = (bench->seed >> 8) % bench_clients;
+            replay_build_request((uint8_t *)&request, client, bench->seed, DHCP_REQUEST);
+            process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply);
+            bench->operations++;
+            continue;
+        }
+        uint32_t client = bench_next_client++;
+        replay_build_request((uint8_t *)&request, client, client, DHCP_DISCOVER);
+        process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply);
+        replay_build_request((uint8_t *)&request, client, client, DHCP_REQUEST);
+        if (process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply) > 0 && reply.options[2] == DHCP_ACK) {
+            replay_build_request((uint8_t *)&request, client, client, DHCP_RELEASE);
+            request.ciaddr = reply.yiaddr;
+            process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply);
+        }
+        bench->operations++;
+        if ((bench->operations & 1023) == 0 && elapsed_ns(&last_tick) >= 1000000000ull) {
+            clock_gettime(CLOCK_MONOTONIC, &last_tick);
+            for (int s = 0; s < shard_count; s++) {
+                release_expired_shard(s, 1);
+            }
+        }
+    }
+    rcu_unregister();
+    return NULL;
+}
+
+// Una medida de BENCH_SECONDS con 'readers' lectores; deja en 'results' las
+// renovaciones/s, los ciclos/s del hilo de fondo y las esperas de mutex/s
+static int bench_run(struct bench_thread *threads, int readers, double results[3]) {
+    atomic_store(&bench_stop, 0);
+    for (int t = 0; t <= readers; t++) {
+        memset(&threads[t].stats, 0, sizeof(threads[t].stats));
+        threads[t].background = t == readers;
+        threads[t].operations = 0;
+        threads[t].seed = 0x9E3779B9u * (t + 1);
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t <= readers; t++) {
+        if (pthread_create(&threads[t].thread, NULL, bench_main, &threads[t]) != 0) {
+            perror("Error al crear un hilo del banco de contención");
+            atomic_store(&bench_stop, 1);
+            for (int u = 0; u < t; u++) {
+                pthread_join(threads[u].thread, NULL);
+            }
+            return -1;
+        }
+    }
+    struct timespec duration = { BENCH_SECONDS, 0 };
+    nanosleep(&duration, NULL);
+    atomic_store(&bench_stop, 1);
+    uint64_t renewals = 0, contended = 0;
+    for (int t = 0; t <= readers; t++) {
+        pthread_join(threads[t].thread, NULL);
+        renewals += threads[t].background ? 0 : threads[t].operations;
+        contended += metrics_read(&threads[t].stats.counters[CNT_LOCKS_CONTENDED]);
+    }
+    double seconds = elapsed_ns(&start) / 1e9;
+    results[0] = renewals / seconds;
+    results[1] = threads[readers].operations / seconds;
+    results[2] = contended / seconds;
+    return 0;
+}
+
+// Mide las renovaciones por segundo con 1, 2, 4... hasta 'max_readers'
+// lectores, con el mutex del pool y sin él, y comprueba al final que cada
+// cliente de los lectores conserva su dirección
+int run_contention_bench(int max_readers) {
+    uint32_t room = 0;
+    for (int p = 0; p < shard_count; p++) {
+        room += lease_pools[p].leases.max_capacity < lease_pools[p].bitmap.size ? lease_pools[p].leases.max_capacity
+                                                                               : lease_pools[p].bitmap.size;
+    }
+    bench_clients = room / 2 < BENCH_CLIENTS ? room / 2 : BENCH_CLIENTS;  // El resto queda para el hilo de fondo
+    bench_next_client = bench_clients;
+    struct bench_thread *threads = aligned_alloc(64, (max_readers + 1) * sizeof(struct bench_thread));
+    uint32_t *assigned = malloc((bench_clients + 1) * sizeof(uint32_t));
+    if (threads == NULL || assigned == NULL || bench_clients == 0) {
+        fprintf(stderr, "No se puede preparar el banco de contención (%u clientes)\n", bench_clients);
+        return 1;
+    }
+
+    // Conceder los leases que renovarán los lectores
+    struct dhcp_packet request, reply;
+    for (uint32_t c = 0; c < bench_clients; c++) {
+        replay_build_request((uint8_t *)&request, c, c, DHCP_DISCOVER);
+        process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply);
+        replay_build_request((uint8_t *)&request, c, c, DHCP_REQUEST);
+        assigned[c] = process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply) > 0 ? reply.yiaddr : 0;
+    }
+    LOG(LOG_INFO, "Banco de contención: %u leases de %s, hasta %d lectores, %d s por medida.", bench_clients,
+        subnets[0].name, max_readers, BENCH_SECONDS);
+
+    log_flush();
+    printf("%8s %16s %16s %14s %14s %12s %12s\n", "lectores", "renov/s mutex", "renov/s sin", "fondo/s mutex",
+           "fondo/s sin", "esperas/s", "esperas/s sin");
+    for (int readers = 1;; readers = readers * 2 < max_readers ? readers * 2 : max_readers) {
+        double locked[3], lockfree[3];
+        renew_without_lock = 0;
+        if (bench_run(threads, readers, locked) < 0) {
+            return 1;
+        }
+        renew_without_lock = 1;
+        if (bench_run(threads, readers, lockfree) < 0) {
+            return 1;
+        }
+        printf("%8d %16.0f %16.0f %14.0f %14.0f %12.0f %12.0f\n", readers, locked[0], lockfree[0], locked[1],
+               lockfree[1], locked[2], lockfree[2]);
+        fflush(stdout);
+        if (readers == max_readers) {
+            break;
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t c = 0; c < bench_clients; c++) {
+        replay_build_request((uint8_t *)&request, c, c, DHCP_REQUEST);
+        kept += assigned[c] != 0 && process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply) > 0 &&
+                reply.options[2] == DHCP_ACK && reply.yiaddr == assigned[c];
+    }
+    printf("Leases de los lectores intactos: %u de %u\n", kept, bench_clients);
+    free(assigned);
+    free(threads);
+    return kept == bench_clients ? 0 : 1;
+}
+
+// Banco del diario (-W N, con -j): ACKs por segundo con 1, 2, 4 y 8 hilos,
+// esperando a que cada registro sea durable y sin esperar (-E), con las
+// llamadas a fdatasync y los registros que entran en cada una; después llena
+// los pools hasta N leases, para el hilo de commit y mide la recuperación de
+// esos leases desde el diario y desde una instantánea.
+struct journal_bench_thread {
+    pthread_t thread;
+    struct worker_stats stats;
+    uint64_t acks;
+    struct timespec end;  // Cuándo terminó: sin esperar, el presupuesto se agota antes del segundo
+} __attribute__((aligned(64)));
+
+_Atomic uint32_t journal_bench_next;  // Siguiente cliente nuevo
+uint32_t journal_bench_limit;         // Primer cliente que ya no toca en esta medida
+
+void *journal_bench_main(void *arg) {
+    struct journal_bench_thread *bench = arg;
+    struct dhcp_packet request, reply;
+    thread_stats = &bench->stats;
+    while (!atomic_load_explicit(&bench_stop, memory_order_relaxed)) {
+        uint32_t client = atomic_fetch_add(&journal_bench_next, 1);
+        if (client >= journal_bench_limit) {
+            break;
+        }
+        replay_build_request((uint8_t *)&request, client, client, DHCP_DISCOVER);
+        process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        replay_build_request((uint8_t *)&request, client, client, DHCP_REQUEST);
+        if (process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply) > 0 && reply.options[2] == DHCP_ACK) {
+            journal_wait_durable();  // Donde el servidor enviaría la respuesta
+            metrics_add(&bench->stats.latency[latency_bucket(elapsed_ns(&start))], 1);
+            bench->acks++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &bench->end);
+    rcu_unregister();
+    return NULL;
+}
+
+static uint64_t journal_bench_syncs(void) {
+    uint64_t syncs = 0;
+    for (int p = 0; p < pool_count; p++) {
+        syncs += atomic_load_explicit(&lease_pools[p].journal.syncs, memory_order_relaxed);
+    }
+    return syncs;
+}
+
+static size_t journal_bench_leases(void) {
+    size_t leases = 0;
+    for (int p = 0; p < pool_count; p++) {
+        leases += lease_pools[p].leases.used;
+    }
+    return leases;
+}
+
+// Vuelve a crear los pools vacíos y los recupera del diario; devuelve los ms
+static double journal_bench_recover(uint32_t *generation) {
+    if (create_pools() < 0) {
+        return -1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *generation = journal_recover(journal_dir);
+    return elapsed_ns(&start) / 1e6;
+}
+
+int run_journal_bench(uint32_t target) {
+    static const int thread_counts[] = { 1, 2, 4, 8 };
+    if (journal_dir == NULL || journal_bench_leases() > 0) {
+        fprintf(stderr, "El banco del diario necesita -j con un directorio sin leases\n");
+        return 1;
+    }
+    size_t room = 0;
+    for (int p = 0; p < pool_count; p++) {
+        room += lease_pools[p].leases.max_capacity;
+    }
+    if (room < target) {
+        fprintf(stderr, "Los pools configurados solo admiten %zu leases; el banco del diario necesita %u (-c con "
+                        "un rango mayor)\n", room, target);
+        return 1;
+    }
+    struct journal_bench_thread *threads = aligned_alloc(64, 8 * sizeof(struct journal_bench_thread));
+    if (threads == NULL) {
+        perror("Error al asignar el banco del diario");
+        return 1;
+    }
+    uint32_t step = target / 16;  // Clientes como máximo por medida; el resto llena los pools
+    LOG(LOG_INFO, "Banco del diario en %s: hasta %u clientes por medida de %d s, %u leases en total.", journal_dir,
+        step, BENCH_SECONDS, target);
+    log_flush();
+    printf("%-10s %6s %10s %12s %14s %12s\n", "ACK", "hilos", "ACK/s", "fdatasync/s", "registros/sync",
+           "p99 ACK us");
+    for (int early = 0; early < 2; early++) {
+        config.early_ack = early;
+        for (size_t k = 0; k < sizeof(thread_counts) / sizeof(thread_counts[0]); k++) {
+            int count = thread_counts[k];
+            memset(threads, 0, count * sizeof(struct journal_bench_thread));
+            journal_bench_limit = atomic_load(&journal_bench_next) + step;
+            atomic_store(&bench_stop, 0);
+            uint64_t syncs = journal_bench_syncs();
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int t = 0; t < count; t++) {
+                if (pthread_create(&threads[t].thread, NULL, journal_bench_main, &threads[t]) != 0) {
+                    perror("Error al crear un hilo del banco del diario");
+                    free(threads);
+                    return 1;
+                }
+            }
+            struct timespec duration = { BENCH_SECONDS, 0 };
+            nanosleep(&duration, NULL);
+            atomic_store(&bench_stop, 1);
+            uint64_t acks = 0, latency[LAT_BUCKETS] = { 0 }, last = 0;
+            for (int t = 0; t < count; t++) {
+                pthread_join(threads[t].thread, NULL);
+                uint64_t ns = (threads[t].end.tv_sec - start.tv_sec) * 1000000000ULL + threads[t].end.tv_nsec -
+                              start.tv_nsec;
+                last = ns > last ? ns : last;
+                acks += threads[t].acks;
+                for (int b = 0; b < LAT_BUCKETS; b++) {
+                    latency[b] += metrics_read(&threads[t].stats.latency[b]);
+                }
+            }
+            double seconds = last / 1e9;
+            syncs = journal_bench_syncs() - syncs;
+            uint64_t seen = 0, p99 = 0;
+            for (int b = 0; b < LAT_BUCKETS && acks > 0; b++) {
+                seen += latency[b];
+                if (seen >= acks - acks / 100) {
+                    p99 = latency_bucket_value(b);
+                    break;
+                }
+            }
+            printf("%-10s %6d %10.0f %12.0f %14.1f %12.1f\n", early ? "sin esperar" : "durable", count, acks / seconds,
+                   syncs / seconds, syncs > 0 ? (double)acks / syncs : 0.0, p99 / 1e3);
+            fflush(stdout);
+        }
+    }
+
+    // Llenar hasta 'target' leases sin esperar, desde este hilo
+    struct dhcp_packet request, reply;
+    thread_stats = &worker_stats[0];
+    for (size_t leases = journal_bench_leases(); leases < target; leases++) {
+        uint32_t client = atomic_fetch_add(&journal_bench_next, 1);
+        replay_build_request((uint8_t *)&request, client, client, DHCP_DISCOVER);
+        process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply);
+        replay_build_request((uint8_t *)&request, client, client, DHCP_REQUEST);
+        if (process_dhcp_request(&request, REPLAY_PACKET_LEN, 0, &reply) == 0 || reply.options[2] != DHCP_ACK) {
+            fprintf(stderr, "Pools llenos con %zu leases\n", leases);
+            break;
+        }
+    }
+    size_t leases = journal_bench_leases();
+    journal_stop();  // Todo lo pendiente queda escrito
+
+    uint32_t generation = 0;
+    double from_journal = journal_bench_recover(&generation);
+    size_t recovered_journal = journal_bench_leases();
+    for (int p = 0; p < pool_count; p++) {
+        lease_pools[p].journal.generation = generation;
+        snapshot_pool(&lease_pools[p], p);
+    }
+    double from_snapshot = journal_bench_recover(&generation);
+    size_t recovered_snapshot = journal_bench_leases();
+    printf("Recuperación de %zu leases: %zu desde el diario en %.0f ms, %zu desde la instantánea en %.0f ms\n",
+           leases, recovered_journal, from_journal, recovered_snapshot, from_snapshot);
+    free(threads);
+    return recovered_journal == leases && recovered_snapshot == leases ? 0 : 1;
+}
+
+// Banco de ocupación (-F): compara la asignación por primera libre con la de
+// hash de chaddr sobre un mapa de bits del tamaño del rango de la primera
+// subred. Para cada ocupación (50, 90 y 99%) llena el rango y lo mantiene así
+// mientras clientes nuevos sustituyen a otros elegidos al azar; de esas
+// asignaciones mide las palabras del mapa miradas (p50, p90, p99 y máximo),
+// cuántas dieron la IP preferida y cuántas tuvieron que recorrer el rango.
+// Después simula un reinicio sin estado: los mismos clientes vuelven en otro
+// orden y se cuenta cuántos reciben la misma IP que antes.
+struct fill_client {
+    uint32_t id;  // Semilla de la MAC del cliente
+    uint32_t ip;
+};
+
+static uint64_t fill_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Asigna una IP al cliente 'id' con la política dada y la marca como ocupada.
+// Deja en 'probes' las palabras miradas y en 'preferred' si es la IP preferida.
+static uint32_t fill_allocate(struct ip_bitmap *bm, enum alloc_policy policy, uint32_t id, int *probes,
+                              int *preferred) {
+    // MAC al azar pero reproducible (splitmix64 del índice): con MACs
+    // consecutivas el hash las repartiría mejor que el azar y el banco saldría optimista
+    uint64_t bits = id + 0x9E3779B97F4A7C15ull;
+    bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ull;
+    bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBull;
+    bits ^= bits >> 31;
+    uint8_t mac[6];
+    memcpy(mac, &bits, 6);
+    uint32_t ip;
+    if (policy == ALLOC_FIRST_FIT) {
+        size_t from = bm->hint / 64;
+        ip = ip_bitmap_find(bm);
+        *probes = (int)(((ip - bm->base) / 64 + bm->nwords - from) % bm->nwords) + 1;
+        *preferred = 0;
+    } else {
+        uint32_t off = preferred_offset(client_hash(mac, NULL), bm->size);
+        ip = ip_bitmap_find_near(bm, off, probes);
+        *preferred = ip == bm->base + off;
+    }
+    ip_bitmap_take(bm, ip);
+    return ip;
+}
+
+// Percentil 'p' de un histograma de palabras miradas
+static int fill_percentile(const uint64_t *hist, size_t buckets, uint64_t total, double p) {
+    uint64_t target = (uint64_t)(total * p / 100.0), seen = 0;
+    for (size_t b = 0; b < buckets; b++) {
+        seen += hist[b];
+        if (seen > target) {
+            return (int)b;
+        }
+    }
+    return (int)buckets - 1;
+}
+
+// Escribe una longitud de sonda; con hash, más de HASH_MAX_PROBES es un recorrido del rango
+static const char *fill_probes(char *text, size_t len, int probes, enum alloc_policy policy) {
+    if (policy != ALLOC_FIRST_FIT && probes > HASH_MAX_PROBES) {
+        snprintf(text, len, ">%d", HASH_MAX_PROBES);
+    } else {
+        snprintf(text, len, "%d", probes);
+    }
+    return text;
+}
+
+int run_fill_bench(void) {
+    static const int fills[] = { 50, 90, 99 };
+    static const enum alloc_policy policies[] = { ALLOC_FIRST_FIT, ALLOC_HASH_MAC };
+    static const char *names[] = { "primera libre", "hash de MAC" };
+    uint32_t start = subnets[0].range_start, end = subnets[0].range_end, size = end - start + 1;
+    size_t buckets = size / 64 + HASH_MAX_PROBES + 3;
+    struct fill_client *clients = malloc(size * sizeof(struct fill_client));
+    uint32_t *order = malloc(size * sizeof(uint32_t));
+    uint64_t *hist = malloc(buckets * sizeof(uint64_t));
+    if (clients == NULL || order == NULL || hist == NULL) {
+        perror("Error al asignar el banco de ocupación");
+        return 1;
+    }
+    LOG(LOG_INFO, "Banco de ocupación: rango de %u direcciones de %s, %u sustituciones por medida.", size,
+        subnets[0].name, size);
+    log_flush();
+    printf("%9s %-14s %6s %6s %6s %6s %11s %11s %12s\n", "ocupación", "política", "p50", "p90", "p99", "máx",
+           "preferida", "recorridos", "misma IP");
+
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); f++) {
+        for (size_t k = 0; k < sizeof(policies) / sizeof(policies[0]); k++) {
+            enum alloc_policy policy = policies[k];
+            uint32_t live = (uint64_t)size * fills[f] / 100, next_id = 0;
+            struct ip_bitmap bm;
+            if (live == 0 || ip_bitmap_init(&bm, start, end) < 0) {
+                fprintf(stderr, "Rango demasiado pequeño o sin memoria para el banco de ocupación\n");
+                return 1;
+            }
+            int probes, preferred;
+            for (uint32_t c = 0; c < live; c++, next_id++) {
+                clients[c] = (struct fill_client){ next_id, fill_allocate(&bm, policy, next_id, &probes, &preferred) };
+            }
+
+            // Régimen estable: cada cliente nuevo sustituye a uno al azar
+            memset(hist, 0, buckets * sizeof(uint64_t));
+            uint64_t hits = 0, scans = 0;
+            for (uint32_t op = 0; op < size; op++, next_id++) {
+                uint32_t c = (uint32_t)(fill_random(&rng) % live);
+                ip_bitmap_put(&bm, clients[c].ip);
+                clients[c] = (struct fill_client){ next_id, fill_allocate(&bm, policy, next_id, &probes, &preferred) };
+                hist[probes < (int)buckets ? probes : (int)buckets - 1]++;
+                hits += preferred;
+                scans += policy != ALLOC_FIRST_FIT && probes > HASH_MAX_PROBES;
+            }
+
+            // Reinicio sin estado: los mismos clientes, en otro orden
+            free(bm.words);
+            if (ip_bitmap_init(&bm, start, end) < 0) {
+                perror("Error al asignar el banco de ocupación");
+                return 1;
+            }
+            for (uint32_t c = 0; c < live; c++) {
+                order[c] = c;
+            }
+            for (uint32_t c = live - 1; c > 0; c--) {
+                uint32_t other = (uint32_t)(fill_random(&rng) % (c + 1));
+                uint32_t swap = order[c];
+                order[c] = order[other];
+                order[other] = swap;
+            }
+            uint32_t same = 0;
+            for (uint32_t c = 0; c < live; c++) {
+                struct fill_client *client = &clients[order[c]];
+                same += fill_allocate(&bm, policy, client->id, &probes, &preferred) == client->ip;
+            }
+            free(bm.words);
+
+            char p50[12], p90[12], p99[12], max[12], hit[16] = "-", scan[16] = "-";
+            int top = (int)buckets - 1;
+            while (top > 0 && hist[top] == 0) {
+                top--;
+            }
+            if (policy != ALLOC_FIRST_FIT) {
+                snprintf(hit, sizeof(hit), "%.1f%%", 100.0 * hits / size);
+                snprintf(scan, sizeof(scan), "%.2f%%", 100.0 * scans / size);
+            }
+            printf("%8d%% %-14s %6s %6s %6s %6s %11s %11s %11.1f%%\n", fills[f], names[k],
+                   fill_probes(p50, sizeof(p50), fill_percentile(hist, buckets, size, 50), policy),
+                   fill_probes(p90, sizeof(p90), fill_percentile(hist, buckets, size, 90), policy),
+                   fill_probes(p99, sizeof(p99), fill_percentile(hist, buckets, size, 99), policy),
+                   fill_probes(max, sizeof(max), top, policy), hit, scan, 100.0 * same / live);
+        }
+    }
+    free(hist);
+    free(order);
+    free(clients);
+    return 0;
+}
+
+// Banco del índice MAC (-I): búsquedas de MACs presentes y ausentes en
+// índices de 10 a 1.000.000 leases, en orden aleatorio, frente al recorrido
+// lineal de la tabla que hacía antes find_ip_by_mac() (solo hasta 100.000,
+// después tardaría demasiado)
+static void index_bench_mac(uint32_t id, uint8_t *mac) {
+    uint64_t bits = id + 0x9E3779B97F4A7C15ull;  // splitmix64: MACs reproducibles y sin patrón
+    bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ull;
+    bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBull;
+    bits ^= bits >> 31;
+    memcpy(mac, &bits, 6);
+}
+
+// Buckets (líneas de caché) que recorre la búsqueda de una MAC presente
+static size_t index_bench_probes(const struct mac_index *index, const uint8_t *mac) {
+    uint64_t key = mac_key(mac);
+    size_t b = mac_hash(key) & index->mask, probes = 1;
+    for (;; b = (b + 1) & index->mask, probes++) {
+        for (int i = 0; i < INDEX_BUCKET_SLOTS; i++) {
+            if (index->buckets[b].key[i] == key) {
+                return probes;
+            }
+        }
+    }
+}
+
+int run_index_bench(void) {
+    uint8_t mac[6];
+    uint64_t sink = 0;
+    LOG(LOG_INFO, "Banco del índice MAC: %d búsquedas por medida, buckets de %d entradas al %d%% como máximo.",
+        INDEX_BENCH_LOOKUPS, INDEX_BUCKET_SLOTS, INDEX_MAX_LOAD_PCT);
+    log_flush();
+    printf("%9s %9s %12s %12s %13s %14s\n", "leases", "buckets", "ns presente", "ns ausente", "buckets/busq",
+           "ns lineal");
+    for (uint32_t n = 10; n <= 1000000; n *= 10) {
+        struct mac_index index;
+        uint8_t (*table)[6] = malloc((size_t)n * 6);
+        if (table == NULL || mac_index_init(&index, n) < 0) {
+            perror("Error al asignar el banco del índice MAC");
+            return 1;
+        }
+        for (uint32_t c = 0; c < n; c++) {
+            index_bench_mac(c, table[c]);
+            mac_index_insert(&index, table[c], c);
+        }
+        uint64_t probes = 0;
+        for (uint32_t c = 0; c < n; c++) {
+            probes += index_bench_probes(&index, table[c]);
+        }
+
+        // Presentes y ausentes (ids a partir de n), en orden pseudoaleatorio
+        double ns[2];
+        for (int absent = 0; absent < 2; absent++) {
+            uint32_t seed = 0x9E3779B9u;
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (uint32_t k = 0; k < INDEX_BENCH_LOOKUPS; k++) {
+                seed = seed * 1103515245u + 12345u;
+                index_bench_mac((uint32_t)(((uint64_t)seed * n) >> 32) + (absent ? n : 0), mac);
+                sink += (uint64_t)mac_index_lookup(&index, mac);
+            }
+            ns[absent] = (double)elapsed_ns(&start) / INDEX_BENCH_LOOKUPS;
+        }
+
+        // Recorrido lineal de las MACs, como la tabla ip_pool original
+        char linear[16] = "-";
+        if (n <= 100000) {
+            uint32_t lookups = 400000000u / n < INDEX_BENCH_LOOKUPS ? 400000000u / n : INDEX_BENCH_LOOKUPS;
+            uint32_t seed = 0x9E3779B9u;
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (uint32_t k = 0; k < lookups; k++) {
+                seed = seed * 1103515245u + 12345u;
+                index_bench_mac((uint32_t)(((uint64_t)seed * n) >> 32), mac);
+                for (uint32_t c = 0; c < n; c++) {
+                    if (memcmp(table[c], mac, 6) == 0) {
+                        sink += c;
+                        break;
+                    }
+                }
+            }
+            snprintf(linear, sizeof(linear), "%.1f", (double)elapsed_ns(&start) / lookups);
+        }
+        printf("%9u %9zu %12.1f %12.1f %13.3f %14s\n", n, index.mask + 1, ns[0], ns[1], (double)probes / n, linear);
+        fflush(stdout);
+        free(index.buckets);
+        free(index.spare);
+        free(table);
+    }
+    return sink == 0;  // Solo para que el compilador no descarte las búsquedas
+}
+
+// Banco de opciones (-X): comprueba el corpus de opciones malformadas y mide
+// lo que cuesta analizar un paquete y consultar las opciones que mira el
+// servidor (tipo, IP solicitada e identificador del servidor)
+static uint64_t options_bench_time(uint8_t *const *packets, const size_t *lens, size_t count, uint32_t *sink) {
+    struct dhcp_options opts;
+    uint32_t value;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t n = 0; n < OPTIONS_BENCH_PARSES; n++) {
+        size_t k = n % count;
+        dhcp_options_parse_packet(&opts, packets[k], lens[k]);
+        *sink += dhcp_message_type(&opts);
+        *sink += dhcp_option_get32(&opts, DHCP_OPT_REQUESTED_IP, &value) ? value : 0;
+        *sink += dhcp_option_get32(&opts, DHCP_OPT_SERVER_ID, &value) ? value : 0;
+    }
+    return elapsed_ns(&start);
+}
+
+int run_options_bench(void) {
+    // REQUEST como los de un cliente de escritorio: client-id, IP, servidor,
+    // nombre, lista de parámetros, tamaño máximo y clase de fabricante
+    static const uint8_t request_options[] = {
+        53, 1, 3, 61, 7, 1, 0x02, 0, 0, 0, 0, 1, 50, 4, 10, 0, 0, 1, 54, 4, 192, 168, 0, 1,
+        12, 8, 'p', 'o', 'r', 't', 'a', 't', 'i', 'l', 55, 13, 1, 3, 6, 15, 31, 33, 43, 44, 46, 47, 119, 121, 249,
+        57, 2, 0x05, 0xdc, 60, 8, 'M', 'S', 'F', 'T', ' ', '5', '.', '0', 255,
+    };
+    static uint8_t discover[REPLAY_PACKET_LEN], request[REPLAY_CORPUS_SLOT], padded[REPLAY_CORPUS_SLOT];
+    static uint8_t corpus[REPLAY_OPTIONS_CASES][REPLAY_CORPUS_SLOT];
+    int failures = replay_check_options();
+    if (failures > 0) {
+        fprintf(stderr, "%d de %zu casos del corpus de opciones fallan\n", failures, REPLAY_OPTIONS_CASES);
+        return 1;
+    }
+
+    replay_build_request(discover, 0, 0, DHCP_DISCOVER);
+    replay_build_request(request, 0, 0, DHCP_REQUEST);
+    memcpy(request + DHCP_OPTIONS_OFFSET, request_options, sizeof(request_options));
+    replay_build_request(padded, 0, 0, DHCP_DISCOVER);
+    memset(padded + DHCP_OPTIONS_OFFSET + 3, DHCP_OPT_PAD, REPLAY_CORPUS_SLOT - DHCP_OPTIONS_OFFSET - 4);
+    padded[REPLAY_CORPUS_SLOT - 1] = DHCP_OPT_END;
+    uint8_t *corpus_packets[REPLAY_OPTIONS_CASES];
+    size_t corpus_lens[REPLAY_OPTIONS_CASES];
+    for (size_t k = 0; k < REPLAY_OPTIONS_CASES; k++) {
+        corpus_packets[k] = corpus[k];
+        corpus_lens[k] = replay_build_options_case(corpus[k], &replay_options_corpus[k], (uint32_t)k);
+    }
+
+    struct {
+        const char *name;
+        uint8_t *packet;
+        size_t len;
+    } kinds[] = {
+        { "DISCOVER mínimo", discover, REPLAY_PACKET_LEN },
+        { "REQUEST de escritorio", request, DHCP_OPTIONS_OFFSET + sizeof(request_options) },
+        { "576 bytes con PAD", padded, REPLAY_CORPUS_SLOT },
+    };
+    uint32_t sink = 0;
+    LOG(LOG_INFO, "Banco de opciones: %zu casos del corpus correctos, %d análisis por medida.", REPLAY_OPTIONS_CASES,
+        OPTIONS_BENCH_PARSES);
+    log_flush();
+    printf("%-24s %8s %14s\n", "paquete", "bytes", "ns por paquete");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        uint64_t ns = options_bench_time(&kinds[k].packet, &kinds[k].len, 1, &sink);
+        printf("%-24s %8zu %14.1f\n", kinds[k].name, kinds[k].len, (double)ns / OPTIONS_BENCH_PARSES);
+    }
+    uint64_t ns = options_bench_time(corpus_packets, corpus_lens, REPLAY_OPTIONS_CASES, &sink);
+    printf("%-24s %8s %14.1f\n", "corpus malformado", "-", (double)ns / OPTIONS_BENCH_PARSES);
+    return sink == 0xFFFFFFFFu;  // Solo para que el compilador no descarte los análisis
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-w trabajadores] [-q tamaño_cola] [-b] [-B lote] [-r bytes] [-S fragmentos] [-j dir] [-m socket] [-l nivel] [-c fichero] [-A tasa[:ráfaga]] [-G tasa[:ráfaga]] [-O segundos] [-P traza [-Z]] [-T lectores] [-U] [-i interfaz]... [-a política] [-E] [-W leases] [-F] [-I] [-X]\n", prog);
+    fprintf(stderr, "  -w N  número de hilos trabajadores (por defecto %d)\n", DEFAULT_WORKERS);
+    fprintf(stderr, "  -q N  ranuras de la cola, potencia de 2 (por defecto %d)\n", DEFAULT_QUEUE_SIZE);
+    fprintf(stderr, "  -b    con la cola llena, esperar en vez de descartar\n");
+    fprintf(stderr, "  -B N  modo por lotes: hasta N datagramas por recvmmsg/sendmmsg, sin trabajadores\n");
+    fprintf(stderr, "  -r N  tamaño del buffer de recepción del socket (SO_RCVBUF) en bytes\n");
+    fprintf(stderr, "  -j DIR  persistir los leases en DIR (diario + instantáneas) y recuperarlos al arrancar\n");
+    fprintf(stderr, "  -E    con -j, enviar cada ACK sin esperar a que su registro sea durable (hasta %d ms de\n"
+                    "        leases que una caída puede olvidar y volver a dar a otro cliente)\n", JOURNAL_FLUSH_MS);
+    fprintf(stderr, "  -S N  modo fragmentado: N sockets SO_REUSEPORT con bucle y pool propios (0 = uno por núcleo)\n");
+    fprintf(stderr, "  -m PATH  exponer métricas de Prometheus en el socket Unix PATH\n");
+    fprintf(stderr, "  -l NIVEL  nivel de registro: error, warn, info (por defecto) o debug (un mensaje por paquete)\n");
+    fprintf(stderr, "  -c FILE  subredes a servir, elegidas por giaddr o por el interfaz de entrada\n");
+    fprintf(stderr, "  -A N[:R]  admitir N mensajes por segundo y MAC, con ráfagas de R (por defecto 2N; sin -A no hay límite)\n");
+    fprintf(stderr, "  -G N[:R]  admitir N DISCOVER por segundo y giaddr (el de los clientes directos es 0), con ráfagas de R\n");
+    fprintf(stderr, "  -O N  segundos que una IP ofrecida queda reservada esperando el REQUEST (por defecto %d)\n",
+            DEFAULT_OFFER_TTL);
+    fprintf(stderr, "  -P TRAZA  reproducir un pcap o synthetic:CLIENTES[:RENOVACIONES] sin sockets, medir y salir\n");
+    fprintf(stderr, "  -Z    con -P, reproducir la traza dos veces y fallar (salida 2) si la segunda pasada reserva memoria\n");
+    fprintf(stderr, "  -U    recibir y enviar con io_uring (buffers provistos, recvmsg multishot) en el hilo principal\n"
+                    "        o en cada fragmento; sin soporte del kernel se usa recvmmsg/sendmmsg\n");
+    fprintf(stderr, "  -i IFACE  modo captura: recibir del anillo TPACKET_V3 de IFACE (repetible, hasta %d) y responder\n"
+                    "            a los clientes sin dirección por su anillo de envío; incompatible con -S y -U\n",
+            RAW_MAX_INTERFACES);
+    fprintf(stderr, "  -a POL  IP de un cliente nuevo: first (primera libre, por defecto), mac (preferida según un hash\n"
+                    "          de chaddr, estable entre reinicios) o client-id (hash de la opción 61 si la envía)\n");
+    fprintf(stderr, "  -F    banco de ocupación: longitud de sonda y reasignación tras reinicio al 50, 90 y 99%%\n");
+    fprintf(stderr, "  -W N  con -j, banco del diario: ACK/s durables con 1 a 8 hilos y recuperación de N leases\n");
+    fprintf(stderr, "  -I    banco del índice MAC: coste de búsqueda de 10 a 1.000.000 leases\n");
+    fprintf(stderr, "  -X    banco de opciones: comprueba el corpus de opciones malformadas y mide el análisis\n");
+    fprintf(stderr, "  -T N  banco de contención: renovaciones/s con 1, 2, 4... N lectores y un flujo de DISCOVER de fondo\n");
+}
+
+// Lee un límite "tasa[:ráfaga]"; sin ráfaga se admite el doble de la tasa
+static int parse_rate(const char *text, double *rate, double *burst) {
+    char *end;
+    *rate = strtod(text, &end);
+    *burst = 2 * *rate;
+    if (*end == ':') {
+        *burst = strtod(end + 1, &end);
+    }
+    return (end == text || *end != '\0' || *rate < 0 || *burst < 0) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    const char *metrics_path = NULL;
+    const char *subnets_path = NULL;
+    const char *replay_spec = NULL;
+    const char *interfaces[RAW_MAX_INTERFACES];
+    int bench_readers = 0, check_heap = 0, fill_bench = 0, options_bench = 0, index_bench = 0;
+    uint32_t journal_bench = 0;
+    int level = LOG_INFO;
+    while ((opt = getopt(argc, argv, "w:q:bB:r:S:j:EW:m:l:c:A:G:O:P:ZT:Ui:a:FIXh")) != -1) {
+        switch (opt) {
+            case 'w':
+                config.workers = atoi(optarg);
+                break;
+            case 'q':
+                config.queue_size = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                config.backpressure = 1;
+                break;
+            case 'B':
+                config.batch_size = atoi(optarg);
+                break;
+            case 'r':
+                config.rcvbuf = atoi(optarg);
+                break;
+            case 'j':
+                journal_dir = optarg;
+                break;
+            case 'E':
+                config.early_ack = 1;
+                break;
+            case 'W':
+                journal_bench = strtoul(optarg, NULL, 10);
+                if (journal_bench == 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_path = optarg;
+                break;
+            case 'l':
+                if ((level = log_parse_level(optarg)) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                subnets_path = optarg;
+                break;
+            case 'A':
+                if (parse_rate(optarg, &config.mac_rate, &config.mac_burst) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'O':
+                config.offer_ttl = strtoul(optarg, NULL, 10);
+                break;
+            case 'G':
+                if (parse_rate(optarg, &config.relay_rate, &config.relay_burst) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                replay_spec = optarg;
+                break;
+            case 'Z':
+                check_heap = 1;
+                break;
+            case 'a':
+                if (strcmp(optarg, "first") == 0) {
+                    config.alloc_policy = ALLOC_FIRST_FIT;
+                } else if (strcmp(optarg, "mac") == 0) {
+                    config.alloc_policy = ALLOC_HASH_MAC;
+                } else if (strcmp(optarg, "client-id") == 0) {
+                    config.alloc_policy = ALLOC_HASH_CLIENT_ID;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'F':
+                fill_bench = 1;
+                break;
+            case 'I':
+                index_bench = 1;
+                break;
+            case 'X':
+                options_bench = 1;
+                break;
+            case 'U':
+                config.uring = 1;
+                break;
+            case 'i':
+                if (raw_port_count == RAW_MAX_INTERFACES) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                interfaces[raw_port_count++] = optarg;
+                break;
+            case 'T':
+                bench_readers = atoi(optarg);
+                if (bench_readers < 1 || bench_readers >= RCU_MAX_READERS) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'S':
+                config.shards = atoi(optarg);
+                if (config.shards == 0) {
+                    config.shards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (config.workers < 1 || config.offer_ttl < 1 || config.batch_size < 0 || config.shards < 0 || config.queue_size < 2 || (config.queue_size & (config.queue_size - 1)) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (check_heap && (replay_spec == NULL || replay_allocation_count() < 0)) {
+        fprintf(stderr, "-Z necesita -P y un binario que cuente las reservas (sin AddressSanitizer)\n");
+        return 1;
+    }
+    if (raw_port_count > 0 && (config.shards > 0 || config.uring)) {
+        fprintf(stderr, "El modo captura (-i) no se combina con -S ni con -U\n");
+        return 1;
+    }
+    // Registro asíncrono: los hilos del camino caliente solo copian registros binarios
+    if (log_start(level) < 0) {
+        perror("Error al arrancar el hilo de registro");
+        return 1;
+    }
+
+    int sock = -1;
+
+    // Subredes: las del fichero, o solo 192.168.0.0/24 con el rango de siempre
+    if (subnets_path != NULL) {
+        if (load_subnets(subnets_path) < 0) {
+            return 1;
+        }
+    } else {
+        add_subnet(ip_range_start & 0xFFFFFF00, 24, ip_range_start, ip_range_end, 0xC0A80001, 0x08080808, LEASE_TIME);
+    }
+    if (build_subnet_table() < 0) {
+        return 1;
+    }
+
+    if (create_pools() < 0) {
+        return 1;
+    }
+    if (subnets_path != NULL) {
+        LOG(LOG_INFO, "%d subredes cargadas de %s (%d pools, %zu nodos de búsqueda).", subnet_count, subnets_path,
+            pool_count, subnet_table.count);
+    }
+    if (journal_dir != NULL && journal_start(journal_dir) < 0) {
+        return 1;
+    }
+    report_lease_memory();
+
+    struct batch_ring batch_ring;
+    if (config.uring && config.batch_size == 0) {
+        config.batch_size = DEFAULT_SHARD_BATCH;  // Lote del camino clásico si io_uring no está disponible
+    }
+    stats_slots = config.shards > 0 ? config.shards : (config.batch_size > 0 || raw_port_count > 0) ? 1 : config.workers;
+    worker_stats = aligned_alloc(64, stats_slots * sizeof(struct worker_stats));
+    if (worker_stats == NULL) {
+        perror("Error al asignar estadísticas");
+        return 1;
+    }
+    memset(worker_stats, 0, stats_slots * sizeof(struct worker_stats));
+    // Control de admisión en cada hilo receptor. Con fragmentos el filtro BPF
+    // lleva cada MAC siempre al mismo, así que el límite por MAC es exacto; el
+    // de cada giaddr se reparte entre los fragmentos igual que sus MACs.
+    admission_count = config.shards > 0 ? config.shards : 1;
+    admissions = aligned_alloc(64, admission_count * sizeof(struct admission));
+    if (admissions == NULL) {
+        perror("Error al asignar el control de admisión");
+        return 1;
+    }
+    memset(admissions, 0, admission_count * sizeof(struct admission));
+    for (int a = 0; a < admission_count; a++) {
+        if (rate_sketch_init(&admissions[a].mac, RATE_MAC_BITS, config.mac_rate, config.mac_burst) < 0 ||
+            rate_sketch_init(&admissions[a].relay, RATE_RELAY_BITS, config.relay_rate / admission_count,
+                             config.relay_burst / admission_count) < 0) {
+            perror("Error al asignar el control de admisión");
+            return 1;
+        }
+    }
+    if (replay_spec != NULL) {
+        return run_replay(replay_spec, check_heap);
+    }
+    if (bench_readers > 0) {
+        return run_contention_bench(bench_readers);
+    }
+    if (journal_bench > 0) {
+        return run_journal_bench(journal_bench);
+    }
+    if (fill_bench) {
+        return run_fill_bench();
+    }
+    if (index_bench) {
+        return run_index_bench();
+    }
+    if (options_bench) {
+        return run_options_bench();
+    }
+    int metrics_fd = -1;
+    if (metrics_path != NULL && (metrics_fd = metrics_listen(metrics_path)) < 0) {
+        return 1;
+    }
+
+    if (config.shards > 0) {
+        // Modo fragmentado: un socket SO_REUSEPORT y un bucle por núcleo
+        if (config.batch_size == 0) {
+            config.batch_size = DEFAULT_SHARD_BATCH;
+        }
+        struct shard *shards = calloc(config.shards, sizeof(struct shard));
+        if (shards == NULL) {
+            perror("Error al asignar los fragmentos");
+            return 1;
+        }
+        for (int i = 0; i < config.shards; i++) {
+            shards[i].id = i;
+            shards[i].sock = open_server_socket(1);
+            if (batch_ring_init(&shards[i].ring, config.batch_size) < 0) {
+                perror("Error al asignar el anillo de lotes");
+                return 1;
+            }
+        }
+        if (attach_shard_filter(shards[0].sock, config.shards) < 0) {
+            // Sin filtro el kernel reparte por 4-tupla; cada paquete usa igualmente el pool de su MAC
+            perror("Aviso: no se pudo fijar el reparto por MAC");
+        }
+        for (int i = 0; i < config.shards; i++) {
+            pthread_t thread_id;
+            if (pthread_create(&thread_id, NULL, shard_main, &shards[i]) != 0) {
+                perror("Error al crear el hilo del fragmento");
+                return 1;
+            }
+            pthread_detach(thread_id);
+        }
+        LOG(LOG_INFO, "Servidor DHCP fragmentado en %d sockets SO_REUSEPORT.", config.shards);
+    } else if (raw_port_count > 0) {
+        // Modo captura: el hilo principal lee los anillos de todos los
+        // interfaces. El socket UDP solo envía las respuestas unicast; su
+        // filtro lo descarta todo para que nada se atienda dos veces, y seguir
+        // ligado al puerto evita que el kernel conteste con ICMP.
+        sock = open_server_socket(0);
+        if (raw_attach_drop_filter(sock) < 0) {
+            perror("Error al fijar el filtro del socket UDP");
+            return 1;
+        }
+        for (int i = 0; i < raw_port_count; i++) {
+            if (raw_port_open(&raw_ports[i], interfaces[i]) < 0) {
+                return 1;
+            }
+            LOG(LOG_INFO, "Capturando en %s (%I), anillo de %d bloques de %d KiB.", raw_ports[i].name,
+                raw_ports[i].addr, RAW_RX_BLOCKS, RAW_BLOCK_SIZE / 1024);
+        }
+        thread_stats = &worker_stats[0];
+    } else if (config.batch_size > 0) {
+        // Modo por lotes: el hilo principal recibe, procesa y responde
+        sock = open_server_socket(0);
+        if (batch_ring_init(&batch_ring, config.batch_size) < 0) {
+            perror("Error al asignar el anillo de lotes");
+            return 1;
+        }
+        thread_stats = &worker_stats[0];  // El hilo principal hace de único trabajador
+        if (config.uring) {
+            LOG(LOG_INFO, "Servidor DHCP en un hilo con io_uring (%d buffers de recepción).", URING_BUFFERS);
+        } else {
+            LOG(LOG_INFO, "Servidor DHCP en modo por lotes de %d datagramas.", config.batch_size);
+        }
+    } else {
+        // Preasignar la cola y arrancar el pool fijo de trabajadores
+        sock = open_server_socket(0);
+        // Buffers en uso como mucho: los encolados (una ranura menos que la cola,
+        // la que el receptor tiene reservada), uno por trabajador en proceso y
+        // SLAB_BATCH - 1 en la lista de cada trabajador; con uno más al
+        // receptor nunca le falta buffer mientras haya ranura
+        if (queue_init(&request_queue, config.queue_size) < 0 ||
+            slab_init(&packet_slab, config.queue_size + (size_t)config.workers * SLAB_BATCH + 1) < 0) {
+            perror("Error al asignar la cola de solicitudes");
+            return 1;
+        }
+        for (int i = 0; i < config.workers; i++) {
+            pthread_t thread_id;
+            if (pthread_create(&thread_id, NULL, worker_main, (void *)(intptr_t)i) != 0) {
+                perror("Error al crear el hilo trabajador");
+                return 1;
+            }
+            pthread_detach(thread_id);
+        }
+        LOG(LOG_INFO, "Servidor DHCP con %d trabajadores y cola de %zu ranuras.", config.workers, config.queue_size);
+    }
+
+    // Temporizador de un segundo que hace avanzar la rueda de leases
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        perror("Error al crear timerfd");
+        return 1;
+    }
+    struct itimerspec tick = { { 1, 0 }, { 1, 0 } };
+    timerfd_settime(timer_fd, 0, &tick, NULL);
+
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    if (config.uring && sock >= 0 && uring_serve(sock, 0, timer_fd, metrics_fd, 1) < 0) {
+        perror("Aviso: io_uring no disponible, se usa recvmmsg");
+    }
+    if (raw_port_count > 0) {
+        raw_serve(sock, timer_fd, metrics_fd);
+    }
+    int maxfd = sock > timer_fd ? sock : timer_fd;
+    maxfd = metrics_fd > maxfd ? metrics_fd : maxfd;
+
+    while (1) {
+        fd_set read_fds;
+
+        FD_ZERO(&read_fds);
+        if (sock >= 0) {
+            FD_SET(sock, &read_fds);  // En modo fragmentado este hilo solo reporta
+        }
+        FD_SET(timer_fd, &read_fds);
+        if (metrics_fd >= 0) {
+            FD_SET(metrics_fd, &read_fds);
+        }
+
+        int activity = select(maxfd + 1, &read_fds, NULL, NULL, NULL);
+        if (sock >= 0) {
+            metrics_add(&receiver_syscalls, 1);
+        }
+
+        if (activity < 0) {
+            if (errno != EINTR) {
+                perror("select error");
+            }
+            continue;
+        }
+
+        if (FD_ISSET(timer_fd, &read_fds)) {
+            uint64_t ticks;
+            if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks) && config.shards == 0) {
+                release_expired_shard(0, ticks);
+            }
+
+            uint64_t since_report = elapsed_ns(&last_report);
+            if (since_report >= STATS_INTERVAL * 1000000000ull) {
+                report_stats(since_report / 1e9);
+                clock_gettime(CLOCK_MONOTONIC, &last_report);
+            }
+        }
+
+        if (metrics_fd >= 0 && FD_ISSET(metrics_fd, &read_fds)) {
+            metrics_serve(metrics_fd, write_server_metrics);
+        }
+
+        if (sock < 0) {
+            continue;
+        }
+        if (FD_ISSET(sock, &read_fds) && config.batch_size > 0) {
+            process_batches(sock, &batch_ring, &worker_stats[0], &admissions[0]);
+        } else if (FD_ISSET(sock, &read_fds)) {
+            // Reservar una ranura preasignada de la cola para el paquete
+            size_t pos;
+            struct queue_slot *slot;
+            while ((slot = queue_claim(&request_queue, &pos)) == NULL && config.backpressure) {
+                sched_yield();  // Dejar que los trabajadores vacíen la cola
+            }
+
+            uint32_t handle = slot != NULL ? slab_get(&packet_slab) : SLAB_NONE;
+            if (handle == SLAB_NONE) {
+                // Cola llena: descartar el datagrama sin procesarlo. Con el slab
+                // dimensionado en main() siempre hay buffer si hay ranura; si no,
+                // la ranura se publica vacía y el trabajador la ignora.
+                if (slot != NULL) {
+                    slot->buffer = SLAB_NONE;
+                    queue_publish(&request_queue, slot, pos);
+                }
+                struct dhcp_packet discard;
+                recv(sock, &discard, sizeof(discard), 0);
+                metrics_add(&receiver_syscalls, 1);
+                atomic_fetch_add_explicit(&request_queue.dropped, 1, memory_order_relaxed);
+                continue;
+            }
+
+            // El datagrama se recibe directamente en el buffer; por la cola solo va su índice
+            slot->buffer = handle;
+            struct client_request *request = &packet_slab.buffers[handle].request;
+            request->sock = sock;
+
+            uint8_t control[PKTINFO_CONTROL_LEN] __attribute__((aligned(8)));
+            struct iovec iov = { &request->dhcp_request, sizeof(request->dhcp_request) };
+            struct msghdr msg = { .msg_name = &request->client_addr, .msg_namelen = sizeof(struct sockaddr_in),
+                                  .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control,
+                                  .msg_controllen = sizeof(control) };
+            request->recv_len = recvmsg(sock, &msg, 0);
+            metrics_add(&receiver_syscalls, 1);
+            clock_gettime(CLOCK_MONOTONIC, &request->recv_time);
+            // Lo que supera su límite se descarta aquí y la ranura se reutiliza
+            // con el siguiente datagrama ya encolado, sin despertar a nadie
+            for (int drained = 0; request->recv_len > 0 &&
+                 !admit_request(&admissions[0], &request->dhcp_request, request->recv_len,
+                                timespec_ns(&request->recv_time)); drained++) {
+                if (drained == RATE_DRAIN_MAX) {
+                    request->recv_len = 0;  // Volver al bucle de eventos; el trabajador ignora la ranura
+                    break;
+                }
+                msg.msg_namelen = sizeof(struct sockaddr_in);
+                msg.msg_controllen = sizeof(control);
+                request->recv_len = recvmsg(sock, &msg, MSG_DONTWAIT);
+                metrics_add(&receiver_syscalls, 1);
+                if (request->recv_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    request->recv_len = 0;  // No queda nada: la ranura se publica vacía
+                }
+                clock_gettime(CLOCK_MONOTONIC, &request->recv_time);
+            }
+            request->client_addr_len = msg.msg_namelen;
+            request->local_addr = request->recv_len >= 0 ? packet_local_addr(&msg) : 0;
+            if (request->recv_len < 0) {
+                perror("Error al recibir datos");
+                // La ranura ya está reservada: se publica vacía y el trabajador la ignora
+            }
+
+            // Entregar la solicitud a un trabajador del pool
+            queue_publish(&request_queue, slot, pos);
         }
     }
 
-    // Cerrar el socket y destruir el mutex
+    // Cerrar el socket
+    close(timer_fd);
     close(sock);
-    pthread_mutex_destroy(&pool_mutex);
 
     return 0;
 }
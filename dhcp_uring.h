@@ -0,0 +1,328 @@
+// Backend de E/S con io_uring compartido por el servidor y el relay.
+//
+// Se usan directamente las llamadas io_uring_setup, io_uring_enter e
+// io_uring_register (sin liburing): los anillos de envío y de completado se
+// proyectan con mmap y se leen y escriben con cargas y almacenamientos
+// atómicos, como hace el kernel al otro lado.
+//
+// La recepción es un único recvmsg "multishot" que el kernel mantiene armado:
+// cada datagrama llega a un buffer de un anillo de buffers provistos
+// registrado de antemano y genera un completado con el número de buffer, sin
+// ninguna llamada al sistema por paquete. Cada buffer contiene, en este orden,
+// la cabecera io_uring_recvmsg_out, la dirección de origen, los datos
+// auxiliares y el datagrama, así que el paquete queda en un sitio fijo
+// preasignado. Los envíos se encolan como sendmsg y se publican todos juntos
+// en la siguiente llamada a io_uring_enter, que además recoge los completados.
+//
+// Hace falta Linux 6.0 o posterior (recvmsg multishot con buffers provistos).
+// uring_init() devuelve -1 si el kernel no tiene io_uring o lo tiene
+// deshabilitado, y el primer recvmsg termina con -EINVAL si no admite el modo
+// multishot; en ambos casos el llamante vuelve al camino clásico de sockets.
+#ifndef DHCP_URING_H
+#define DHCP_URING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+// Etiqueta de cada operación en user_data: tipo en los 32 bits altos, índice en los bajos
+#define URING_DATA(tag, index) (((uint64_t)(tag) << 32) | (uint32_t)(index))
+#define URING_TAG(data) ((uint32_t)((data) >> 32))
+#define URING_INDEX(data) ((uint32_t)(data))
+
+// Posición del datagrama dentro de un buffer de recepción
+#define URING_PAYLOAD_OFFSET(namelen, controllen) (sizeof(struct io_uring_recvmsg_out) + (namelen) + (controllen))
+
+struct uring {
+    int fd;
+    unsigned features;
+    // Anillo de envío
+    _Atomic uint32_t *sq_head;
+    _Atomic uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_local_tail;  // SQEs preparadas, aún no publicadas al kernel
+    uint32_t sq_submitted;   // Hasta dónde se han publicado
+    struct io_uring_sqe *sqes;
+    // Anillo de completado
+    _Atomic uint32_t *cq_head;
+    _Atomic uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    // Proyecciones a deshacer al cerrar
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+    // Anillo de buffers provistos para la recepción
+    struct io_uring_buf_ring *buf_ring;
+    uint8_t *buffers;
+    size_t buf_ring_len;
+    uint32_t buf_size;
+    uint32_t buf_mask;
+    uint16_t buf_tail;  // Buffers devueltos, publicados en la siguiente entrada al kernel
+    uint16_t buf_group;
+};
+
+static inline void uring_close(struct uring *ring) {
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_ring_len);
+    }
+    free(ring->buffers);
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static inline int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+// Crea un anillo de 'entries' SQEs y 'cq_entries' completados (potencias de 2).
+// Pide un único hilo emisor y que el kernel solo complete operaciones dentro de
+// io_uring_enter, que es justo como se usa; si el kernel no conoce esas
+// opciones se repite sin ellas. Devuelve -1 con errno si no hay io_uring.
+static inline int uring_init(struct uring *ring, unsigned entries, unsigned cq_entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    static const unsigned flag_sets[] = {
+        IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_CQSIZE,
+    };
+    struct io_uring_params params;
+    for (size_t i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]) && ring->fd < 0; i++) {
+        memset(&params, 0, sizeof(params));
+        params.flags = flag_sets[i];
+        params.cq_entries = cq_entries;
+        ring->fd = uring_setup(entries, &params);
+        if (ring->fd < 0 && errno != EINVAL) {
+            return -1;  // ENOSYS, EPERM (io_uring_disabled), ENOMEM...
+        }
+    }
+    if (ring->fd < 0) {
+        return -1;
+    }
+    ring->features = params.features;
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_len > ring->sq_map_len) {
+            ring->sq_map_len = ring->cq_map_len;
+        }
+        ring->cq_map_len = ring->sq_map_len;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        uring_close(ring);
+        return -1;
+    }
+    if (ring->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            uring_close(ring);
+            return -1;
+        }
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_close(ring);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (_Atomic uint32_t *)(sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic uint32_t *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    ring->cq_head = (_Atomic uint32_t *)(cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic uint32_t *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    // El array de índices es la identidad: la SQE i siempre ocupa la posición i
+    uint32_t *array = (uint32_t *)(sq + params.sq_off.array);
+    for (uint32_t i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    ring->sq_local_tail = ring->sq_submitted = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    return 0;
+}
+
+// Registra 'count' buffers de recepción de 'size' bytes (count potencia de 2)
+// como grupo 'group' y los entrega todos al kernel
+static inline int uring_buffers_init(struct uring *ring, uint32_t count, uint32_t size, uint16_t group) {
+    ring->buf_ring_len = count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    size = (size + 63) & ~63u;  // Cada buffer empieza en su propia línea de caché
+    ring->buffers = aligned_alloc(64, (size_t)count * size);
+    if (ring->buffers == NULL) {
+        return -1;
+    }
+    ring->buf_size = size;
+    ring->buf_mask = count - 1;
+    ring->buf_group = group;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+    ring->buf_tail = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail++ & ring->buf_mask];
+        buf->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)i * size);
+        buf->len = size;
+        buf->bid = (uint16_t)i;
+    }
+    atomic_store_explicit((_Atomic uint16_t *)&ring->buf_ring->tail, ring->buf_tail, memory_order_release);
+    return 0;
+}
+
+static inline uint8_t *uring_buffer(const struct uring *ring, uint32_t bid) {
+    return ring->buffers + (size_t)bid * ring->buf_size;
+}
+
+// Devuelve un buffer al anillo; el kernel lo verá en la siguiente uring_submit()
+static inline void uring_buffer_recycle(struct uring *ring, uint32_t bid) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail++ & ring->buf_mask];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(ring, bid);
+    buf->len = ring->buf_size;
+    buf->bid = (uint16_t)bid;
+}
+
+// Siguiente SQE libre, ya limpia, o NULL si el anillo de envío está lleno
+static inline struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    uint32_t head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    if (ring->sq_local_tail - head > ring->sq_mask) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail++ & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Publica las SQEs preparadas y los buffers devueltos y entra en el kernel
+// para enviarlas, esperando hasta tener 'wait' completados. Es la única
+// llamada al sistema del bucle. Devuelve -1 con errno si falla.
+static inline int uring_submit(struct uring *ring, unsigned wait) {
+    atomic_store_explicit((_Atomic uint16_t *)&ring->buf_ring->tail, ring->buf_tail, memory_order_release);
+    uint32_t pending = ring->sq_local_tail - ring->sq_submitted;
+    atomic_store_explicit(ring->sq_tail, ring->sq_local_tail, memory_order_release);
+    ring->sq_submitted = ring->sq_local_tail;
+    // GETEVENTS siempre: con DEFER_TASKRUN los completados solo se generan aquí
+    int ret = (int)syscall(__NR_io_uring_enter, ring->fd, pending, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+    return ret < 0 ? -1 : ret;
+}
+
+// Siguiente completado sin consumir, o NULL si no hay
+static inline struct io_uring_cqe *uring_peek(struct uring *ring) {
+    uint32_t head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *ring) {
+    uint32_t head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+}
+
+// recvmsg multishot sobre 'fd' con buffers del grupo registrado. 'msg' solo
+// indica cuánto reservar para la dirección y los datos auxiliares, y debe
+// seguir vivo mientras la operación esté armada.
+static inline void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, const struct uring *ring, int fd,
+                                                struct msghdr *msg, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = ring->buf_group;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+// 'msg' y lo que apunta deben vivir hasta el completado del envío
+static inline void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+}
+
+// Aviso multishot de que 'fd' es legible (temporizadores y socket de métricas)
+static inline void uring_prep_poll_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = user_data;
+}
+
+// Número de buffer de un completado de recepción, o -1 si no usó ninguno
+static inline int uring_cqe_buffer(const struct io_uring_cqe *cqe) {
+    return (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+}
+
+// Localiza las partes de un datagrama recibido en 'buffer' ('res' bytes usados)
+// por un recvmsg multishot armado con 'msg'. Devuelve la longitud del
+// datagrama (recortada a lo recibido y a 'max_len') o -1 si el buffer no es válido.
+static inline ssize_t uring_recvmsg_parse(uint8_t *buffer, int res, const struct msghdr *msg, size_t max_len,
+                                          struct io_uring_recvmsg_out **out, uint8_t **payload) {
+    size_t header = URING_PAYLOAD_OFFSET(msg->msg_namelen, msg->msg_controllen);
+    if (res < 0 || (size_t)res < header) {
+        return -1;
+    }
+    *out = (struct io_uring_recvmsg_out *)buffer;
+    *payload = buffer + header;
+    size_t len = (*out)->payloadlen;
+    if (len > (size_t)res - header) {
+        len = (size_t)res - header;
+    }
+    return (ssize_t)(len < max_len ? len : max_len);
+}
+
+#endif